@@ -0,0 +1,72 @@
+#ifndef LIBPX_BENCH_BENCH_HPP
+#define LIBPX_BENCH_BENCH_HPP
+
+#include <chrono>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace px {
+
+/// Sets whether or not strokes with a pixel size greater than one are
+/// painted as horizontal spans, when the result is the same as stamping
+/// a square at every point. This is on by default and affects all
+/// documents. It's only defined when libpx is built with LIBPX_BENCH.
+///
+/// @param enabled Whether or not to paint strokes as spans.
+void setStrokeSpans(bool enabled) noexcept;
+
+namespace bench {
+
+/// A small, deterministic random number generator.
+/// This keeps the generated documents the same between runs.
+class Random final
+{
+  /// The current state of the generator.
+  std::uint32_t state = 1;
+public:
+  constexpr Random(std::uint32_t seed = 1) noexcept : state(seed ? seed : 1) {}
+  /// Generates a number in the range [0, n).
+  int operator () (int n) noexcept
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return int(state % std::uint32_t(n));
+  }
+};
+
+/// Calls a function several times and measures the fastest call.
+///
+/// @param iterations The number of times to call @p func.
+/// @param func The function to measure.
+///
+/// @return The fastest call, in milliseconds.
+template <typename Functor>
+double measure(std::size_t iterations, Functor func)
+{
+  using Clock = std::chrono::steady_clock;
+
+  double best = 0;
+
+  for (std::size_t i = 0; i < iterations; i++) {
+
+    auto start = Clock::now();
+
+    func();
+
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+
+    if ((i == 0) || (elapsed.count() < best)) {
+      best = elapsed.count();
+    }
+  }
+
+  return best;
+}
+
+} // namespace bench
+
+} // namespace px
+
+#endif // LIBPX_BENCH_BENCH_HPP
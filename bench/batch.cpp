@@ -0,0 +1,185 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+/// The number of lines in the generated documents.
+constexpr int lineCount = 100000;
+
+/// The number of points in each line.
+constexpr int pointsPerLine = 16;
+
+/// Generates the points of the lines, the way
+/// that a procedural generator or importer would.
+std::vector<int> makePoints()
+{
+  px::bench::Random random;
+
+  std::vector<int> points(std::size_t(lineCount) * pointsPerLine * 2);
+
+  for (auto& p : points) {
+    p = random(1024);
+  }
+
+  return points;
+}
+
+/// Builds a document one node and one point at a time.
+px::Document* buildSingle(const std::vector<int>& points)
+{
+  auto* doc = px::createDoc();
+
+  const int* xy = points.data();
+
+  for (int i = 0; i < lineCount; i++) {
+
+    auto* line = px::addLine(doc);
+
+    for (int j = 0; j < pointsPerLine; j++, xy += 2) {
+      px::addPoint(line, xy[0], xy[1]);
+    }
+  }
+
+  return doc;
+}
+
+/// Builds a document with the batch functions.
+px::Document* buildBatch(const std::vector<int>& points)
+{
+  auto* doc = px::createDoc();
+
+  std::vector<px::Line*> lines(lineCount);
+
+  px::addLines(doc, lines.size(), lines.data());
+
+  for (int i = 0; i < lineCount; i++) {
+    px::addPoints(lines[std::size_t(i)], &points[std::size_t(i) * pointsPerLine * 2], pointsPerLine);
+  }
+
+  return doc;
+}
+
+/// Checks that two documents have the same lines.
+bool sameLines(px::Document* a, px::Document* b)
+{
+  auto* layerA = px::getLayer(a, 0);
+  auto* layerB = px::getLayer(b, 0);
+
+  if (px::getNodeCount(layerA) != px::getNodeCount(layerB)) {
+    return false;
+  }
+
+  for (std::size_t i = 0; i < px::getNodeCount(layerA); i++) {
+
+    const auto* lineA = px::getLine(layerA, i);
+    const auto* lineB = px::getLine(layerB, i);
+
+    if (!lineA || !lineB || (px::getPointCount(lineA) != px::getPointCount(lineB))) {
+      return false;
+    }
+
+    for (std::size_t j = 0; j < px::getPointCount(lineA); j++) {
+      if ((px::getPointX(lineA, j) != px::getPointX(lineB, j))
+       || (px::getPointY(lineA, j) != px::getPointY(lineB, j))) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/// Draws a long stroke the way the pen tool does,
+/// dissolving the line after every new point.
+///
+/// @param incremental Whether to only dissolve the new points.
+px::Document* drawStroke(int pointCount, bool incremental)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  auto* line = px::addLine(doc);
+
+  int x = 0;
+  int y = 0;
+
+  for (int i = 0; i < pointCount; i++) {
+
+    // Mostly straight runs, so that some points are dissolved.
+    if (random(4) == 0) {
+      x += random(3) - 1;
+      y += random(3) - 1;
+    } else {
+      x++;
+    }
+
+    auto first = px::getPointCount(line);
+
+    px::addPoint(line, x, y);
+
+    if (incremental) {
+      px::dissolvePoints(line, first);
+    } else {
+      px::dissolvePoints(line);
+    }
+  }
+
+  return doc;
+}
+
+} // namespace
+
+int main()
+{
+  auto points = makePoints();
+
+  px::Document* single = nullptr;
+  px::Document* batch = nullptr;
+
+  auto singleTime = px::bench::measure(3, [&points, &single]() {
+    px::closeDoc(single);
+    single = buildSingle(points);
+  });
+
+  auto batchTime = px::bench::measure(3, [&points, &batch]() {
+    px::closeDoc(batch);
+    batch = buildBatch(points);
+  });
+
+  auto identical = sameLines(single, batch);
+
+  px::closeDoc(single);
+  px::closeDoc(batch);
+
+  int strokePoints = 20000;
+
+  px::Document* full = nullptr;
+  px::Document* incremental = nullptr;
+
+  auto fullTime = px::bench::measure(1, [strokePoints, &full]() {
+    full = drawStroke(strokePoints, false);
+  });
+
+  auto incrementalTime = px::bench::measure(1, [strokePoints, &incremental]() {
+    incremental = drawStroke(strokePoints, true);
+  });
+
+  auto identicalStrokes = sameLines(full, incremental);
+
+  px::closeDoc(full);
+  px::closeDoc(incremental);
+
+  std::printf("%-36s %10s %10s\n", "", "single", "batch");
+  std::printf("%-36s %10.2f %10.2f\n", "build 100k lines, 16 points (ms)", singleTime, batchTime);
+  std::printf("%-36s %10.2f %10.2f\n", "stroke of 20k points (ms)", fullTime, incrementalTime);
+  std::printf("identical: %s\n", (identical && identicalStrokes) ? "yes" : "no");
+
+  return (identical && identicalStrokes) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <string>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// Builds a document with every type of node,
+/// with most of the data being in lines.
+px::Document* makeDoc(int lineCount)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, 1024, 768);
+
+  px::setBackground(doc, 0.25f, 0.5f, 0.75f, 1);
+
+  for (std::size_t l = 0; l < 3; l++) {
+
+    if (l > 0) {
+      px::addLayer(doc);
+    }
+
+    auto* layer = px::getLayer(doc, l);
+
+    px::setLayerName(layer, (l == 1) ? "Quoted \"layer\" \\ name" : "Layer");
+    px::setLayerOpacity(layer, random(256) / 255.0f);
+    px::setLayerVisibility(layer, l != 2);
+
+    for (int i = 0; i < lineCount; i++) {
+
+      auto* line = px::addLine(doc, l);
+
+      px::setPixelSize(line, 1 + random(8));
+      px::setBlendMode(line, random(4) ? px::BlendMode::Normal : px::BlendMode::Subtract);
+      px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f);
+
+      int x = random(1024);
+      int y = random(768);
+
+      for (int j = 0; j < 32; j++) {
+        x += random(33) - 16;
+        y += random(33) - 16;
+        px::addPoint(line, x, y);
+      }
+    }
+
+    auto* ellipse = px::addEllipse(doc, l);
+    px::setCenter(ellipse, -random(100), random(100));
+    px::setRadius(ellipse, random(50), -random(50));
+    px::setColor(ellipse, 1, 0, 0, 0.5f);
+
+    auto* quad = px::addQuad(doc, l);
+    px::setPoint(quad, 0, -2000000000, 2000000000);
+    px::setPoint(quad, 2, 2000000000, -2000000000);
+    px::setPixelSize(quad, 3);
+
+    auto* fill = px::addFill(doc, l);
+    px::setFillOrigin(fill, random(1024), random(768));
+    px::setBlendMode(fill, px::BlendMode::Subtract);
+    px::setColor(fill, 0, 1, 0, 1);
+  }
+
+  return doc;
+}
+
+/// Encodes a document as text, so that documents can be compared.
+std::string toText(const px::Document* doc)
+{
+  void* data = nullptr;
+  std::size_t size = 0;
+
+  px::saveDoc(doc, &data, &size);
+
+  std::string text(static_cast<const char*>(data), size);
+
+  std::free(data);
+
+  return text;
+}
+
+/// Saves and opens a document, measuring both operations.
+///
+/// @param reopened Receives the opened document.
+/// @param saveTime Receives the time taken to save, in milliseconds.
+/// @param openTime Receives the time taken to open, in milliseconds.
+///
+/// @return The number of bytes in the saved document.
+std::size_t roundTrip(const px::Document* doc, px::DocFormat format, px::Document* reopened, double& saveTime, double& openTime)
+{
+  void* data = nullptr;
+  std::size_t size = 0;
+
+  saveTime = px::bench::measure(3, [&]() {
+    std::free(data);
+    px::saveDoc(doc, &data, &size, format);
+  });
+
+  int result = 0;
+
+  openTime = px::bench::measure(3, [&]() { result = px::openDoc(reopened, data, size); });
+
+  std::free(data);
+
+  return (result == 0) ? size : 0;
+}
+
+} // namespace
+
+int main()
+{
+  auto* doc = makeDoc(5000);
+
+  auto* fromText = px::createDoc();
+  auto* fromBinary = px::createDoc();
+
+  double textSave = 0;
+  double textOpen = 0;
+  double binarySave = 0;
+  double binaryOpen = 0;
+
+  auto textSize = roundTrip(doc, px::DocFormat::Text, fromText, textSave, textOpen);
+  auto binarySize = roundTrip(doc, px::DocFormat::Binary, fromBinary, binarySave, binaryOpen);
+
+  // Both formats quantize colors the same way,
+  // so they should open to the same document.
+  auto expected = toText(fromText);
+  auto identical = (textSize > 0) && (binarySize > 0) && (toText(fromBinary) == expected);
+
+  // A binary document that is truncated should fail to open.
+  void* data = nullptr;
+  std::size_t size = 0;
+  px::saveDoc(fromBinary, &data, &size, px::DocFormat::Binary);
+  auto truncatedFails = px::openDoc(fromBinary, data, size / 2) == EINVAL;
+  std::free(data);
+
+  std::printf("%-8s %12s %10s %10s\n", "format", "size (KiB)", "save (ms)", "open (ms)");
+  std::printf("%-8s %12.1f %10.2f %10.2f\n", "text", textSize / 1024.0, textSave, textOpen);
+  std::printf("%-8s %12.1f %10.2f %10.2f\n", "binary", binarySize / 1024.0, binarySave, binaryOpen);
+  std::printf("round trip identical: %s\n", identical ? "yes" : "no");
+  std::printf("truncated data rejected: %s\n", truncatedFails ? "yes" : "no");
+
+  px::closeDoc(fromBinary);
+  px::closeDoc(fromText);
+  px::closeDoc(doc);
+
+  return (identical && truncatedFails) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
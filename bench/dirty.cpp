@@ -0,0 +1,167 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// Builds a large document with a few thousand lines,
+/// similar to a drawing that has been worked on for a while.
+///
+/// @param fills Whether or not to put a second layer with a grid
+/// of filled circles under the lines. The lines are then drawn on
+/// the second layer and the first layer is left empty.
+px::Document* makeDoc(int w, int h, bool fills)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  std::size_t layer = 0;
+
+  if (fills) {
+
+    px::addLayer(doc);
+
+    layer = px::getLayerCount(doc) - 1;
+
+    for (int y = 0; y < h; y += 160) {
+
+      for (int x = 0; x < w; x += 160) {
+
+        auto* ellipse = px::addEllipse(doc, layer);
+
+        px::setPixelSize(ellipse, 2);
+
+        px::resizeRect(ellipse, x + 8, y + 8, x + 152, y + 152);
+
+        auto* fill = px::addFill(doc, layer);
+
+        px::setFillOrigin(fill, x + 80, y + 80);
+
+        px::setColor(fill, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f);
+      }
+    }
+  }
+
+  for (int i = 0; i < 4000; i++) {
+
+    auto* line = px::addLine(doc, layer);
+
+    px::setPixelSize(line, 1 + random(8));
+
+    px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, 0.5f);
+
+    for (int j = 0; j < 4; j++) {
+      px::addPoint(line, random(w), random(h));
+    }
+  }
+
+  return doc;
+}
+
+/// Simulates the pen tool, adding one point at a time to a new line.
+/// After each point, the document is rendered again.
+///
+/// @param layer The layer to add the line to.
+/// @param partial Whether or not to only render the new segment.
+void drawStroke(px::Document* doc, std::size_t layer, px::Image* image, int pointCount, bool partial)
+{
+  px::bench::Random random(7);
+
+  auto* line = px::addLine(doc, layer);
+
+  px::setPixelSize(line, 4);
+
+  px::setColor(line, 0.1f, 0.2f, 0.3f, 0.75f);
+
+  int x = 1000;
+  int y = 1000;
+
+  for (int i = 0; i < pointCount; i++) {
+
+    x += random(41) - 20;
+    y += random(41) - 20;
+
+    px::addPoint(line, x, y);
+
+    int bounds[4] {};
+
+    if (!partial) {
+      px::render(doc, image);
+    } else if (px::getBounds(line, bounds, px::getPointCount(line) - 1)) {
+      px::render(doc, image, bounds[0], bounds[1], bounds[2], bounds[3]);
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  int w = 3840;
+  int h = 2160;
+
+  int pointCount = 10;
+
+  struct Case final
+  {
+    /// The name of the case.
+    const char* name;
+    /// Whether or not the document has fills.
+    bool fills;
+    /// The layer that the stroke is drawn on. In
+    /// the documents with fills, the fills are on
+    /// the second layer, so a stroke on the first
+    /// layer changes what the fills cover.
+    std::size_t layer;
+  };
+
+  const Case cases[] {
+    { "lines", false, 0 },
+    { "over fills", true, 1 },
+    { "under fills", true, 0 }
+  };
+
+  auto* fullImage = px::createImage(w, h);
+  auto* partialImage = px::createImage(w, h);
+
+  bool allIdentical = true;
+
+  std::printf("%-12s %16s %18s %10s\n", "document", "full per point", "region per point", "identical");
+
+  for (const auto& c : cases) {
+
+    auto* fullDoc = makeDoc(w, h, c.fills);
+    auto* partialDoc = makeDoc(w, h, c.fills);
+
+    px::render(partialDoc, partialImage);
+
+    auto full = px::bench::measure(1, [&]() { drawStroke(fullDoc, c.layer, fullImage, pointCount, false); });
+
+    auto partial = px::bench::measure(1, [&]() { drawStroke(partialDoc, c.layer, partialImage, pointCount, true); });
+
+    auto identical = std::memcmp(px::getColorBuffer(fullImage),
+                                 px::getColorBuffer(partialImage),
+                                 std::size_t(w * h * 4) * sizeof(float)) == 0;
+
+    std::printf("%-12s %13.3f ms %15.3f ms %10s\n", c.name, full / pointCount, partial / pointCount, identical ? "yes" : "no");
+
+    allIdentical = allIdentical && identical;
+
+    px::closeDoc(fullDoc);
+    px::closeDoc(partialDoc);
+  }
+
+  px::closeImage(fullImage);
+  px::closeImage(partialImage);
+
+  return allIdentical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
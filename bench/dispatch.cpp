@@ -0,0 +1,89 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+/// Builds a document the way that the pen tool does when it's
+/// tapped along the canvas: many short lines, each with a style
+/// that is usually the same as the style of the line before it.
+///
+/// @param lineCount The number of lines to add.
+/// @param styleRun The number of lines between style changes.
+/// @param pixelSize The pixel size of the lines.
+px::Document* makeDoc(int w, int h, int lineCount, int styleRun, int pixelSize)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  float color[3] { 0, 0, 0 };
+
+  // The lines follow each other across the canvas, the
+  // way the taps of a stroke would, so that painting them
+  // isn't dominated by cache misses in the image.
+  int x = w / 2;
+  int y = h / 2;
+
+  for (int i = 0; i < lineCount; i++) {
+
+    if ((i % styleRun) == 0) {
+      color[0] = random(256) / 255.0f;
+      color[1] = random(256) / 255.0f;
+      color[2] = random(256) / 255.0f;
+    }
+
+    auto* line = px::addLine(doc);
+
+    px::setPixelSize(line, pixelSize);
+
+    px::setColor(line, color[0], color[1], color[2]);
+
+    x = (x + random(5) - 2 + w) % w;
+    y = (y + random(5) - 2 + h) % h;
+
+    px::addPoint(line, x, y);
+    px::addPoint(line, x + random(3) - 1, y + random(3) - 1);
+  }
+
+  return doc;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 1024;
+  int h = 1024;
+
+  int lineCount = 500000;
+
+  auto* image = px::createImage(w, h);
+
+  std::printf("%-10s %-10s %12s %14s\n", "pixel size", "style run", "render (ms)", "ns per line");
+
+  for (int pixelSize = 1; pixelSize <= 4; pixelSize *= 4) {
+
+    for (int styleRun = 1; styleRun <= 1000; styleRun *= 1000) {
+
+      auto* doc = makeDoc(w, h, lineCount, styleRun, pixelSize);
+
+      auto elapsed = px::bench::measure(3, [doc, image]() { px::render(doc, image); });
+
+      std::printf("%-10d %-10d %12.2f %14.1f\n", pixelSize, styleRun, elapsed, (elapsed * 1e6) / lineCount);
+
+      px::closeDoc(doc);
+    }
+  }
+
+  px::closeImage(image);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// Builds a document with a few layers of strokes of
+/// every kind, with translucent and subtracted colors,
+/// and a fill on each layer.
+px::Document* makeDoc(int w, int h, std::size_t layerCount)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  auto randomColor = [&random]() { return random(256) / 255.0f; };
+
+  for (std::size_t l = 0; l < layerCount; l++) {
+
+    if (l > 0) {
+      px::setLayerOpacity(px::addLayer(doc), 0.5f + (0.5f * randomColor()));
+    }
+
+    for (int i = 0; i < 500; i++) {
+
+      auto* line = px::addLine(doc, l);
+
+      px::setPixelSize(line, 1 + random(6));
+
+      px::setColor(line, randomColor(), randomColor(), randomColor(), (random(2) ? 1.0f : randomColor()));
+
+      if (!random(8)) {
+        px::setBlendMode(line, px::BlendMode::Subtract);
+      }
+
+      for (int j = 0; j < 4; j++) {
+        px::addPoint(line, random(w), random(h));
+      }
+    }
+
+    for (int i = 0; i < 20; i++) {
+
+      auto* ellipse = px::addEllipse(doc, l);
+
+      px::setCenter(ellipse, random(w), random(h));
+      px::setRadius(ellipse, random(w / 8), random(h / 8));
+      px::setPixelSize(ellipse, 1 + random(4));
+      px::setColor(ellipse, randomColor(), randomColor(), randomColor());
+
+      auto* quad = px::addQuad(doc, l);
+
+      for (std::size_t j = 0; j < 4; j++) {
+        px::setPoint(quad, j, random(w), random(h));
+      }
+
+      px::setColor(quad, randomColor(), randomColor(), randomColor(), randomColor());
+    }
+
+    auto* fill = px::addFill(doc, l);
+
+    px::setFillOrigin(fill, random(w), random(h));
+
+    px::setColor(fill, randomColor(), randomColor(), randomColor());
+  }
+
+  return doc;
+}
+
+/// Indicates whether two images have the same pixels.
+bool sameImage(const px::Image* a, const px::Image* b)
+{
+  std::size_t size = px::getImageWidth(a) * px::getImageHeight(a) * 4 * sizeof(float);
+
+  return std::memcmp(px::getColorBuffer(a), px::getColorBuffer(b), size) == 0;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 1920;
+  int h = 1080;
+
+  std::size_t layerCount = 4;
+
+  auto* doc = makeDoc(w, h, layerCount);
+
+  auto* direct = px::createImage(w, h);
+  auto* listed = px::createImage(w, h);
+
+  auto* list = px::createDisplayList();
+
+  auto compile = px::bench::measure(1, [&]() { px::compileDoc(doc, w, h, list); });
+
+  px::render(doc, direct);
+  px::render(list, listed);
+
+  auto same = sameImage(direct, listed);
+
+  auto directRender = px::bench::measure(5, [&]() { px::render(doc, direct); });
+
+  auto listRender = px::bench::measure(5, [&]() { px::render(list, listed); });
+
+  auto addEdit = [&]() {
+    auto* line = px::addLine(doc, layerCount - 1);
+    px::addPoint(line, 0, 0);
+    px::addPoint(line, w - 1, h - 1);
+  };
+
+  auto directEdit = px::bench::measure(5, [&]() {
+    addEdit();
+    px::render(doc, direct);
+  });
+
+  auto listEdit = px::bench::measure(5, [&]() {
+    addEdit();
+    px::compileDoc(doc, w, h, list);
+    px::render(list, listed);
+  });
+
+  px::render(doc, direct);
+
+  same = same && sameImage(direct, listed);
+
+  std::printf("%-24s %10s %10s\n", "operation", "direct", "listed");
+  std::printf("%-24s %10s %10.2f\n", "compile (ms)", "", compile);
+  std::printf("%-24s %10.2f %10.2f\n", "render (ms)", directRender, listRender);
+  std::printf("%-24s %10.2f %10.2f\n", "edit top layer (ms)", directEdit, listEdit);
+  std::printf("identical: %s\n", same ? "yes" : "no");
+
+  px::closeDisplayList(list);
+
+  px::closeImage(direct);
+  px::closeImage(listed);
+
+  px::closeDoc(doc);
+
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,312 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// The size of a cell of the maze, in pixels.
+/// This includes one of its walls.
+constexpr int cellSize() noexcept { return 8; }
+
+/// Builds a document with a maze drawn in black on white.
+/// Every corridor of the maze is connected, so a fill anywhere
+/// in a corridor reaches all of them, winding through the canvas.
+px::Document* makeMaze(int w, int h)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  int cols = w / cellSize();
+  int rows = h / cellSize();
+
+  // Bit 0 opens the wall to the right of a
+  // cell and bit 1 opens the wall below it.
+  std::vector<unsigned char> openings(std::size_t(cols * rows), 0);
+  std::vector<unsigned char> visited(std::size_t(cols * rows), 0);
+
+  std::vector<int> stack { 0 };
+
+  visited[0] = 1;
+
+  while (!stack.empty()) {
+
+    auto cell = stack.back();
+
+    int x = cell % cols;
+    int y = cell / cols;
+
+    int neighbors[4];
+    int count = 0;
+
+    if ((x > 0) && !visited[cell - 1]) neighbors[count++] = cell - 1;
+    if ((x < (cols - 1)) && !visited[cell + 1]) neighbors[count++] = cell + 1;
+    if ((y > 0) && !visited[cell - cols]) neighbors[count++] = cell - cols;
+    if ((y < (rows - 1)) && !visited[cell + cols]) neighbors[count++] = cell + cols;
+
+    if (!count) {
+      stack.pop_back();
+      continue;
+    }
+
+    auto next = neighbors[random(count)];
+
+    if (next == (cell + 1)) {
+      openings[cell] |= 1;
+    } else if (next == (cell - 1)) {
+      openings[next] |= 1;
+    } else if (next == (cell + cols)) {
+      openings[cell] |= 2;
+    } else {
+      openings[next] |= 2;
+    }
+
+    visited[next] = 1;
+
+    stack.push_back(next);
+  }
+
+  auto addWall = [doc](int x1, int y1, int x2, int y2) {
+    auto* line = px::addLine(doc);
+    px::setColor(line, 0, 0, 0, 1);
+    px::addPoint(line, x1, y1);
+    px::addPoint(line, x2, y2);
+  };
+
+  // Walls along the same grid line are merged,
+  // which keeps the number of nodes down.
+
+  for (int y = 0; y <= rows; y++) {
+
+    int start = -1;
+
+    for (int x = 0; x <= cols; x++) {
+
+      auto closed = (x < cols) && ((y == 0) || (y == rows) || !(openings[((y - 1) * cols) + x] & 2));
+
+      if (closed && (start < 0)) {
+        start = x;
+      } else if (!closed && (start >= 0)) {
+        addWall(start * cellSize(), y * cellSize(), x * cellSize(), y * cellSize());
+        start = -1;
+      }
+    }
+  }
+
+  for (int x = 0; x <= cols; x++) {
+
+    int start = -1;
+
+    for (int y = 0; y <= rows; y++) {
+
+      auto closed = (y < rows) && ((x == 0) || (x == cols) || !(openings[(y * cols) + x - 1] & 1));
+
+      if (closed && (start < 0)) {
+        start = y;
+      } else if (!closed && (start >= 0)) {
+        addWall(x * cellSize(), start * cellSize(), x * cellSize(), y * cellSize());
+        start = -1;
+      }
+    }
+  }
+
+  return doc;
+}
+
+/// Checks that a fill was blended exactly once onto every
+/// pixel it reached. Since the maze is connected, each pixel
+/// is either black or has the color of the fill origin.
+bool isUniform(const px::Image* image, int originX, int originY)
+{
+  const float* color = px::getColorBuffer(image);
+
+  auto w = px::getImageWidth(image);
+  auto h = px::getImageHeight(image);
+
+  const float* expected = color + ((std::size_t(originY) * w) + std::size_t(originX)) * 4;
+
+  for (std::size_t i = 0; i < (w * h); i++) {
+
+    const float* c = color + (i * 4);
+
+    auto wall = (c[0] == 0) && (c[1] == 0) && (c[2] == 0) && (c[3] == 1);
+
+    auto same = (c[0] == expected[0])
+             && (c[1] == expected[1])
+             && (c[2] == expected[2])
+             && (c[3] == expected[3]);
+
+    if (!wall && !same) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Builds a blank document with a small square outlined on it
+/// and a fill inside of the square, which reaches a small part
+/// of the canvas.
+///
+/// @param fill Receives the fill.
+px::Document* makeSquare(int w, int h, px::Fill** fill)
+{
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  auto* quad = px::addQuad(doc);
+
+  px::setColor(quad, 0, 0, 0, 1);
+
+  px::setPoint(quad, 0, 100, 100);
+  px::setPoint(quad, 1, 132, 100);
+  px::setPoint(quad, 2, 132, 132);
+  px::setPoint(quad, 3, 100, 132);
+
+  *fill = px::addFill(doc);
+
+  px::setColor(*fill, 0.2f, 0.4f, 0.6f, 1.0f);
+
+  return doc;
+}
+
+/// A way of filling the maze.
+struct FillCase final
+{
+  const char* name;
+  px::BlendMode blendMode;
+  float color[4];
+};
+
+} // namespace
+
+int main()
+{
+  int w = 4096;
+  int h = 4096;
+
+  auto* doc = makeMaze(w, h);
+
+  std::size_t threadCount = 4;
+
+  auto* image = px::createImage(w, h);
+  auto* cachedImage = px::createImage(w, h);
+  auto* threadedImage = px::createImage(w, h);
+
+  // The walls are rendered on their own first,
+  // so that the time spent filling can be found.
+  auto walls = px::bench::measure(3, [&]() { px::render(doc, image); });
+  auto threadedWalls = px::bench::measure(3, [&]() { px::render(doc, threadedImage, threadCount); });
+
+  int originX = cellSize() / 2;
+  int originY = cellSize() / 2;
+
+  auto* fill = px::addFill(doc);
+
+  px::setFillOrigin(fill, originX, originY);
+
+  const FillCase cases[] {
+    { "opaque", px::BlendMode::Normal, { 0.2f, 0.4f, 0.6f, 1.0f } },
+    { "translucent", px::BlendMode::Normal, { 0.2f, 0.4f, 0.6f, 0.25f } },
+    { "low alpha", px::BlendMode::Normal, { 0.0f, 0.0f, 0.0f, 1.0f / 512.0f } },
+    { "subtract", px::BlendMode::Subtract, { 0.001f, 0.0f, 0.0f, 0.0f } }
+  };
+
+  auto uniform = true;
+  auto identical = true;
+
+  // Moving the origin by one pixel keeps the region the same,
+  // but the cached region can't be used, so it is searched for.
+  int frame = 0;
+
+  auto moveOrigin = [&]() { px::setFillOrigin(fill, originX + ((frame++) % 2), originY); };
+
+  px::resetFillCacheStats();
+
+  std::printf("%-12s %12s %12s %16s %10s %10s\n", "fill", "search (ms)", "cached (ms)", "4 threads (ms)", "uniform", "identical");
+
+  for (const auto& c : cases) {
+
+    px::setBlendMode(fill, c.blendMode);
+    px::setColor(fill, c.color[0], c.color[1], c.color[2], c.color[3]);
+
+    auto searched = px::bench::measure(3, [&]() {
+      moveOrigin();
+      px::render(doc, image);
+    });
+
+    auto cached = px::bench::measure(3, [&]() { px::render(doc, cachedImage); });
+
+    auto threaded = px::bench::measure(3, [&]() {
+      moveOrigin();
+      px::render(doc, threadedImage, threadCount);
+    });
+
+    auto same = isUniform(image, originX, originY);
+
+    auto size = std::size_t(w * h * 4) * sizeof(float);
+
+    auto sameCached = std::memcmp(px::getColorBuffer(image), px::getColorBuffer(cachedImage), size) == 0;
+    auto sameThreaded = std::memcmp(px::getColorBuffer(image), px::getColorBuffer(threadedImage), size) == 0;
+
+    uniform = uniform && same;
+
+    identical = identical && sameCached && sameThreaded;
+
+    std::printf("%-12s %12.2f %12.2f %16.2f %10s %10s\n",
+                c.name,
+                searched - walls,
+                cached - walls,
+                threaded - threadedWalls,
+                same ? "yes" : "no",
+                (sameCached && sameThreaded) ? "yes" : "no");
+  }
+
+  // A fill that only reaches a small part of a large canvas
+  // should cost about as much as its region, with any number of threads.
+
+  px::Fill* squareFill = nullptr;
+
+  auto* squareDoc = makeSquare(w, h, &squareFill);
+
+  px::setFillOrigin(squareFill, -1, -1);
+
+  auto blank = px::bench::measure(3, [&]() { px::render(squareDoc, threadedImage, threadCount); });
+
+  auto small = px::bench::measure(3, [&]() {
+    px::setFillOrigin(squareFill, 110 + ((frame++) % 2), 110);
+    px::render(squareDoc, threadedImage, threadCount);
+  });
+
+  std::printf("%-12s %12s %12s %16.2f\n", "small", "", "", small - blank);
+
+  px::closeDoc(squareDoc);
+
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+
+  px::getFillCacheStats(&hits, &misses);
+
+  std::printf("cache hits: %zu, misses: %zu\n", hits, misses);
+
+  px::closeImage(cachedImage);
+  px::closeImage(threadedImage);
+  px::closeImage(image);
+
+  px::closeDoc(doc);
+
+  return (uniform && identical) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,180 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+/// Builds a document with one layer of short strokes and shapes,
+/// the way that a drawing with a lot of detail would look.
+px::Document* makeDoc(int w, int h, int nodeCount)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  for (int i = 0; i < nodeCount; i++) {
+
+    auto x = random(w);
+    auto y = random(h);
+
+    if (random(4)) {
+
+      auto* line = px::addLine(doc);
+
+      px::setPixelSize(line, 1 + random(4));
+
+      for (int j = 0; j < 3; j++) {
+        px::addPoint(line, x + random(32) - 16, y + random(32) - 16);
+      }
+
+    } else {
+
+      auto* ellipse = px::addEllipse(doc);
+
+      px::setCenter(ellipse, x, y);
+      px::setRadius(ellipse, random(24), random(24));
+    }
+  }
+
+  return doc;
+}
+
+/// Gets the bounds of a node by its type.
+bool getNodeBounds(px::Layer* layer, std::size_t index, int* bounds)
+{
+  switch (px::getNodeType(layer, index)) {
+    case px::NodeType::Ellipse:
+      return px::getBounds(px::getEllipse(layer, index), bounds);
+    case px::NodeType::Fill:
+      return px::getBounds(px::getFill(layer, index), bounds);
+    case px::NodeType::Line:
+      return px::getBounds(px::getLine(layer, index), bounds);
+    case px::NodeType::Quad:
+      return px::getBounds(px::getQuad(layer, index), bounds);
+  }
+
+  return false;
+}
+
+/// Finds the nodes intersecting a rectangle by looking at every node.
+std::vector<std::size_t> scan(px::Layer* layer, int x1, int y1, int x2, int y2)
+{
+  std::vector<std::size_t> found;
+
+  for (std::size_t i = 0; i < px::getNodeCount(layer); i++) {
+
+    int b[4];
+
+    if (getNodeBounds(layer, i, b) && (b[0] < x2) && (b[2] > x1) && (b[1] < y2) && (b[3] > y1)) {
+      found.emplace_back(i);
+    }
+  }
+
+  return found;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 4096;
+  int h = 4096;
+
+  int nodeCount = 100000;
+
+  auto* doc = makeDoc(w, h, nodeCount);
+
+  auto* layer = px::getLayer(doc, 0);
+
+  auto found = std::vector<std::size_t>(std::size_t(nodeCount));
+
+  px::bench::Random random(7);
+
+  auto matches = true;
+
+  // The queries are checked against a scan of every node.
+  for (int i = 0; (i < 200) && matches; i++) {
+
+    auto x = random(w);
+    auto y = random(h);
+    auto size = 1 + random(256);
+
+    auto expected = scan(layer, x, y, x + size, y + size);
+
+    auto count = px::findNodes(layer, x, y, x + size, y + size, found.data(), found.size());
+
+    matches = (count == expected.size()) && std::equal(expected.begin(), expected.end(), found.begin());
+
+    std::size_t top = 0;
+
+    auto hasTop = px::findTopNode(layer, x, y, &top);
+
+    auto expectedTop = scan(layer, x, y, x + 1, y + 1);
+
+    matches = matches && (hasTop == !expectedTop.empty()) && (!hasTop || (top == expectedTop.back()));
+
+    // Moving a node has to move it in the index.
+    auto* line = px::getLine(layer, std::size_t(random(nodeCount)));
+    if (line) {
+      px::setPoint(line, 0, random(w), random(h));
+    }
+  }
+
+  auto rebuild = px::bench::measure(1, [&]() {
+    px::addLayer(doc);
+    layer = px::getLayer(doc, 0);
+    auto* copy = px::copyDoc(doc);
+    px::findNodes(px::getLayer(copy, 0), 0, 0, 1, 1, found.data(), found.size());
+    px::closeDoc(copy);
+  });
+
+  std::size_t sink = 0;
+
+  auto scanQuery = px::bench::measure(5, [&]() {
+    sink += scan(layer, 100, 100, 164, 164).size();
+  });
+
+  auto pointQuery = px::bench::measure(5, [&]() {
+    for (int i = 0; i < 1000; i++) {
+      std::size_t top = 0;
+      sink += px::findTopNode(layer, random(w), random(h), &top) ? top : 0;
+    }
+  });
+
+  auto rectQuery = px::bench::measure(5, [&]() {
+    for (int i = 0; i < 1000; i++) {
+      auto x = random(w);
+      auto y = random(h);
+      sink += px::findNodes(layer, x, y, x + 64, y + 64, found.data(), found.size());
+    }
+  });
+
+  auto editQuery = px::bench::measure(5, [&]() {
+    for (int i = 0; i < 100; i++) {
+      auto* line = px::addLine(doc);
+      px::addPoint(line, random(w), random(h));
+      px::addPoint(line, random(w), random(h));
+      std::size_t top = 0;
+      sink += px::findTopNode(layer, random(w), random(h), &top) ? top : 0;
+    }
+  });
+
+  std::printf("%-36s %10.3f\n", "build index, 100k nodes (ms)", rebuild);
+  std::printf("%-36s %10.3f\n", "scan every node (ms)", scanQuery);
+  std::printf("%-36s %10.3f\n", "1000 point queries (ms)", pointQuery);
+  std::printf("%-36s %10.3f\n", "1000 64x64 rect queries (ms)", rectQuery);
+  std::printf("%-36s %10.3f\n", "100 edits and point queries (ms)", editQuery);
+  std::printf("matches scan: %s (%zu)\n", matches ? "yes" : "no", sink % 2);
+
+  px::closeDoc(doc);
+
+  return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,149 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+/// Builds a document with several layers of opaque lines.
+/// The lines of the third layer subtract their color and
+/// the fifth layer ends with a fill, so that those layers
+/// can't be cached.
+px::Document* makeDoc(int w, int h, std::size_t layerCount)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  for (std::size_t l = 0; l < layerCount; l++) {
+
+    if (l > 0) {
+      px::addLayer(doc);
+    }
+
+    for (int i = 0; i < 500; i++) {
+
+      auto* line = px::addLine(doc, l);
+
+      px::setPixelSize(line, 1 + random(8));
+
+      px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f);
+
+      if (l == 2) {
+        px::setBlendMode(line, px::BlendMode::Subtract);
+      }
+
+      for (int j = 0; j < 4; j++) {
+        px::addPoint(line, random(w), random(h));
+      }
+    }
+
+    if (l == 4) {
+
+      auto* fill = px::addFill(doc, l);
+
+      px::setFillOrigin(fill, w / 2, h / 2);
+
+      px::setColor(fill, 0.2f, 0.4f, 0.6f, 0.5f);
+    }
+  }
+
+  return doc;
+}
+
+/// Finds the largest difference between two images.
+float maxDifference(const px::Image* a, const px::Image* b)
+{
+  const float* colorA = px::getColorBuffer(a);
+  const float* colorB = px::getColorBuffer(b);
+
+  std::size_t count = px::getImageWidth(a) * px::getImageHeight(a) * 4;
+
+  float diff = 0;
+
+  for (std::size_t i = 0; i < count; i++) {
+    diff = std::fmax(diff, std::fabs(colorA[i] - colorB[i]));
+  }
+
+  return diff;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 1920;
+  int h = 1080;
+
+  std::size_t layerCount = 8;
+
+  auto* doc = makeDoc(w, h, layerCount);
+
+  auto* direct = px::createImage(w, h);
+  auto* cached = px::createImage(w, h);
+
+  auto* compositor = px::createCompositor();
+
+  auto first = px::bench::measure(1, [&]() { px::render(doc, cached, compositor); });
+
+  px::render(doc, direct);
+
+  // The only difference between the
+  // two modes should be rounding.
+  auto diff = maxDifference(direct, cached);
+
+  int frame = 0;
+
+  auto nextOpacity = [&frame]() { return 0.5f + 0.5f * float((frame++) % 2); };
+
+  auto directOpacity = px::bench::measure(5, [&]() {
+    px::setLayerOpacity(px::getLayer(doc, layerCount / 2), nextOpacity());
+    px::render(doc, direct);
+  });
+
+  auto cachedOpacity = px::bench::measure(5, [&]() {
+    px::setLayerOpacity(px::getLayer(doc, layerCount / 2), nextOpacity());
+    px::render(doc, cached, compositor);
+  });
+
+  auto directEdit = px::bench::measure(5, [&]() {
+    px::addPoint(px::addLine(doc, layerCount - 1), 0, 0);
+    px::render(doc, direct);
+  });
+
+  auto cachedEdit = px::bench::measure(5, [&]() {
+    px::addPoint(px::addLine(doc, layerCount - 1), 0, 0);
+    px::render(doc, cached, compositor);
+  });
+
+  // A translucent layer is painted the same way in both modes.
+  px::setLayerOpacity(px::getLayer(doc, layerCount / 2), 0.5f);
+
+  px::render(doc, direct);
+
+  px::render(doc, cached, compositor);
+
+  diff = std::fmax(diff, maxDifference(direct, cached));
+
+  std::printf("%-24s %10s %10s\n", "operation", "direct", "cached");
+  std::printf("%-24s %10s %10.2f\n", "first frame (ms)", "", first);
+  std::printf("%-24s %10.2f %10.2f\n", "opacity change (ms)", directOpacity, cachedOpacity);
+  std::printf("%-24s %10.2f %10.2f\n", "edit top layer (ms)", directEdit, cachedEdit);
+  std::printf("max difference: %g\n", double(diff));
+
+  px::closeCompositor(compositor);
+
+  px::closeImage(direct);
+  px::closeImage(cached);
+
+  px::closeDoc(doc);
+
+  return (diff < 1e-5f) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
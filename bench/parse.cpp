@@ -0,0 +1,115 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+/// Gets the peak resident set size of the process, in kilobytes.
+/// Zero is returned if this isn't supported on the platform.
+long peakMemory()
+{
+#ifdef __unix__
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+#else
+  return 0;
+#endif
+}
+
+/// Writes a large document file without building the document in memory,
+/// so that the memory used by the parser is the largest allocation made.
+///
+/// @return The size of the file, in bytes.
+long writeDoc(const char* path, int lineCount)
+{
+  px::bench::Random random;
+
+  auto* file = std::fopen(path, "wb");
+  if (!file) {
+    return 0;
+  }
+
+  std::fprintf(file, "width 1024\nheight 1024\nbackground 0 0 0 65535\n");
+  std::fprintf(file, "layer\n  name \"Layer 1\"\n  opacity 65535\n  visible true\n");
+
+  for (int i = 0; i < lineCount; i++) {
+
+    std::fprintf(file, "  line\n    pixel_size %d\n", 1 + random(8));
+
+    std::fprintf(file, "    color %d %d %d 65535\n", random(65536), random(65536), random(65536));
+
+    std::fprintf(file, "    blend_mode normal\n    points");
+
+    for (int j = 0; j < 16; j++) {
+      std::fprintf(file, " %d %d", random(1024), random(1024));
+    }
+
+    std::fprintf(file, " end\n  end\n");
+  }
+
+  std::fprintf(file, "end\n");
+
+  long size = std::ftell(file);
+
+  std::fclose(file);
+
+  return size;
+}
+
+} // namespace
+
+int main()
+{
+  const char* path = "px_bench_parse.px";
+
+  auto fileSize = writeDoc(path, 200000);
+  if (!fileSize) {
+    std::fprintf(stderr, "Failed to write '%s'\n", path);
+    return EXIT_FAILURE;
+  }
+
+  auto* doc = px::createDoc();
+
+  auto memoryBefore = peakMemory();
+
+  int result = 0;
+
+  auto elapsed = px::bench::measure(1, [&]() { result = px::openDoc(doc, path); });
+
+  auto memoryAfter = peakMemory();
+
+  auto megabytes = double(fileSize) / (1024.0 * 1024.0);
+
+  std::printf("file size:          %10.2f MiB\n", megabytes);
+  std::printf("parse time:         %10.2f ms\n", elapsed);
+  std::printf("throughput:         %10.2f MiB/s\n", megabytes / (elapsed / 1000.0));
+  std::printf("peak memory growth: %10.2f MiB (file contents and document included)\n", double(memoryAfter - memoryBefore) / 1024.0);
+
+  // Parse the same document from memory, the
+  // way that a cache of documents would.
+
+  void* data = nullptr;
+  std::size_t size = 0;
+
+  px::saveDoc(doc, &data, &size);
+
+  auto bufferElapsed = px::bench::measure(1, [&]() { result |= px::openDoc(doc, data, size); });
+
+  std::printf("buffer parse time:  %10.2f ms\n", bufferElapsed);
+
+  std::free(data);
+
+  px::closeDoc(doc);
+
+  std::remove(path);
+
+  return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,123 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// Builds a document with translucent lines
+/// and, optionally, a fill at the end.
+px::Document* makeDoc(int w, int h, bool withFill)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 0.5f);
+
+  for (int i = 0; i < 2000; i++) {
+
+    auto* line = px::addLine(doc);
+
+    px::setPixelSize(line, 1 + random(8));
+
+    px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f);
+
+    for (int j = 0; j < 4; j++) {
+      px::addPoint(line, random(w), random(h));
+    }
+  }
+
+  if (withFill) {
+    auto* fill = px::addFill(doc);
+    px::setFillOrigin(fill, random(w), random(h));
+    px::setColor(fill, 0.2f, 0.4f, 0.6f, 1.0f);
+  }
+
+  return doc;
+}
+
+/// Converts the color buffer of an image the
+/// way that the editor and the tutorials do it.
+void toBytes(const px::Image* image, unsigned char* rgba, bool premultiplied)
+{
+  using Byte = unsigned char;
+
+  const float* src = px::getColorBuffer(image);
+
+  std::size_t count = px::getImageWidth(image) * px::getImageHeight(image);
+
+  for (std::size_t i = 0; i < count; i++, src += 4, rgba += 4) {
+
+    auto a = src[3];
+
+    for (std::size_t j = 0; j < 3; j++) {
+      if (premultiplied) {
+        rgba[j] = Byte(src[j] * 255);
+      } else {
+        rgba[j] = (a > 0) ? Byte(((src[j] / a) < 1 ? (src[j] / a) : 1.0f) * 255) : Byte(0);
+      }
+    }
+
+    rgba[3] = Byte(a * 255);
+  }
+}
+
+} // namespace
+
+int main()
+{
+  int w = 3840;
+  int h = 2160;
+
+  std::size_t size = std::size_t(w * h * 4);
+
+  auto identical = true;
+
+  std::printf("%-22s %16s %16s %10s\n", "document", "float + convert", "rgba8 (ms)", "identical");
+
+  for (int withFill = 0; withFill < 2; withFill++) {
+
+    auto* doc = makeDoc(w, h, withFill != 0);
+
+    for (int premultiplied = 1; premultiplied >= 0; premultiplied--) {
+
+      std::vector<unsigned char> expected(size);
+      std::vector<unsigned char> actual(size);
+
+      auto converted = px::bench::measure(1, [&]() {
+        auto* image = px::createImage(w, h);
+        px::render(doc, image);
+        toBytes(image, expected.data(), premultiplied != 0);
+        px::closeImage(image);
+      });
+
+      auto direct = px::bench::measure(1, [&]() {
+        px::render(doc, actual.data(), w, h, premultiplied != 0);
+      });
+
+      auto same = std::memcmp(expected.data(), actual.data(), size) == 0;
+
+      identical = identical && same;
+
+      char name[64];
+
+      std::snprintf(name, sizeof(name), "%s, %s",
+                    withFill ? "fill" : "no fill",
+                    premultiplied ? "premultiplied" : "straight");
+
+      std::printf("%-22s %16.2f %16.2f %10s\n", name, converted, direct, same ? "yes" : "no");
+    }
+
+    px::closeDoc(doc);
+  }
+
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
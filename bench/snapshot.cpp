@@ -0,0 +1,152 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+/// Builds a document with several layers of short lines.
+px::Document* makeDoc(std::size_t layerCount, int linesPerLayer)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, 512, 512);
+
+  for (std::size_t l = 0; l < layerCount; l++) {
+
+    if (l > 0) {
+      px::addLayer(doc);
+    }
+
+    for (int i = 0; i < linesPerLayer; i++) {
+
+      auto* line = px::addLine(doc, l);
+
+      for (int j = 0; j < 8; j++) {
+        px::addPoint(line, random(512), random(512));
+      }
+    }
+  }
+
+  return doc;
+}
+
+/// Saves a document to a string, so that two documents can be compared.
+std::string encode(const px::Document* doc)
+{
+  void* data = nullptr;
+
+  std::size_t size = 0;
+
+  px::saveDoc(doc, &data, &size);
+
+  std::string result(static_cast<const char*>(data), size);
+
+  std::free(data);
+
+  return result;
+}
+
+/// Checks that copies of a document are not affected by changes to each other.
+bool checkIsolation()
+{
+  auto* a = makeDoc(2, 10);
+
+  auto* line = px::addLine(a, 1);
+
+  px::addPoint(line, 1, 2);
+
+  auto original = encode(a);
+
+  auto* b = px::copyDoc(a);
+
+  // A pointer that was taken before the copy
+  // only modifies the document it was taken from.
+  px::setPoint(line, 0, 3, 4);
+
+  px::setLayerOpacity(px::getLayer(a, 0), 0.5f);
+
+  auto ok = (encode(b) == original) && (encode(a) != original);
+
+  auto modified = encode(a);
+
+  px::addPoint(px::addLine(b, 1), 5, 6);
+
+  px::setLayerName(px::getLayer(b, 0), "renamed");
+
+  ok = ok && (encode(a) == modified);
+
+  auto* c = px::copyDoc(b);
+
+  auto copied = encode(c);
+
+  px::closeDoc(b);
+
+  ok = ok && (encode(c) == copied);
+
+  px::addPoint(px::addLine(c, 0), 7, 8);
+
+  ok = ok && (encode(a) == modified);
+
+  px::closeDoc(a);
+  px::closeDoc(c);
+
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  auto isolated = checkIsolation();
+
+  std::size_t layerCount = 8;
+
+  auto* doc = makeDoc(layerCount, 20000);
+
+  // Each step copies the document, the way that the editor
+  // takes a snapshot, and then draws a line on one layer.
+
+  std::vector<px::Document*> history { px::copyDoc(doc) };
+
+  auto steps = px::bench::measure(1, [&]() {
+    for (std::size_t i = 0; i < 100; i++) {
+      auto* next = px::copyDoc(history.back());
+      auto* line = px::addLine(next, i % layerCount);
+      px::addPoint(line, 0, 0);
+      px::addPoint(line, 1, 1);
+      history.emplace_back(next);
+    }
+  });
+
+  auto copyTime = px::bench::measure(5, [&]() { px::closeDoc(px::copyDoc(doc)); });
+
+  std::size_t stepMemory = 0;
+
+  for (std::size_t i = 1; i < history.size(); i++) {
+    stepMemory += px::getDocMemoryUsage(history[i], history[i - 1]);
+  }
+
+  auto docMemory = px::getDocMemoryUsage(doc);
+
+  std::printf("%-32s %10.3f\n", "copy (ms)", copyTime);
+  std::printf("%-32s %10.3f\n", "100 snapshot and edit (ms)", steps);
+  std::printf("%-32s %10.3f\n", "document memory (MiB)", docMemory / (1024.0 * 1024.0));
+  std::printf("%-32s %10.3f\n", "memory per step (MiB)", (stepMemory / double(history.size() - 1)) / (1024.0 * 1024.0));
+  std::printf("isolated: %s\n", isolated ? "yes" : "no");
+
+  for (auto* snapshot : history) {
+    px::closeDoc(snapshot);
+  }
+
+  px::closeDoc(doc);
+
+  return isolated ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,128 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// The number of points in each line.
+constexpr int pointsPerLine() noexcept { return 8; }
+
+/// Builds a document with many short lines.
+///
+/// @param interleaved If true, points are added to many lines
+/// at a time, the way that several strokes being edited at once
+/// would, which scatters the points of each line in memory.
+px::Document* makeDoc(int w, int h, int lineCount, bool interleaved)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  std::vector<px::Line*> lines;
+
+  std::vector<int> positions;
+
+  for (int i = 0; i < lineCount; i++) {
+
+    auto* line = px::addLine(doc);
+
+    px::setPixelSize(line, 1 + random(2));
+
+    px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f);
+
+    lines.push_back(line);
+
+    positions.push_back(random(w));
+    positions.push_back(random(h));
+  }
+
+  auto addPoint = [&](int i) {
+    auto& x = positions[std::size_t(i * 2)];
+    auto& y = positions[std::size_t(i * 2) + 1];
+    x += random(9) - 4;
+    y += random(9) - 4;
+    px::addPoint(lines[std::size_t(i)], x, y);
+  };
+
+  if (interleaved) {
+    for (int j = 0; j < pointsPerLine(); j++) {
+      for (int i = 0; i < lineCount; i++) {
+        addPoint(i);
+      }
+    }
+  } else {
+    for (int i = 0; i < lineCount; i++) {
+      for (int j = 0; j < pointsPerLine(); j++) {
+        addPoint(i);
+      }
+    }
+  }
+
+  return doc;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 1920;
+  int h = 1080;
+
+  int lineCount = 100000;
+
+  auto* inOrder = makeDoc(w, h, lineCount, false);
+  auto* interleaved = makeDoc(w, h, lineCount, true);
+
+  // Copying a document packs the points of each
+  // line together again, in painting order.
+  auto* packed = px::copyDoc(interleaved);
+
+  auto* expected = px::createImage(w, h);
+  auto* image = px::createImage(w, h);
+
+  px::render(interleaved, expected);
+
+  auto identical = true;
+
+  std::printf("%-24s %10s %12s %10s\n", "document", "copy (ms)", "render (ms)", "identical");
+
+  const px::Document* docs[] { inOrder, interleaved, packed };
+
+  const char* names[] { "built in order", "built interleaved", "copy of interleaved" };
+
+  for (std::size_t i = 0; i < 3; i++) {
+
+    auto copyTime = px::bench::measure(5, [&]() { px::closeDoc(px::copyDoc(docs[i])); });
+
+    auto renderTime = px::bench::measure(5, [&]() { px::render(docs[i], image); });
+
+    auto same = true;
+
+    if (docs[i] != inOrder) {
+      auto size = std::size_t(w * h * 4) * sizeof(float);
+      same = std::memcmp(px::getColorBuffer(expected), px::getColorBuffer(image), size) == 0;
+      identical = identical && same;
+    }
+
+    std::printf("%-24s %10.2f %12.2f %10s\n", names[i], copyTime, renderTime, (docs[i] == inOrder) ? "-" : (same ? "yes" : "no"));
+  }
+
+  px::closeImage(image);
+  px::closeImage(expected);
+
+  px::closeDoc(packed);
+  px::closeDoc(interleaved);
+  px::closeDoc(inOrder);
+
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,117 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+namespace {
+
+/// Builds a document of lines and ellipses
+/// that all have the same pixel size.
+///
+/// @param pixelSize The pixel size to give the strokes.
+/// @param alpha The alpha channel of the strokes. Opaque strokes
+/// and translucent strokes are painted differently, since translucent
+/// strokes have to be blended once per overlapping square.
+px::Document* makeDoc(int w, int h, int pixelSize, float alpha)
+{
+  px::bench::Random random(pixelSize);
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  for (int i = 0; i < 200; i++) {
+
+    auto* line = px::addLine(doc);
+
+    px::setPixelSize(line, pixelSize);
+
+    px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, alpha);
+
+    for (int j = 0; j < 8; j++) {
+      px::addPoint(line, random(w), random(h));
+    }
+  }
+
+  for (int i = 0; i < 50; i++) {
+
+    auto* ellipse = px::addEllipse(doc);
+
+    px::setPixelSize(ellipse, pixelSize);
+
+    px::setColor(ellipse, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, alpha);
+
+    px::setCenter(ellipse, random(w), random(h));
+
+    px::setRadius(ellipse, 1 + random(w / 4), 1 + random(h / 4));
+  }
+
+  return doc;
+}
+
+/// Measures a render with and without stroke spans.
+///
+/// @param times Receives the time with square stamps (the way strokes
+/// were painted before spans) and then the time with spans.
+///
+/// @return True if both renders are identical, false otherwise.
+bool measureDoc(px::Document* doc, px::Image* before, px::Image* after, double* times)
+{
+  px::setStrokeSpans(false);
+
+  times[0] = px::bench::measure(3, [doc, before]() { px::render(doc, before); });
+
+  px::setStrokeSpans(true);
+
+  times[1] = px::bench::measure(3, [doc, after]() { px::render(doc, after); });
+
+  auto size = px::getImageWidth(after) * px::getImageHeight(after) * 4 * sizeof(float);
+
+  return std::memcmp(px::getColorBuffer(before), px::getColorBuffer(after), size) == 0;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 1024;
+  int h = 1024;
+
+  auto* before = px::createImage(w, h);
+  auto* after = px::createImage(w, h);
+
+  std::printf("%-10s %25s %25s\n", "", "opaque (ms)", "alpha 0.5 (ms)");
+  std::printf("%-10s %12s %12s %12s %12s\n", "pixel size", "before", "after", "before", "after");
+
+  auto identical = true;
+
+  for (int pixelSize = 1; pixelSize <= 32; pixelSize *= 2) {
+
+    double times[4] { 0, 0, 0, 0 };
+
+    float alphas[2] { 1.0f, 0.5f };
+
+    for (int i = 0; i < 2; i++) {
+
+      auto* doc = makeDoc(w, h, pixelSize, alphas[i]);
+
+      identical &= measureDoc(doc, before, after, &times[i * 2]);
+
+      px::closeDoc(doc);
+    }
+
+    std::printf("%-10d %12.2f %12.2f %12.2f %12.2f\n", pixelSize, times[0], times[1], times[2], times[3]);
+  }
+
+  // Translucent strokes are blended once per overlapping square,
+  // so they can't be painted as spans and still match the stamps.
+  std::printf("identical: %s\n", identical ? "yes" : "no");
+
+  px::closeImage(before);
+  px::closeImage(after);
+
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+#include "Bench.hpp"
+
+#include <libpx.hpp>
+
+#include <thread>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+/// Builds a 4K document with a few thousand lines
+/// spread over several layers, with a fill at the end
+/// of each layer.
+px::Document* makeDoc(int w, int h)
+{
+  px::bench::Random random;
+
+  auto* doc = px::createDoc();
+
+  px::resizeDoc(doc, std::size_t(w), std::size_t(h));
+
+  px::setBackground(doc, 1, 1, 1, 1);
+
+  for (std::size_t l = 0; l < 4; l++) {
+
+    if (l > 0) {
+      px::addLayer(doc);
+    }
+
+    px::setLayerOpacity(px::getLayer(doc, l), 0.9f);
+
+    for (int i = 0; i < 1000; i++) {
+
+      auto* line = px::addLine(doc, l);
+
+      px::setPixelSize(line, 1 + random(8));
+
+      px::setColor(line, random(256) / 255.0f, random(256) / 255.0f, random(256) / 255.0f, 0.5f);
+
+      for (int j = 0; j < 4; j++) {
+        px::addPoint(line, random(w), random(h));
+      }
+    }
+
+    auto* fill = px::addFill(doc, l);
+
+    px::setFillOrigin(fill, random(w), random(h));
+
+    px::setColor(fill, 0.2f, 0.4f, 0.6f, 0.5f);
+  }
+
+  return doc;
+}
+
+} // namespace
+
+int main()
+{
+  int w = 3840;
+  int h = 2160;
+
+  auto* doc = makeDoc(w, h);
+
+  auto* reference = px::createImage(w, h);
+  auto* image = px::createImage(w, h);
+
+  auto serial = px::bench::measure(3, [doc, reference]() { px::render(doc, reference); });
+
+  std::printf("%-8s %10s %8s %10s\n", "threads", "time (ms)", "speedup", "identical");
+
+  std::printf("%-8s %10.2f %8.2f %10s\n", "serial", serial, 1.0, "yes");
+
+  std::size_t maxThreads = std::thread::hardware_concurrency();
+  if (maxThreads < 8) {
+    maxThreads = 8;
+  }
+
+  auto success = true;
+
+  for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+
+    auto t = px::bench::measure(3, [doc, image, threads]() { px::render(doc, image, threads); });
+
+    auto identical = std::memcmp(px::getColorBuffer(reference),
+                                 px::getColorBuffer(image),
+                                 std::size_t(w) * std::size_t(h) * 4 * sizeof(float)) == 0;
+
+    success &= identical;
+
+    std::printf("%-8zu %10.2f %8.2f %10s\n", threads, t, serial / t, identical ? "yes" : "no");
+  }
+
+  px::closeImage(image);
+  px::closeImage(reference);
+  px::closeDoc(doc);
+
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -15,6 +15,8 @@
 #include "OpenErrorState.hpp"
 #include "Platform.hpp"
 #include "Renderer.hpp"
+#include "SnapshotSource.hpp"
+#include "StashWorker.hpp"
 #include "StyleEditor.hpp"
 
 #include <libpx.hpp>
@@ -28,6 +30,7 @@
 
 #include <filesystem>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include <cstdio>
@@ -54,6 +57,12 @@ class AppImpl final : public App,
   MenuBar menuBar;
   /// The log for events and errors.
   Log log;
+  /// Takes the snapshots of the document for the render
+  /// and stash workers, so that they share one snapshot.
+  SnapshotSource snapshotSource;
+  /// Writes the unsaved changes to
+  /// the document in the background.
+  StashWorker stashWorker { &snapshotSource };
   /// Used for editing the application style.
   StyleEditor styleEditor;
   /// The translation of the document on the edit area.
@@ -71,6 +80,8 @@ public:
   /// Releases memory allocated by the app.
   ~AppImpl()
   {
+    stashWorker.flush(getDocument(), nullptr);
+
     closeImage(image);
   }
   /// Gets a pointer the log.
@@ -98,6 +109,11 @@ public:
   {
     history.snapshot();
   }
+  /// Gets the source of the shared document snapshots.
+  SnapshotSource* getSnapshotSource() noexcept override
+  {
+    return &snapshotSource;
+  }
   /// Gets a pointer to the menu bar.
   Image* getImage() noexcept override
   {
@@ -108,6 +124,12 @@ public:
   {
     return image;
   }
+  /// Replaces the latest rendered image.
+  Image* swapImage(Image* other) noexcept override
+  {
+    std::swap(image, other);
+    return other;
+  }
   /// Gets a pointer to the menu bar.
   const MenuBar* getMenuBar() const noexcept override
   {
@@ -198,6 +220,8 @@ public:
   /// Creates a new document.
   void createDocument() override
   {
+    stashWorker.flush(getDocument(), this);
+
     history = History();
 
     syncDocument();
@@ -217,6 +241,8 @@ public:
   /// @return True on success, false on failure.
   bool openDocument(int id) override
   {
+    stashWorker.flush(getDocument(), this);
+
     documentID = id;
 
     Document* doc = createDoc();
@@ -237,9 +263,11 @@ public:
     return true;
   }
   /// Stashes any unsaved changes to the document.
+  /// The stash is written in the background, once
+  /// the document hasn't been changed for a while.
   void stashDocument() override
   {
-    AppStorage::stashDocument(documentID, getDocument());
+    stashWorker.request(documentID);
   }
   /// Removes a document from application storage.
   ///
@@ -306,6 +334,8 @@ protected:
         stateStack.pop_back();
       }
     }
+
+    stashWorker.poll(getDocument(), this);
   }
   /// Observes a menu bar event.
   void observe(MenuBar::Event event) override
@@ -387,6 +417,8 @@ protected:
   /// state and restarting program.
   void closeDocument()
   {
+    stashWorker.flush(getDocument(), this);
+
     // TODO : There's probably a cleaner way to do this.
     stateStack.clear();
     history = History();
@@ -397,6 +429,8 @@ protected:
   /// Saves the document to the application storage.
   void saveDocumentToAppStorage()
   {
+    stashWorker.cancel();
+
     AppStorage::saveDocument(documentID, getDocument());
     AppStorage::syncToDevice(this);
   }
@@ -430,6 +464,8 @@ protected:
   /// document and then re-open it.
   void discardChanges()
   {
+    stashWorker.cancel();
+
     AppStorage::removeDocumentStash(documentID);
 
     openDocument(documentID);
@@ -16,6 +16,7 @@ class AppState;
 class Log;
 class MenuBar;
 class Platform;
+class SnapshotSource;
 
 /// This is the interface for the application.
 /// The @ref Platform and @ref App class most communicate
@@ -54,6 +55,17 @@ public:
   virtual Image* getImage() noexcept = 0;
   /// Gets a pointer to the latest rendered image.
   virtual const Image* getImage() const noexcept = 0;
+  /// Replaces the latest rendered image.
+  ///
+  /// @param image The image to replace it with.
+  /// The app takes ownership of this image.
+  ///
+  /// @return The image that was replaced,
+  /// which now belongs to the caller.
+  virtual Image* swapImage(Image* image) noexcept = 0;
+  /// Gets the source of the document snapshots that are
+  /// shared by the workers reading the document in the background.
+  virtual SnapshotSource* getSnapshotSource() noexcept = 0;
   /// Gets a pointer to the platform hosting the app.
   ///
   /// @return A pointer to the platform for non-const access.
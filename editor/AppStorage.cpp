@@ -5,15 +5,42 @@
 #include <libpx.hpp>
 
 #include <filesystem>
+#include <memory>
 #include <sstream>
 
 #include <cerrno>
 
 namespace px {
 
+namespace {
+
+/// The index of the documents in app storage, as it was read
+/// from storage. This is null until the index is first needed,
+/// and again after app storage is loaded from the device.
+std::unique_ptr<Index> loadedIndex;
+
+/// Gets the index of the documents in app storage. It's opened
+/// the first time it's needed and kept in memory afterwards,
+/// so that it isn't read again on every operation.
+Index& getIndex()
+{
+  if (!loadedIndex) {
+    loadedIndex.reset(new Index(AppStorage::getIndexPath().c_str()));
+  }
+
+  return *loadedIndex;
+}
+
+} // namespace
+
+void AppStorage::closeIndex() noexcept
+{
+  loadedIndex.reset();
+}
+
 int AppStorage::createDocument()
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   auto id = index.createDocument();
 
@@ -22,7 +49,7 @@ int AppStorage::createDocument()
 
 void AppStorage::removeDocument(int id)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   index.removeDocument(id);
 
@@ -31,7 +58,7 @@ void AppStorage::removeDocument(int id)
 
 void AppStorage::removeDocumentStash(int id)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   index.removeDocumentStash(id);
 
@@ -50,7 +77,7 @@ AppStorage::Path AppStorage::getIndexPath()
 
 std::string AppStorage::getDocumentName(int id)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   auto entry = index.findEntry(id);
 
@@ -59,7 +86,7 @@ std::string AppStorage::getDocumentName(int id)
 
 void AppStorage::renameDocument(int id, const char* name)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   index.rename(id, name);
 
@@ -68,14 +95,14 @@ void AppStorage::renameDocument(int id, const char* name)
 
 int AppStorage::openDocument(int id, Document* doc, ErrorList** errList)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   return index.openDocument(id, doc, errList);
 }
 
 bool AppStorage::saveDocument(int id, const Document* document)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   if (!index.saveDocument(id, document)) {
     return false;
@@ -88,27 +115,23 @@ bool AppStorage::saveDocument(int id, const Document* document)
 
 bool AppStorage::setUnsaved(int id, bool unsaved)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   index.setUnsaved(id, unsaved);
 
   return index.save(getIndexPath().c_str());
 }
 
-bool AppStorage::stashDocument(int id, const Document* document)
+AppStorage::Path AppStorage::getDocumentStashPath(int id)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
-  if (!index.stashDocument(id, document)) {
-    return false;
-  }
-
-  return index.save(getIndexPath().c_str());
+  return index.findStashPath(id);
 }
 
 void AppStorage::listDocuments(Observer* observer)
 {
-  Index index(getIndexPath().c_str());
+  auto& index = getIndex();
 
   for (std::size_t i = 0; i < index.getEntryCount(); i++) {
 
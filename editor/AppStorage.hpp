@@ -55,6 +55,11 @@ public:
   ///
   /// @return True on success, false on failure.
   static bool init(Observer* observer = nullptr);
+  /// Drops the index of the documents that's kept in memory,
+  /// so that the next operation reads it from storage again.
+  /// This is done once app storage is loaded from the device,
+  /// since an index read before then would be empty.
+  static void closeIndex() noexcept;
   /// Creates a new document.
   ///
   /// @return The ID of the newly created document.
@@ -101,16 +106,13 @@ public:
   ///
   /// @return True on success, false on failure.
   static bool setUnsaved(int id, bool unsaved);
-  /// Stashes unsaved changes to application storage.
+  /// Gets the path that the stash of a document is saved at.
   ///
-  /// @param id The ID of the document being stashed.
-  /// This document will be marked as having unsaved changes
-  /// after calling this function.
+  /// @param id The ID of the document to get the stash path of.
   ///
-  /// @param document The document containing the data to stash.
-  ///
-  /// @return True on success, false on failure.
-  static bool stashDocument(int id, const Document* document);
+  /// @return The path of the stash. This is empty
+  /// if there is no document with the given ID.
+  static Path getDocumentStashPath(int id);
   /// Gets a path to the document index.
   ///
   /// @return A path to the document index.
@@ -4,12 +4,27 @@
 
 #include <emscripten.h>
 
+namespace {
+
+/// Whether or not app storage is being loaded from
+/// the device, after a call to @ref px::AppStorage::init.
+bool loading = false;
+
+} // namespace
+
 extern "C" {
 
 void pxEditAppStorageSync(void* data, char* result)
 {
   px::AppStorage::Observer* observer = (px::AppStorage::Observer*)data;
 
+  // The index may have been read before its file was loaded,
+  // so it's read again by the next operation that needs it.
+  if (loading) {
+    loading = false;
+    px::AppStorage::closeIndex();
+  }
+
   if (observer) {
     observer->observeSyncResult(result);
   }
@@ -21,6 +36,8 @@ namespace px {
 
 bool AppStorage::init(Observer* observer)
 {
+  loading = true;
+
   EM_ASM({
     pxedit.setSyncCallback($0, "pxEditAppStorageSync");
     pxedit.initAppStorage();
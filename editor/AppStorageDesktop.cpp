@@ -13,6 +13,8 @@ bool AppStorage::init(Observer* observer)
   std::filesystem::create_directory(prefix);
   std::filesystem::create_directory(prefix / "Documents");
 
+  closeIndex();
+
   observer->observeSyncResult(nullptr);
 
   return true;
@@ -7,6 +7,7 @@
 #include "LayerPanel.hpp"
 #include "MenuBar.hpp"
 #include "Platform.hpp"
+#include "RenderWorker.hpp"
 #include "Renderer.hpp"
 
 #include "BucketTool.hpp"
@@ -29,6 +30,7 @@
 
 #include <memory>
 
+#include <cstdint>
 #include <cstdio>
 
 namespace px {
@@ -146,6 +148,32 @@ protected:
   }
 };
 
+/// Keeps track of which frames uploaded a new image of the
+/// document. Frames in which no new image has been rendered
+/// reuse the image that was last uploaded to the renderer.
+struct FrameStats final
+{
+  /// The number of frames that uploaded a new image.
+  std::size_t renderedFrames = 0;
+  /// The number of frames that reused the last image.
+  std::size_t skippedFrames = 0;
+  /// The time it took the render worker to
+  /// render the last image, in milliseconds.
+  double renderTime = 0;
+  /// Renders the frame statistics window.
+  void frame()
+  {
+    ImGui::Begin("Frame Stats", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+    ImGui::Text("Frame time:      %.2f ms", 1000.0f / ImGui::GetIO().Framerate);
+    ImGui::Text("Rendered frames: %zu", renderedFrames);
+    ImGui::Text("Skipped frames:  %zu", skippedFrames);
+    ImGui::Text("Last render:     %.2f ms", renderTime);
+
+    ImGui::End();
+  }
+};
+
 /// Represents the application when it is being used
 /// for drawing the artwork.
 class DrawStateImpl final : public DrawState,
@@ -162,8 +190,17 @@ class DrawStateImpl final : public DrawState,
   LeftPanel leftPanel;
   /// Contains the layers in the document.
   RightPanel rightPanel;
+  /// Renders the document on a background thread.
+  RenderWorker renderWorker;
+  /// Whether or not the document has
+  /// been requested from the render worker.
+  bool requested = false;
+  /// The revision of the document that was last requested.
+  std::uint64_t requestedRevision = 0;
+  /// Counts the rendered and skipped frames.
+  FrameStats frameStats;
 public:
-  DrawStateImpl(App* app) : DrawState(app)
+  DrawStateImpl(App* app) : DrawState(app), renderWorker(app->getSnapshotSource())
   {
     currentTool.reset(new PenTool(this));
   }
@@ -175,6 +212,10 @@ public:
     leftPanel(getApp(), drawPanel);
 
     rightPanel(getApp(), layerPanel);
+
+    if (getApp()->getMenuBar()->frameStatsVisible()) {
+      frameStats.frame();
+    }
   }
   /// Handles a mouse button event.
   void mouseButton(const MouseButtonEvent& mouseButton) override
@@ -301,6 +342,9 @@ protected:
     return getApp()->getDocument();
   }
   /// Renders the document onto the window.
+  /// The document is rendered on the render worker whenever it
+  /// changes, and the latest image it completed is uploaded to the
+  /// renderer. This never waits for the render worker to complete.
   void renderDocument()
   {
     auto* renderer = getPlatform()->getRenderer();
@@ -309,17 +353,36 @@ protected:
 
     renderer->setTransform(glm::value_ptr(transform));
 
-    auto* doc = getDocument();
+    const auto* doc = getDocument();
+
+    // The revision also changes when the document is resized.
+    auto revision = getDocRevision(doc);
+
+    // While the worker is busy, the request is made again on a later
+    // frame, so a drag only snapshots the document once per frame at most.
+    if (!requested || (revision != requestedRevision)) {
+      if (renderWorker.request(doc)) {
+        requested = true;
+        requestedRevision = revision;
+      }
+    }
 
-    auto* image = getApp()->getImage();
+    auto* app = getApp();
 
-    render(doc, image);
+    if (auto* frame = renderWorker.takeFrame(app->getImage())) {
 
-    auto* color = getColorBuffer(image);
-    auto w = getImageWidth(image);
-    auto h = getImageHeight(image);
+      app->swapImage(frame);
+
+      renderer->upload(getColorBuffer(frame), getImageWidth(frame), getImageHeight(frame));
+
+      frameStats.renderTime = renderWorker.getRenderTime();
+      frameStats.renderedFrames++;
+
+    } else {
+      frameStats.skippedFrames++;
+    }
 
-    renderer->blit(color, w, h);
+    renderer->draw();
   }
   /// Observes an event from the draw panel.
   void observe(DrawPanel::Event event) override
@@ -16,8 +16,11 @@ void EraserTool::onBegin(const MouseButtonEvent&, int docX, int docY)
 
 void EraserTool::onDrag(const MouseMotionEvent&, int docX, int docY)
 {
+  // Only the new point and the points
+  // before it can have become meaningless.
+  auto first = getPointCount(line);
   addPoint(line, docX, docY);
-  dissolvePoints(line);
+  dissolvePoints(line, first);
 }
 
 void EraserTool::onEnd(int, int)
@@ -8,11 +8,31 @@
 #include "GlslBrowserShaders.hpp"
 #endif
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 namespace px {
 
+namespace {
+
+/// The internal format of the texture.
+/// WebGL 1 requires this to match the format of the pixels.
+#ifdef PXEDIT_DESKTOP
+constexpr GLint internalFormat = GL_RGBA8;
+#else
+constexpr GLint internalFormat = GL_RGBA;
+#endif
+
+/// Converts a color channel to a byte, rounding to the nearest value.
+inline unsigned char toByte(float c) noexcept
+{
+  return (c <= 0) ? 0 : ((c >= 1) ? 255 : (unsigned char) ((c * 255.0f) + 0.5f));
+}
+
+} // namespace
+
 GlRenderer::~GlRenderer()
 {
 }
@@ -29,6 +49,10 @@ bool GlRenderer::init()
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+#ifdef PXEDIT_DESKTOP
+  glGenBuffers(1, &pixelBuffer);
+#endif
+
   glGenVertexArrays(1, &vertexArray);
   glBindVertexArray(vertexArray);
 
@@ -117,14 +141,202 @@ bool GlRenderer::init()
   return true;
 }
 
-void GlRenderer::blit(const float* img, std::size_t w, std::size_t h)
+void GlRenderer::upload(const float* img, std::size_t w, std::size_t h)
+{
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  if ((w != textureWidth) || (h != textureHeight)) {
+
+    glUniform2i(gridSizeLocation, int(w), int(h));
+
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, GLsizei(w), GLsizei(h), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    textureWidth = w;
+    textureHeight = h;
+
+    // Zero is transparent black, which is a valid
+    // color, so force every pixel to be uploaded.
+    pixels.assign(w * h, 0);
+
+    std::size_t region[4] { 0, 0, 0, 0 };
+
+    convert(img, region);
+
+    std::size_t all[4] { 0, 0, w, h };
+
+    uploadRegion(all);
+
+    return;
+  }
+
+  std::size_t region[4] { 0, 0, 0, 0 };
+
+  if (convert(img, region)) {
+    uploadRegion(region);
+  }
+}
+
+bool GlRenderer::convert(const float* img, std::size_t* region)
+{
+  auto w = textureWidth;
+  auto h = textureHeight;
+
+  std::size_t x1 = w;
+  std::size_t y1 = h;
+  std::size_t x2 = 0;
+  std::size_t y2 = 0;
+
+  for (std::size_t y = 0; y < h; y++) {
+
+    auto* src = img + (y * w * 4);
+
+    auto* dst = pixels.data() + (y * w);
+
+    std::size_t rowX1 = w;
+    std::size_t rowX2 = 0;
+
+    for (std::size_t x = 0; x < w; x++) {
+
+      unsigned char rgba[4] {
+        toByte(src[(x * 4) + 0]),
+        toByte(src[(x * 4) + 1]),
+        toByte(src[(x * 4) + 2]),
+        toByte(src[(x * 4) + 3])
+      };
+
+      std::uint32_t packed = 0;
+
+      std::memcpy(&packed, rgba, sizeof(packed));
+
+      if (packed != dst[x]) {
+        dst[x] = packed;
+        rowX1 = (rowX1 < x) ? rowX1 : x;
+        rowX2 = x + 1;
+      }
+    }
+
+    if (rowX1 < rowX2) {
+      x1 = (x1 < rowX1) ? x1 : rowX1;
+      x2 = (x2 > rowX2) ? x2 : rowX2;
+      y1 = (y1 < y) ? y1 : y;
+      y2 = y + 1;
+    }
+  }
+
+  if ((x1 >= x2) || (y1 >= y2)) {
+    return false;
+  }
+
+  region[0] = x1;
+  region[1] = y1;
+  region[2] = x2;
+  region[3] = y2;
+
+  return true;
+}
+
+void GlRenderer::uploadRegion(const std::size_t* region)
+{
+  if ((region[0] >= region[2]) || (region[1] >= region[3])) {
+    return;
+  }
+
+  mipmapsDirty = true;
+
+#ifdef PXEDIT_DESKTOP
+  if (streamRegion(region)) {
+    return;
+  }
+#endif
+
+  // Without a pixel buffer, the rows are uploaded whole so that
+  // they're contiguous, since WebGL 1 can't skip along a row.
+
+  auto y = region[1];
+  auto h = region[3] - region[1];
+
+  const auto* rows = pixels.data() + (y * textureWidth);
+
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, GLint(y), GLsizei(textureWidth), GLsizei(h), GL_RGBA, GL_UNSIGNED_BYTE, rows);
+}
+
+#ifdef PXEDIT_DESKTOP
+
+bool GlRenderer::streamRegion(const std::size_t* region)
+{
+  // The rows of the region are copied into a pixel buffer, which
+  // the driver can transfer to the texture without stalling. The
+  // buffer is orphaned first, so it's never waiting on a transfer.
+
+  auto x = region[0];
+  auto y = region[1];
+  auto w = region[2] - region[0];
+  auto h = region[3] - region[1];
+
+  auto size = GLsizeiptr(w * h * 4);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+  auto* dst = static_cast<std::uint32_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+
+  auto streamed = false;
+
+  if (dst) {
+
+    for (std::size_t row = 0; row < h; row++) {
+      std::memcpy(dst + (row * w), pixels.data() + ((y + row) * textureWidth) + x, w * 4);
+    }
+
+    // The contents of the buffer are lost if unmapping fails.
+    if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, GLint(x), GLint(y), GLsizei(w), GLsizei(h), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+      streamed = true;
+    }
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  return streamed;
+}
+
+#endif // PXEDIT_DESKTOP
+
+void GlRenderer::updateFilter()
 {
-  glUniform2i(gridSizeLocation, int(w), int(h));
+#ifdef PXEDIT_DESKTOP
+
+  // The image covers the viewport when the scale is one.
+  GLint viewport[4] { 0, 0, 0, 0 };
 
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  auto screenW = std::fabs(scale[0]) * float(viewport[2]);
+  auto screenH = std::fabs(scale[1]) * float(viewport[3]);
+
+  auto zoomedOut = (screenW < float(textureWidth)) || (screenH < float(textureHeight));
+
+  if (zoomedOut && mipmapsDirty) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+    mipmapsDirty = false;
+  }
+
+  if (zoomedOut != mipmapsEnabled) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, zoomedOut ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    mipmapsEnabled = zoomedOut;
+  }
+
+#endif // PXEDIT_DESKTOP
+}
+
+void GlRenderer::draw()
+{
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_FLOAT, img);
-  glGenerateMipmap(GL_TEXTURE_2D);
+
+  updateFilter();
 
   glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
 
@@ -172,6 +384,9 @@ void GlRenderer::setCursor(int x, int y)
 
 void GlRenderer::setTransform(const float* data)
 {
+  scale[0] = data[0];
+  scale[1] = data[5];
+
   glUniformMatrix4fv(transformLocation, 1, GL_FALSE /* no transpose */, data);
 }
 
@@ -7,7 +7,10 @@
 
 #include <GL/gl.h>
 
+#include <vector>
+
 #include <cstddef>
+#include <cstdint>
 
 #include "Renderer.hpp"
 
@@ -37,6 +40,25 @@ class GlRenderer final : public Renderer
   /// The ID of the texture that
   /// receives the painter output.
   GLuint texture = 0;
+  /// The width of the texture storage, in pixels.
+  std::size_t textureWidth = 0;
+  /// The height of the texture storage, in pixels.
+  std::size_t textureHeight = 0;
+  /// The last uploaded image, with each pixel packed into
+  /// 8-bit RGBA. New images are compared with it, so that
+  /// only the pixels that changed are uploaded.
+  std::vector<std::uint32_t> pixels;
+  /// Whether or not the mipmaps are out of date.
+  /// They're only built while the image is zoomed out.
+  bool mipmapsDirty = true;
+  /// Whether or not the texture is sampled with mipmaps.
+  bool mipmapsEnabled = false;
+  /// The scale of the image, in normalized device coordinates.
+  float scale[2] { 1, 1 };
+#ifdef PXEDIT_DESKTOP
+  /// The pixel buffer that changed regions are streamed through.
+  GLuint pixelBuffer = 0;
+#endif
 
   /// The location of the image transformation.
   GLuint transformLocation = 0;
@@ -55,13 +77,17 @@ public:
   ///
   /// @return True on success, false on failure.
   bool init();
-  /// Renders an image to the to the window.
+  /// Uploads an image to the texture. The texture storage is only
+  /// allocated when the size of the image changes, and only the
+  /// rectangle of pixels that changed since the last upload is sent.
   ///
-  /// @param img The image to render.
+  /// @param img The image to upload.
   /// The image should be in the format of RGBA.
   /// @param w The width of the image, in pixels.
   /// @param h The height of the image, in pixels.
-  void blit(const float* img, std::size_t w, std::size_t h) override;
+  void upload(const float* img, std::size_t w, std::size_t h) override;
+  /// Renders the texture to the window.
+  void draw() override;
   /// Clears the background.
   void clear(float r, float g, float b, float a) override;
   /// Sets the base color of the checkerboard pattern.
@@ -87,6 +113,33 @@ protected:
   /// @return On success, a non-zero shader ID is returned.
   /// On failure, zero is returned.
   GLuint setupShader(const char* name, const char* source, GLenum shaderType);
+  /// Converts an image to 8-bit RGBA, storing
+  /// the result in @ref GlRenderer::pixels.
+  ///
+  /// @param img The image to convert.
+  /// @param region Receives the rectangle of pixels that changed,
+  /// as the inclusive upper left corner followed by the exclusive
+  /// lower right corner.
+  ///
+  /// @return True if any pixel changed, false otherwise.
+  bool convert(const float* img, std::size_t* region);
+  /// Uploads a rectangle of @ref GlRenderer::pixels to the texture.
+  ///
+  /// @param region The rectangle to upload.
+  void uploadRegion(const std::size_t* region);
+#ifdef PXEDIT_DESKTOP
+  /// Uploads a rectangle of @ref GlRenderer::pixels
+  /// to the texture through the pixel buffer.
+  ///
+  /// @param region The rectangle to upload.
+  ///
+  /// @return True on success, false if the pixel buffer couldn't be
+  /// written to, in which case the rectangle has to be uploaded directly.
+  bool streamRegion(const std::size_t* region);
+#endif
+  /// Builds the mipmaps if the image is zoomed out and switches
+  /// the texture between sampling with and without them.
+  void updateFilter();
 };
 
 } // namespace px
@@ -4,26 +4,86 @@
 
 #include <vector>
 
+#include <cstdint>
+
 namespace px {
 
+namespace {
+
+/// The memory budget used unless another one is set.
+constexpr std::size_t defaultMemoryBudget() noexcept { return 256 * 1024 * 1024; }
+
+/// Indicates that no snapshot in the history is the saved one.
+constexpr std::size_t noSnapshot() noexcept { return SIZE_MAX; }
+
+/// The memory used by a snapshot, not including
+/// the layers it shares with the snapshot before it.
+struct Step final
+{
+  /// The number of bytes used by the snapshot alone.
+  std::size_t bytes = 0;
+  /// Identifies what the snapshot and the one before it looked like
+  /// when the step was measured. See @ref HistoryImpl::refresh.
+  std::uint64_t key = 0;
+};
+
+/// Computes a key from the layers of a document. Documents share
+/// layers by pointing to the same ones, so whether or not a layer is
+/// shared with the snapshot before it only changes when this does.
+///
+/// @param doc The document to compute the key of.
+///
+/// @return The key of the document's layers.
+std::uint64_t layersKey(const Document* doc) noexcept
+{
+  std::uint64_t key = 14695981039346656037ULL;
+
+  for (std::size_t i = 0; i < getLayerCount(doc); i++) {
+    key = (key ^ std::uint64_t(reinterpret_cast<std::uintptr_t>(getLayer(doc, i)))) * 1099511628211ULL;
+  }
+
+  return key;
+}
+
+} // namespace
+
 class HistoryImpl final
 {
   friend History;
 
   std::vector<Document*> snapshots;
+  /// The memory used by each snapshot, with
+  /// one step per snapshot in @ref snapshots.
+  std::vector<Step> steps;
+  /// The sum of the bytes of the steps.
+  std::size_t memoryUsage = 0;
   std::size_t pos = 0;
   std::size_t saved = 0;
+  std::size_t memoryBudget = defaultMemoryBudget();
 
   ~HistoryImpl();
+  /// Adds a snapshot to the end of the history.
+  ///
+  /// @param doc The snapshot to add, which is
+  /// released if it can't be added.
+  void push(Document* doc);
+  /// Releases the snapshots after the current one,
+  /// since they can no longer be redone.
+  void truncate() noexcept;
+  /// Releases the oldest snapshots until the
+  /// history fits into the memory budget.
+  void trim() noexcept;
+  /// Measures the steps whose snapshots changed since they were
+  /// measured. A snapshot changes when it's modified, which changes
+  /// its revision, or when it's given a copy of a layer that another
+  /// snapshot modified, which changes its layers. Checking for either
+  /// is much cheaper than measuring the snapshots again.
+  void refresh() noexcept;
 };
 
 History::History(Document* doc) : impl(new HistoryImpl())
 {
-  if (doc) {
-    impl->snapshots.emplace_back(doc);
-  } else {
-    impl->snapshots.emplace_back(createDoc());
-  }
+  impl->push(doc ? doc : createDoc());
 }
 
 History::~History()
@@ -43,20 +103,28 @@ const Document* History::getDocument() const noexcept
 
 int History::open(const char* path, ErrorList** errList)
 {
+  auto memoryBudget = impl->memoryBudget;
+
   delete impl;
 
   impl = new HistoryImpl();
 
+  impl->memoryBudget = memoryBudget;
+
+  impl->push(createDoc());
+
   return openDoc(impl->snapshots[0], path, errList);
 }
 
 void History::snapshot()
 {
-  impl->snapshots.resize(impl->pos + 1);
+  impl->truncate();
 
-  impl->snapshots.emplace_back(copyDoc(getDocument()));
+  impl->push(copyDoc(getDocument()));
 
   impl->pos = impl->snapshots.size() - 1;
+
+  impl->trim();
 }
 
 void History::undo()
@@ -83,6 +151,20 @@ bool History::isSaved() const noexcept
   return impl->pos == impl->saved;
 }
 
+void History::setMemoryBudget(std::size_t bytes)
+{
+  impl->memoryBudget = bytes;
+
+  impl->trim();
+}
+
+std::size_t History::getMemoryUsage() const noexcept
+{
+  impl->refresh();
+
+  return impl->memoryUsage;
+}
+
 History& History::operator = (History&& other) noexcept
 {
   delete impl;
@@ -96,6 +178,120 @@ HistoryImpl::~HistoryImpl()
   for (auto* doc : snapshots) {
     closeDoc(doc);
   }
-};
+}
+
+void HistoryImpl::push(Document* doc)
+{
+  try {
+    snapshots.reserve(snapshots.size() + 1);
+    steps.reserve(steps.size() + 1);
+  } catch (...) {
+    closeDoc(doc);
+    throw;
+  }
+
+  snapshots.emplace_back(doc);
+
+  steps.emplace_back();
+}
+
+void HistoryImpl::truncate() noexcept
+{
+  for (auto i = pos + 1; i < snapshots.size(); i++) {
+    closeDoc(snapshots[i]);
+    memoryUsage -= steps[i].bytes;
+  }
+
+  snapshots.resize(pos + 1);
+
+  steps.resize(pos + 1);
+
+  if ((saved != noSnapshot()) && (saved > pos)) {
+    saved = noSnapshot();
+  }
+}
+
+void HistoryImpl::trim() noexcept
+{
+  refresh();
+
+  // The current snapshot is always kept, even
+  // if it doesn't fit into the budget on its own.
+
+  std::size_t dropCount = 0;
+
+  auto usage = memoryUsage;
+
+  // The bytes used by the oldest snapshot that is kept.
+  auto firstBytes = steps[0].bytes;
+
+  while ((dropCount < pos) && (usage > memoryBudget)) {
+
+    // The layers that the next snapshot shared with
+    // the dropped one now belong to it alone.
+
+    auto next = dropCount + 1;
+
+    usage -= firstBytes;
+    usage -= steps[next].bytes;
+
+    firstBytes = getDocMemoryUsage(snapshots[next]);
+
+    usage += firstBytes;
+
+    dropCount = next;
+  }
+
+  if (!dropCount) {
+    return;
+  }
+
+  for (std::size_t i = 0; i < dropCount; i++) {
+    closeDoc(snapshots[i]);
+  }
+
+  snapshots.erase(snapshots.begin(), snapshots.begin() + dropCount);
+
+  steps.erase(steps.begin(), steps.begin() + dropCount);
+
+  steps[0].bytes = firstBytes;
+
+  // The first step is keyed without a snapshot before it.
+  steps[0].key = 0;
+
+  memoryUsage = usage;
+
+  pos -= dropCount;
+
+  if (saved != noSnapshot()) {
+    saved = (saved >= dropCount) ? (saved - dropCount) : noSnapshot();
+  }
+}
+
+void HistoryImpl::refresh() noexcept
+{
+  std::uint64_t baseKey = 0;
+
+  for (std::size_t i = 0; i < snapshots.size(); i++) {
+
+    auto& step = steps[i];
+
+    auto layers = layersKey(snapshots[i]);
+
+    auto key = ((layers ^ getDocRevision(snapshots[i])) * 1099511628211ULL) ^ baseKey;
+
+    if (key != step.key) {
+
+      memoryUsage -= step.bytes;
+
+      step.bytes = getDocMemoryUsage(snapshots[i], i ? snapshots[i - 1] : nullptr);
+      step.key = key;
+
+      memoryUsage += step.bytes;
+    }
+
+    baseKey = layers;
+  }
+}
 
 } // namespace px
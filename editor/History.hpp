@@ -1,6 +1,8 @@
 #ifndef LIBPX_EDITOR_HISTORY_HPP
 #define LIBPX_EDITOR_HISTORY_HPP
 
+#include <cstddef>
+
 namespace px {
 
 struct Document;
@@ -10,6 +12,17 @@ class HistoryImpl;
 
 /// Used for storing snapshots of the
 /// document for undo and redo operations.
+///
+/// Each snapshot shares the layers that it has in common
+/// with the snapshot before it, so a snapshot only costs
+/// the memory of the layers that were modified after it.
+/// When the snapshots use more memory than the budget
+/// allows, the oldest ones are released.
+///
+/// Layers are the smallest unit that is shared, so a snapshot
+/// taken before adding one stroke to a layer still costs a copy
+/// of that whole layer. With large layers, this means that few
+/// undo steps fit into the budget.
 class History final
 {
   /// A pointer to the implementation data.
@@ -43,9 +56,22 @@ public:
   ///
   /// @return True if it is, false otherwise.
   bool isSaved() const noexcept;
+  /// Sets the amount of memory that the snapshots may use.
+  /// The oldest snapshots are released until the history fits,
+  /// although the current snapshot is always kept.
+  ///
+  /// @param bytes The memory budget, in bytes.
+  void setMemoryBudget(std::size_t bytes);
+  /// Measures the memory used by the snapshots.
+  /// Layers shared between snapshots are counted once.
+  ///
+  /// @return The number of bytes used by the snapshots.
+  std::size_t getMemoryUsage() const noexcept;
   /// Pushes a new document to the history stack.
   /// If there were snapshots that were undone, they
   /// are erased at this point and no longer available for redo.
+  /// If the history no longer fits into the memory budget,
+  /// the oldest snapshots are released.
   void snapshot();
   /// Performs an undo operation.
   /// The next call to getDocument() will
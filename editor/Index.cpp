@@ -4,13 +4,18 @@
 
 #include <libpx.hpp>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <cerrno>
+#include <cstddef>
+#include <cstdint>
 
 #ifdef __clang__
 #pragma clang diagnostic push
@@ -74,6 +79,37 @@ void createEmptyFile(const char* path)
   }
 }
 
+/// The fewest records that the journal is allowed
+/// to hold before it's compacted into the index file.
+constexpr std::size_t minJournalSize() noexcept { return 64; }
+
+/// Gets the path of the journal that belongs to an index file.
+/// The journal records the changes made to the index since the
+/// index file was last written, one JSON object per line. Each
+/// record carries the generation of the index file it was written
+/// after, so that records left over from before a compaction are
+/// told apart from the ones written after it.
+///
+/// @param path The path of the index file.
+///
+/// @return The path of the journal.
+std::string getJournalPath(const std::string& path)
+{
+  return path + ".journal";
+}
+
+/// Converts an entry to its JSON representation, which is
+/// used both in the index file and in the journal.
+nlohmann::json toJson(const EntryImpl& ent)
+{
+  return nlohmann::json {
+    { "path", ent.path },
+    { "name", ent.name },
+    { "id", ent.id },
+    { "unsaved", ent.unsaved }
+  };
+}
+
 } // namespace
 
 /// Contains all the implementation data for the index.
@@ -82,10 +118,282 @@ class IndexImpl final
   friend Index;
   /// Contains information on all documents known to the index.
   std::vector<EntryImpl> entries;
+  /// Maps the ID of each document to its position in @ref entries.
+  std::unordered_map<int, std::size_t> positions;
   /// The value of the next document ID.
   int nextID = 0;
+  /// The path of the index file that was opened or last saved.
+  /// Changes to the index are journaled next to this file.
+  std::string path;
+  /// The generation of the index file, which goes up each time
+  /// it's compacted. Journal records of an older generation were
+  /// already compacted into the index file, and are skipped.
+  std::uint64_t generation = 0;
+  /// The number of records in the journal.
+  std::size_t journalSize = 0;
+  /// Whether or not the journal ends in a record that was cut
+  /// short, after which no more records can be appended.
+  bool journalDamaged = false;
+  /// The IDs of the documents changed since the index was last saved.
+  std::unordered_set<int> changed;
+
+  /// Finds the entry of a document.
+  ///
+  /// @return The entry, or a null pointer if there isn't one.
+  EntryImpl* find(int id) noexcept;
+  /// Finds the entry of a document.
+  ///
+  /// @return The entry, or a null pointer if there isn't one.
+  const EntryImpl* find(int id) const noexcept;
+  /// Adds an entry, or replaces the entry with the same ID.
+  void put(EntryImpl&& entry);
+  /// Removes the entry of a document, if there is one.
+  void remove(int id);
+  /// Records that a document was changed, so
+  /// that the next save writes its entry.
+  void markChanged(int id);
+  /// Applies the records of a journal to the entries.
+  /// A record that was cut short by a crash is ignored,
+  /// and so are records from an older generation.
+  void replay(const std::string& journalPath);
+  /// Appends the changed entries to the journal.
+  ///
+  /// @return True on success, false on failure.
+  bool append();
+  /// Writes all of the entries to an index file
+  /// and discards the journal that belonged to it.
+  ///
+  /// @return True on success, false on failure.
+  bool compact(const std::string& indexPath);
 };
 
+EntryImpl* IndexImpl::find(int id) noexcept
+{
+  auto it = positions.find(id);
+
+  return (it != positions.end()) ? &entries[it->second] : nullptr;
+}
+
+const EntryImpl* IndexImpl::find(int id) const noexcept
+{
+  auto it = positions.find(id);
+
+  return (it != positions.end()) ? &entries[it->second] : nullptr;
+}
+
+void IndexImpl::put(EntryImpl&& entry)
+{
+  auto* existing = find(entry.id);
+
+  if (existing) {
+    *existing = std::move(entry);
+    return;
+  }
+
+  positions.emplace(entry.id, entries.size());
+
+  entries.emplace_back(std::move(entry));
+}
+
+void IndexImpl::remove(int id)
+{
+  auto it = positions.find(id);
+
+  if (it == positions.end()) {
+    return;
+  }
+
+  auto pos = it->second;
+
+  positions.erase(it);
+
+  entries.erase(entries.begin() + std::ptrdiff_t(pos));
+
+  // Documents are listed in the order they were created, so the
+  // entries after it are shifted. This makes removing a document
+  // linear in the number of entries, unlike the other operations.
+  for (auto i = pos; i < entries.size(); i++) {
+    positions[entries[i].id] = i;
+  }
+}
+
+void IndexImpl::markChanged(int id)
+{
+  changed.emplace(id);
+}
+
+void IndexImpl::replay(const std::string& journalPath)
+{
+  using namespace nlohmann;
+
+  std::ifstream journal(journalPath);
+
+  std::string line;
+
+  while (std::getline(journal, line)) {
+
+    auto record = json::parse(line, nullptr, false);
+
+    if (record.is_discarded() || !record.is_object()) {
+      journalDamaged = true;
+      break;
+    }
+
+    journalSize++;
+
+    // If a crash came between writing the compacted index file and
+    // removing the journal, the journal still holds records that were
+    // compacted. Those may be older than the entries in the index file.
+    if (record.value("generation", std::uint64_t(0)) != generation) {
+      continue;
+    }
+
+    auto recordNextID = record.value("next_id", nextID);
+
+    if (recordNextID > nextID) {
+      nextID = recordNextID;
+    }
+
+    auto id = record.value("id", -1);
+
+    if (record.value("removed", false)) {
+      remove(id);
+      continue;
+    }
+
+    put(EntryImpl {
+      record.value("path", std::string()),
+      record.value("name", std::string()),
+      id,
+      record.value("unsaved", false)
+    });
+  }
+}
+
+bool IndexImpl::append()
+{
+  using namespace nlohmann;
+
+  if (changed.empty()) {
+    return true;
+  }
+
+  std::ofstream journal(getJournalPath(path), std::ios::app);
+  if (!journal.good()) {
+    return false;
+  }
+
+  // IDs go up in the order that documents are created, so writing
+  // the records in that order lists new documents in the same order
+  // once the journal is replayed.
+  std::vector<int> ids(changed.begin(), changed.end());
+
+  std::sort(ids.begin(), ids.end());
+
+  for (auto id : ids) {
+
+    const auto* ent = find(id);
+
+    json record;
+
+    if (ent) {
+      record = toJson(*ent);
+    } else {
+      record = json { { "id", id }, { "removed", true } };
+    }
+
+    record["next_id"] = nextID;
+
+    record["generation"] = generation;
+
+    journal << record.dump() << '\n';
+  }
+
+  journal.flush();
+
+  if (!journal.good()) {
+    return false;
+  }
+
+  journalSize += changed.size();
+
+  changed.clear();
+
+  return true;
+}
+
+bool IndexImpl::compact(const std::string& indexPath)
+{
+  using namespace nlohmann;
+
+  json jsonDocs = json::array();
+
+  for (const auto& ent : entries) {
+    jsonDocs.push_back(toJson(ent));
+  }
+
+  std::error_code errorCode;
+
+  // A journal next to another index file belongs to the index that's
+  // being replaced, and its generations have nothing to do with ours.
+  if (indexPath != path) {
+    std::filesystem::remove(getJournalPath(indexPath), errorCode);
+    if (errorCode) {
+      return false;
+    }
+  }
+
+  auto nextGeneration = generation + 1;
+
+  json jsonRoot {
+    { "documents", jsonDocs },
+    { "next_id", nextID },
+    { "generation", nextGeneration }
+  };
+
+  // The index is written to a temporary file first,
+  // so that a crash doesn't leave it half written.
+  auto tmpPath = indexPath + ".tmp";
+
+  {
+    std::ofstream file(tmpPath);
+
+    file << std::setw(4);
+
+    file << jsonRoot;
+
+    file.close();
+
+    if (!file.good()) {
+      return false;
+    }
+  }
+
+  std::filesystem::rename(tmpPath, indexPath, errorCode);
+
+  if (errorCode) {
+    return false;
+  }
+
+  // If this fails, the records left in the journal are of
+  // the previous generation, so they aren't replayed. The journal
+  // may end in a record that was cut short though, so the next save
+  // compacts again instead of appending to it.
+  std::filesystem::remove(getJournalPath(indexPath), errorCode);
+
+  generation = nextGeneration;
+
+  path = indexPath;
+
+  journalSize = 0;
+
+  journalDamaged = bool(errorCode);
+
+  changed.clear();
+
+  return true;
+}
+
 Index::Index() : self(new IndexImpl()) {}
 
 Index::Index(const char* path) : Index()
@@ -112,44 +420,52 @@ int Index::createDocument()
 
   createEmptyFile(entry.path.c_str());
 
-  self->entries.emplace_back(std::move(entry));
+  self->put(std::move(entry));
+
+  self->markChanged(id);
 
   return id;
 }
 
 void Index::removeDocument(int id)
 {
-  for (std::size_t i = 0; i < self->entries.size(); i++) {
-    if (self->entries[i].id == id) {
-      std::filesystem::remove(self->entries[i].path);
-      std::filesystem::remove(getStashPath(self->entries[i]));
-      self->entries.erase(self->entries.begin() + i);
-    }
+  const auto* ent = self->find(id);
+  if (!ent) {
+    return;
   }
+
+  std::filesystem::remove(ent->path);
+  std::filesystem::remove(getStashPath(*ent));
+
+  self->remove(id);
+
+  self->markChanged(id);
 }
 
 void Index::removeDocumentStash(int id)
 {
-  for (std::size_t i = 0; i < self->entries.size(); i++) {
-
-    if (self->entries[i].id != id) {
-      continue;
-    }
-
-    std::filesystem::remove(getStashPath(self->entries[i]));
-    self->entries[i].unsaved = false;
+  auto* ent = self->find(id);
+  if (!ent) {
     return;
   }
+
+  std::filesystem::remove(getStashPath(*ent));
+
+  ent->unsaved = false;
+
+  self->markChanged(id);
 }
 
 void Index::rename(int id, const char* name)
 {
-  for (auto& ent : self->entries) {
-    if (ent.id == id) {
-      ent.name = name;
-      return;
-    }
+  auto* ent = self->find(id);
+  if (!ent) {
+    return;
   }
+
+  ent->name = name;
+
+  self->markChanged(id);
 }
 
 bool Index::open(const char* path)
@@ -162,6 +478,11 @@ bool Index::open(const char* path)
   }
 
   self->entries.clear();
+  self->positions.clear();
+  self->changed.clear();
+  self->journalSize = 0;
+  self->journalDamaged = false;
+  self->path = path;
 
   json jsonRoot;
 
@@ -175,8 +496,12 @@ bool Index::open(const char* path)
     self->nextID = 0;
   }
 
+  self->generation = jsonRoot.value("generation", std::uint64_t(0));
+
   auto jsonDocs = jsonRoot["documents"];
 
+  std::unordered_set<std::string> paths;
+
   for (const auto& jsonDoc : jsonDocs) {
 
     EntryImpl entry {
@@ -186,134 +511,105 @@ bool Index::open(const char* path)
       jsonDoc["unsaved"].get<bool>()
     };
 
-    if (!pathExists(entry.path.c_str())) {
-      self->entries.emplace_back(std::move(entry));
+    if (paths.emplace(entry.path).second) {
+      self->put(std::move(entry));
     }
   }
 
+  self->replay(getJournalPath(path));
+
   return true;
 }
 
 int Index::openDocument(int id, Document* doc, ErrorList** errList)
 {
-  for (const auto& ent : self->entries) {
-    if (ent.id != id) {
-      continue;
-    }
-
-    std::string path = ent.unsaved ? getStashPath(ent) : ent.path;
-
-    return openDoc(doc, path.c_str(), errList);
+  const auto* ent = self->find(id);
+  if (!ent) {
+    return ENOENT;
   }
 
-  return ENOENT;
+  std::string path = ent->unsaved ? getStashPath(*ent) : ent->path;
+
+  return openDoc(doc, path.c_str(), errList);
 }
 
-bool Index::save(const char* path) const
+bool Index::save(const char* path)
 {
-  using namespace nlohmann;
-
-  std::ofstream file(path);
-  if (!file.good()) {
+  // An index file that wasn't read would be replaced by this index,
+  // which might be missing its entries, so it's never written over.
+  if ((self->path != path) && std::filesystem::exists(path)) {
     return false;
   }
 
-  json jsonDocs;
-
-  for (const auto& ent : self->entries) {
+  // Once the journal holds more records than there are entries,
+  // reading it costs more than reading the index file, so it's
+  // compacted. This keeps the cost of each save constant on average.
+  auto journalLimit = std::max(minJournalSize(), self->entries.size());
 
-    json jsonDoc {
-      { "path", ent.path },
-      { "name", ent.name },
-      { "id", ent.id },
-      { "unsaved", ent.unsaved }
-    };
+  auto compact = (self->path != path)
+              || self->journalDamaged
+              || ((self->journalSize + self->changed.size()) > journalLimit);
 
-    jsonDocs.push_back(jsonDoc);
+  if (compact) {
+    return self->compact(path);
   }
 
-  json jsonRoot {
-    { "documents", jsonDocs },
-    { "next_id", self->nextID }
-  };
-
-  file << std::setw(4);
-
-  file << jsonRoot;
-
-  return true;
+  return self->append();
 }
 
 bool Index::saveDocument(int id, const Document* doc)
 {
-  const char* path = "";
-
-  std::size_t entry_index = SIZE_MAX;
-
-  for (std::size_t i = 0; i < self->entries.size(); i++) {
-    if (self->entries[i].id == id) {
-      entry_index = i;
-      path = self->entries[i].path.c_str();
-      break;
-    }
-  }
-
-  if (entry_index == SIZE_MAX) {
+  auto* ent = self->find(id);
+  if (!ent) {
     return false;
   }
 
-  if (!saveDoc(doc, path)) {
+  if (!saveDoc(doc, ent->path.c_str())) {
     return false;
   }
 
-  self->entries[entry_index].unsaved = false;
+  ent->unsaved = false;
+
+  self->markChanged(id);
 
   return true;
 }
 
 bool Index::setUnsaved(int id, bool unsaved)
 {
-  for (auto& ent : self->entries) {
-    if (ent.id == id) {
-      ent.unsaved = unsaved;
-      return true;
-    }
+  auto* ent = self->find(id);
+  if (!ent) {
+    return false;
+  }
+
+  if (ent->unsaved != unsaved) {
+    ent->unsaved = unsaved;
+    self->markChanged(id);
   }
 
-  return false;
+  return true;
 }
 
-bool Index::stashDocument(int id, const Document* doc)
+Index::Entry Index::findEntry(int id) const noexcept
 {
-  for (auto& ent : self->entries) {
-
-    if (ent.id == id) {
-
-      ent.unsaved = true;
-
-      std::string path = getStashPath(ent);
-
-      return saveDoc(doc, path.c_str());
-    }
+  const auto* ent = self->find(id);
+  if (!ent) {
+    return Entry {};
   }
 
-  return false;
+  return Entry {
+    ent->path.c_str(),
+    ent->name.c_str(),
+    ent->id,
+    ent->unsaved
+  };
 }
 
-Index::Entry Index::findEntry(int id) const noexcept
+std::string Index::findStashPath(int id) const
 {
-  for (const auto& ent : self->entries) {
-    if (ent.id == id) {
-      return Entry {
-        ent.path.c_str(),
-        ent.name.c_str(),
-        ent.id,
-        ent.unsaved
-      };
-    }
-  }
+  const auto* ent = self->find(id);
 
-  return Entry {};
+  return ent ? getStashPath(*ent) : std::string();
 }
 
 Index::Entry Index::getEntry(std::size_t index) const noexcept
@@ -335,15 +631,4 @@ std::size_t Index::getEntryCount() const noexcept
   return self->entries.size();
 }
 
-bool Index::pathExists(const char* path) const noexcept
-{
-  for (const auto& ent : self->entries) {
-    if (ent.path == path) {
-      return true;
-    }
-  }
-
-  return false;
-}
-
 } // namesapce px
@@ -1,6 +1,8 @@
 #ifndef LIBPX_EDITOR_INDEX_HPP
 #define LIBPX_EDITOR_INDEX_HPP
 
+#include <string>
+
 #include <cstddef>
 
 namespace px {
@@ -12,6 +14,10 @@ class IndexImpl;
 
 /// Used to store information about
 /// the documents in the application storage.
+///
+/// Entries are found by their ID through a hash map. Changes
+/// are saved by appending the changed entries to a journal,
+/// which is compacted into the index file once it grows large.
 class Index final
 {
   /// A pointer to the implementation data.
@@ -51,6 +57,7 @@ public:
   /// @return The ID of the document.
   int createDocument();
   /// Opens an index at a certain path.
+  /// The changes in the journal next to it are applied as well.
   ///
   /// @param path The path to the index to open.
   ///
@@ -79,10 +86,18 @@ public:
   void rename(int id, const char* name);
   /// Saves the index to a path.
   ///
+  /// If the index was opened or last saved at the same path, then
+  /// only the entries changed since then are appended to the journal
+  /// next to it. Once the journal grows larger than the index, or if
+  /// the path is a different one, the whole index is written instead.
+  ///
+  /// An existing file at a different path is never written over,
+  /// so an index that failed to open doesn't replace its file.
+  ///
   /// @param path The path to save the index at.
   ///
   /// @return True on success, false on failure.
-  bool save(const char* path) const;
+  bool save(const char* path);
   /// Saves a document.
   ///
   /// @param id The ID of the document within the index.
@@ -97,13 +112,6 @@ public:
   ///
   /// @return True on success, false on failure.
   bool setUnsaved(int id, bool unsaved);
-  /// Saves a temporary copy of a document that contains unsaved changes.
-  ///
-  /// @param id The ID of the document to stash the data for.
-  /// @param document The document instance containing the data to stash.
-  ///
-  /// @return True on success, false on failure.
-  bool stashDocument(int id, const Document* document);
   /// Finds the entry to a document.
   ///
   /// @param id The ID to find the entry for.
@@ -111,6 +119,13 @@ public:
   /// @return On success, the entry for the specified document.
   /// On failure, a default initialized entry instance.
   Entry findEntry(int id) const noexcept;
+  /// Finds the path that the stash of a document is saved at.
+  ///
+  /// @param id The ID of the document to find the stash path of.
+  ///
+  /// @return On success, the path of the stash.
+  /// On failure, an empty string.
+  std::string findStashPath(int id) const;
   /// Gets an entry within the index.
   ///
   /// @param index The index of the entry to get.
@@ -123,10 +138,6 @@ public:
   ///
   /// @return The number of entries in the index.
   std::size_t getEntryCount() const noexcept;
-protected:
-  /// Indicates if an entry exists already
-  /// for a given path.
-  bool pathExists(const char* path) const noexcept;
 };
 
 } // namespace px
@@ -66,7 +66,7 @@ class LayerPanelImpl final
   /// Renders the properties of a specific layer.
   void renderLayerProperties(std::size_t index, App* app)
   {
-    auto* layer = getLayer(app, index);
+    const auto* layer = getLayerForReading(app, index);
     auto opacity = getLayerOpacity(layer);
     auto visible = getLayerVisibility(layer);
 
@@ -101,6 +101,13 @@ protected:
   {
     return px::getLayer(app->getDocument(), index);
   }
+  /// Gets a layer without asking to modify it. A layer that is
+  /// shared with a snapshot is copied when it's accessed with
+  /// @ref getLayer, so this is used when only reading it.
+  const Layer* getLayerForReading(const App* app, std::size_t index)
+  {
+    return px::getLayer(app->getDocument(), index);
+  }
   /// Renders a single layer.
   void renderLayer(std::size_t i, App* app)
   {
@@ -148,7 +155,7 @@ protected:
   {
     auto& state = states[index];
 
-    const auto* name = getLayerName(getLayer(app, index));
+    const auto* name = getLayerName(getLayerForReading(app, index));
 
     if (ImGui::Selectable(name, state.selected, ImGuiSelectableFlags_AllowDoubleClick)) {
 
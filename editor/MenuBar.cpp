@@ -136,6 +136,8 @@ void MenuBar::viewMenu(Observer* observer)
 
   ImGui::Checkbox("Style Editor", &visibility.styleEditor);
 
+  ImGui::Checkbox("Frame Stats", &visibility.frameStats);
+
   ImGui::EndMenu();
 }
 
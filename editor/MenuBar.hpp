@@ -16,6 +16,8 @@ class MenuBar final
     /// There's not a checkbox for this,
     /// since it's not useful for drawing.
     bool styleEditor = false;
+    /// Whether or not the frame statistics are visible.
+    bool frameStats = false;
   };
   /// The one and only instance of @ref VisibilityState.
   VisibilityState visibility;
@@ -61,6 +63,11 @@ public:
   {
     return visibility.styleEditor;
   }
+  /// Indicates whether or not the frame statistics are visible.
+  inline bool frameStatsVisible() const noexcept
+  {
+    return visibility.frameStats;
+  }
   /// Gets the name of the currently selected theme.
   inline const char* getSelectedTheme() const noexcept
   {
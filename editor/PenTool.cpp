@@ -16,8 +16,11 @@ void PenTool::onBegin(const MouseButtonEvent&, int docX, int docY)
 
 void PenTool::onDrag(const MouseMotionEvent&, int docX, int docY)
 {
+  // Only the new point and the points
+  // before it can have become meaningless.
+  auto first = getPointCount(line);
   addPoint(line, docX, docY);
-  dissolvePoints(line);
+  dissolvePoints(line, first);
 }
 
 void PenTool::onEnd(int, int)
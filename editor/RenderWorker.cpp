@@ -0,0 +1,265 @@
+#include "RenderWorker.hpp"
+
+#include "SnapshotSource.hpp"
+
+#include <libpx.hpp>
+
+#include <chrono>
+#include <utility>
+
+#ifdef PXEDIT_DESKTOP
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace px {
+
+namespace {
+
+/// Renders a snapshot into an image the size of the document.
+///
+/// @param compositor Keeps the layers that didn't change since the
+/// last frame, so that showing, hiding or editing one layer doesn't
+/// paint the others again.
+///
+/// @return The time it took to render the image, in milliseconds.
+double renderSnapshot(const Document* doc, Image* image, Compositor* compositor)
+{
+  using Clock = std::chrono::steady_clock;
+
+  auto start = Clock::now();
+
+  resizeImage(image, getDocWidth(doc), getDocHeight(doc));
+
+  try {
+    render(doc, image, compositor);
+  } catch (...) {
+    // Without the memory for the layers,
+    // they're painted straight onto the image.
+    render(doc, image);
+  }
+
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+
+  return elapsed.count();
+}
+
+} // namespace
+
+class RenderWorkerImpl final
+{
+  friend RenderWorker;
+
+  /// The image that the next frame is rendered into.
+  Image* back = createImage(64, 64);
+  /// The latest completed frame. This is null
+  /// if it was taken by the UI thread already.
+  Image* ready = nullptr;
+  /// The image given back by the UI thread for
+  /// rendering later frames into, if not used yet.
+  Image* spare = nullptr;
+  /// The time it took to render the latest completed frame.
+  double renderTime = 0;
+  /// Caches the layers of the frames. This is only
+  /// accessed from the thread that renders the frames.
+  Compositor* compositor = createCompositor();
+
+#ifdef PXEDIT_DESKTOP
+  /// Takes the snapshots that are rendered. This
+  /// is only accessed from the UI thread.
+  SnapshotSource* source = nullptr;
+  /// Guards the pending snapshot, the ready
+  /// frame and the state of the render thread.
+  std::mutex mutex;
+  /// Signals the render thread that a snapshot
+  /// is pending or that it has to stop.
+  std::condition_variable condition;
+  /// The snapshot waiting to be rendered.
+  SnapshotPtr pending;
+  /// Whether or not the render thread is rendering a snapshot.
+  bool busy = false;
+  /// Whether or not the render thread has to stop.
+  bool stopping = false;
+  /// The thread that renders the snapshots.
+  std::thread thread;
+
+  /// Renders the pending snapshots until
+  /// the render thread is asked to stop.
+  void run();
+#endif // PXEDIT_DESKTOP
+
+#ifdef PXEDIT_DESKTOP
+  RenderWorkerImpl(SnapshotSource* s) : source(s) {}
+#else
+  RenderWorkerImpl(SnapshotSource*) {}
+#endif
+
+  ~RenderWorkerImpl();
+  /// Makes the image that was just rendered the ready frame.
+  ///
+  /// @param time The time it took to render the frame.
+  void complete(double time);
+  /// Takes the ready frame, if there is one.
+  ///
+  /// @param image The image to keep for rendering later frames
+  /// into. This is only taken if there was a ready frame.
+  Image* take(Image* image) noexcept;
+};
+
+RenderWorkerImpl::~RenderWorkerImpl()
+{
+  closeImage(back);
+  closeImage(ready);
+  closeImage(spare);
+  closeCompositor(compositor);
+}
+
+void RenderWorkerImpl::complete(double time)
+{
+  // A frame that was never taken is rendered over.
+  std::swap(back, ready);
+
+  if (!back) {
+    back = spare ? spare : createImage(64, 64);
+    spare = nullptr;
+  }
+
+  renderTime = time;
+}
+
+Image* RenderWorkerImpl::take(Image* image) noexcept
+{
+  auto* frame = ready;
+
+  if (frame) {
+    closeImage(spare);
+    spare = image;
+    ready = nullptr;
+  }
+
+  return frame;
+}
+
+#ifdef PXEDIT_DESKTOP
+
+void RenderWorkerImpl::run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+
+    condition.wait(lock, [this]() { return stopping || pending; });
+
+    if (stopping) {
+      break;
+    }
+
+    auto snapshot = std::move(pending);
+
+    busy = true;
+
+    lock.unlock();
+
+    auto time = renderSnapshot(snapshot.get(), back, compositor);
+
+    // The snapshot may be the last reference, in which
+    // case it's released on this thread, outside of the lock.
+    snapshot.reset();
+
+    lock.lock();
+
+    busy = false;
+
+    complete(time);
+  }
+}
+
+RenderWorker::RenderWorker(SnapshotSource* source) : impl(new RenderWorkerImpl(source))
+{
+  impl->thread = std::thread([this]() { impl->run(); });
+}
+
+RenderWorker::~RenderWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->stopping = true;
+  }
+
+  impl->condition.notify_one();
+
+  impl->thread.join();
+
+  delete impl;
+}
+
+bool RenderWorker::request(const Document* doc)
+{
+  {
+    // Only the UI thread makes requests, so the worker
+    // can't go from idle to busy after this check.
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    if (impl->pending || impl->busy) {
+      return false;
+    }
+  }
+
+  auto snapshot = impl->source->take(doc);
+
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->pending = std::move(snapshot);
+  }
+
+  impl->condition.notify_one();
+
+  return true;
+}
+
+Image* RenderWorker::takeFrame(Image* spare) noexcept
+{
+  std::lock_guard<std::mutex> lock(impl->mutex);
+
+  return impl->take(spare);
+}
+
+double RenderWorker::getRenderTime() const noexcept
+{
+  std::lock_guard<std::mutex> lock(impl->mutex);
+
+  return impl->renderTime;
+}
+
+#else // PXEDIT_DESKTOP
+
+RenderWorker::RenderWorker(SnapshotSource* source) : impl(new RenderWorkerImpl(source)) {}
+
+RenderWorker::~RenderWorker()
+{
+  delete impl;
+}
+
+bool RenderWorker::request(const Document* doc)
+{
+  // There are no threads in the browser, so the
+  // document is rendered as it is, without a snapshot.
+
+  impl->complete(renderSnapshot(doc, impl->back, impl->compositor));
+
+  return true;
+}
+
+Image* RenderWorker::takeFrame(Image* spare) noexcept
+{
+  return impl->take(spare);
+}
+
+double RenderWorker::getRenderTime() const noexcept
+{
+  return impl->renderTime;
+}
+
+#endif // PXEDIT_DESKTOP
+
+} // namespace px
@@ -0,0 +1,74 @@
+#ifndef LIBPX_EDITOR_RENDER_WORKER_HPP
+#define LIBPX_EDITOR_RENDER_WORKER_HPP
+
+namespace px {
+
+struct Document;
+struct Image;
+
+class RenderWorkerImpl;
+class SnapshotSource;
+
+/// Renders the document on a background thread,
+/// so that a document that takes a long time to
+/// render doesn't hold up the user interface.
+///
+/// The worker renders a snapshot of the document, so the
+/// document can be modified while it's being rendered. While
+/// the worker is busy with a frame, requests are turned down
+/// without taking a snapshot, so the document is only copied
+/// as often as the worker can render it.
+/// The layers of each frame are kept for the next one, so
+/// showing or hiding a layer only composites the layers again.
+///
+/// In the browser, where there are no threads,
+/// the document is rendered as it is requested.
+class RenderWorker final
+{
+  /// A pointer to the implementation data.
+  RenderWorkerImpl* impl = nullptr;
+public:
+  /// Starts the render thread.
+  ///
+  /// @param source Takes the snapshots of the document
+  /// that are rendered. It has to outlive the worker.
+  RenderWorker(SnapshotSource* source);
+  /// Stops the render thread, waiting for
+  /// the frame it's rendering to complete.
+  ~RenderWorker();
+  /// Workers are not copied, since they own a thread.
+  RenderWorker(const RenderWorker&) = delete;
+  /// Workers are not copied, since they own a thread.
+  RenderWorker& operator = (const RenderWorker&) = delete;
+  /// Requests a frame of the document to be rendered.
+  /// This takes a snapshot of the document from the snapshot
+  /// source, which only copies the layers modified since the
+  /// last snapshot it took.
+  /// It's meant to be called at most once per frame.
+  ///
+  /// @param doc The document to render.
+  /// It may be modified once this function returns.
+  ///
+  /// @return True if the frame was requested. If the worker is
+  /// still rendering an earlier frame, then no snapshot is taken
+  /// and this is false, in which case the request should be made
+  /// again on a later frame.
+  bool request(const Document* doc);
+  /// Takes the latest completed frame, without waiting for one.
+  ///
+  /// @param spare An image that the worker can render later frames
+  /// into. This is only taken if a completed frame is returned.
+  ///
+  /// @return The image of the latest completed frame, which now belongs
+  /// to the caller. If no frame has completed since the last call, then
+  /// this is a null pointer.
+  Image* takeFrame(Image* spare) noexcept;
+  /// Gets the time it took to render the latest completed frame.
+  ///
+  /// @return The render time, in milliseconds.
+  double getRenderTime() const noexcept;
+};
+
+} // namespace px
+
+#endif // LIBPX_EDITOR_RENDER_WORKER_HPP
@@ -15,12 +15,15 @@ class Renderer
 public:
   /// Just a stub.
   virtual ~Renderer() {}
-  /// Blits the document image onto the window.
+  /// Uploads the document image, to be drawn by @ref Renderer::draw.
+  /// This only has to be called when the image has changed.
   ///
   /// @param img A pointer to the RGBA image data.
   /// @param w The width of the image, in pixels.
   /// @param h The height of the image, in pixels.
-  virtual void blit(const float* img, std::size_t w, std::size_t h) = 0;
+  virtual void upload(const float* img, std::size_t w, std::size_t h) = 0;
+  /// Draws the last uploaded image onto the window.
+  virtual void draw() = 0;
   /// Clears the window background.
   ///
   /// @note The RGB components should not be premultiplied.
@@ -0,0 +1,33 @@
+#include "SnapshotSource.hpp"
+
+#include <libpx.hpp>
+
+namespace px {
+
+namespace {
+
+/// Releases a document snapshot.
+struct SnapshotDeleter final
+{
+  void operator () (Document* doc) const noexcept
+  {
+    closeDoc(doc);
+  }
+};
+
+} // namespace
+
+SnapshotPtr SnapshotSource::take(const Document* doc)
+{
+  // Revisions are never reused, so a snapshot
+  // with the same revision looks the same.
+  if (latest && (getDocRevision(latest.get()) == getDocRevision(doc))) {
+    return latest;
+  }
+
+  latest = SnapshotPtr(snapshotDoc(doc, latest.get()), SnapshotDeleter());
+
+  return latest;
+}
+
+} // namespace px
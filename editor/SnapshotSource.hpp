@@ -0,0 +1,41 @@
+#ifndef LIBPX_EDITOR_SNAPSHOT_SOURCE_HPP
+#define LIBPX_EDITOR_SNAPSHOT_SOURCE_HPP
+
+#include <memory>
+
+namespace px {
+
+struct Document;
+
+/// A type definition for a document snapshot pointer.
+/// Snapshots are shared between the UI thread and the
+/// worker threads, and are released by whichever one
+/// drops the last reference.
+using SnapshotPtr = std::shared_ptr<Document>;
+
+/// Takes the snapshots of the document for the workers
+/// that read it in the background. Only the latest snapshot
+/// is kept, and it's shared by all the workers, so that the
+/// document isn't copied once per worker.
+///
+/// This is only used from the UI thread.
+class SnapshotSource final
+{
+  /// The latest snapshot that was taken, which shares
+  /// the unmodified layers with the next snapshot.
+  SnapshotPtr latest;
+public:
+  /// Gets a snapshot of the document as it is now. If the
+  /// latest snapshot has the same revision as the document,
+  /// then it's returned as it is. Otherwise, a new snapshot is
+  /// taken, which only copies the layers modified since then.
+  ///
+  /// @param doc The document to take the snapshot of.
+  ///
+  /// @return The snapshot of the document.
+  SnapshotPtr take(const Document* doc);
+};
+
+} // namespace px
+
+#endif // LIBPX_EDITOR_SNAPSHOT_SOURCE_HPP
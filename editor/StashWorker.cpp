@@ -0,0 +1,393 @@
+#include "StashWorker.hpp"
+
+#include "SnapshotSource.hpp"
+
+#include <libpx.hpp>
+
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef PXEDIT_DESKTOP
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace px {
+
+namespace {
+
+/// A type definition for the clock used to coalesce requests.
+using Clock = std::chrono::steady_clock;
+
+/// How long no requests have to come in for
+/// before the requested stash is written.
+constexpr Clock::duration quietPeriod() noexcept { return std::chrono::milliseconds(500); }
+
+/// The longest a stash is put off while requests keep coming in.
+constexpr Clock::duration maxDelay() noexcept { return std::chrono::seconds(3); }
+
+/// Writes the stash of a document. The document is written to
+/// a temporary file first, which then replaces the stash.
+///
+/// @param doc The document to stash.
+/// @param path The path of the stash.
+///
+/// @return A description of the error that occurred.
+/// On success, this is an empty string.
+std::string writeStash(const Document* doc, const std::string& path)
+{
+  auto tmpPath = path + ".tmp";
+
+  std::error_code errorCode;
+
+  try {
+
+    if (!saveDoc(doc, tmpPath.c_str())) {
+      std::string error = std::strerror(errno);
+      std::filesystem::remove(tmpPath, errorCode);
+      return "Failed to write '" + tmpPath + "' (" + error + ")";
+    }
+
+    std::filesystem::rename(tmpPath, path, errorCode);
+
+    if (errorCode) {
+      std::string error = errorCode.message();
+      std::filesystem::remove(tmpPath, errorCode);
+      return "Failed to replace '" + path + "' (" + error + ")";
+    }
+
+  } catch (const std::exception& e) {
+    std::filesystem::remove(tmpPath, errorCode);
+    return "Failed to stash '" + path + "' (" + e.what() + ")";
+  }
+
+  return std::string();
+}
+
+/// A stash to be written.
+struct Job final
+{
+  /// The ID of the document being stashed.
+  int id = -1;
+  /// The path to write the stash at.
+  std::string path;
+  /// The snapshot of the document to stash.
+  SnapshotPtr doc;
+};
+
+/// The result of writing a stash.
+struct Result final
+{
+  /// The ID of the document that was stashed.
+  int id = -1;
+  /// The error that occurred, which is
+  /// empty if the stash was written.
+  std::string error;
+};
+
+} // namespace
+
+class StashWorkerImpl final
+{
+  friend StashWorker;
+
+  /// Whether or not a stash has been requested
+  /// since the last stash was started.
+  bool requested = false;
+  /// The ID of the document that was requested.
+  int requestedID = -1;
+  /// When the first of the coalesced requests came in.
+  Clock::time_point firstRequest;
+  /// When the last of the coalesced requests came in.
+  Clock::time_point lastRequest;
+  /// The ID of the document last marked as having unsaved
+  /// changes, so that the index isn't rewritten on every stash.
+  int unsavedID = -1;
+  /// The results that haven't been handled yet.
+  std::vector<Result> results;
+
+#ifdef PXEDIT_DESKTOP
+  /// Takes the snapshots that are stashed. This
+  /// is only accessed from the UI thread.
+  SnapshotSource* source = nullptr;
+  /// Guards the pending job, the results
+  /// and the state of the stash thread.
+  std::mutex mutex;
+  /// Signals the stash thread that a job is pending or that it has to
+  /// stop, and signals the UI thread that the stash thread is idle.
+  std::condition_variable condition;
+  /// The job waiting to be written. A newer
+  /// job replaces it if it hasn't been started on.
+  Job pending;
+  /// Whether or not the stash thread is writing a job.
+  bool busy = false;
+  /// Whether or not the stash thread has to stop.
+  bool stopping = false;
+  /// The thread that writes the stashes.
+  std::thread thread;
+
+  /// Writes the pending jobs until the stash thread is asked to
+  /// stop. The pending job is still written before it stops.
+  void run();
+  /// Waits for the stash thread to finish the
+  /// pending job and the job it's writing.
+  void wait(std::unique_lock<std::mutex>& lock);
+#endif // PXEDIT_DESKTOP
+
+#ifdef PXEDIT_DESKTOP
+  StashWorkerImpl(SnapshotSource* s) : source(s) {}
+#else
+  StashWorkerImpl(SnapshotSource*) {}
+#endif
+
+  /// Indicates whether or not enough time has passed
+  /// since the requests to write the stash.
+  bool due() const noexcept;
+  /// Writes the requested stash, or hands it to the stash thread.
+  ///
+  /// @param doc The current state of the requested document.
+  void start(const Document* doc);
+  /// Marks stashed documents as having unsaved changes
+  /// and reports the stashes that failed.
+  ///
+  /// @param observer Is passed the errors. This may be null.
+  void handleResults(AppStorage::Observer* observer);
+};
+
+bool StashWorkerImpl::due() const noexcept
+{
+  auto now = Clock::now();
+
+  return ((now - lastRequest) >= quietPeriod())
+      || ((now - firstRequest) >= maxDelay());
+}
+
+void StashWorkerImpl::handleResults(AppStorage::Observer* observer)
+{
+  std::vector<Result> finished;
+
+#ifdef PXEDIT_DESKTOP
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished.swap(results);
+  }
+#else
+  finished.swap(results);
+#endif
+
+  for (const auto& result : finished) {
+
+    if (!result.error.empty()) {
+      if (observer) {
+        observer->observeSyncResult(result.error.c_str());
+      }
+      continue;
+    }
+
+    if (result.id != unsavedID) {
+
+      if (!AppStorage::setUnsaved(result.id, true)) {
+        if (observer) {
+          observer->observeSyncResult("Failed to mark document as unsaved");
+        }
+        continue;
+      }
+
+      unsavedID = result.id;
+    }
+
+    if (observer) {
+      AppStorage::syncToDevice(observer);
+    }
+  }
+}
+
+void StashWorker::request(int id)
+{
+  auto now = Clock::now();
+
+  if (!impl->requested) {
+    impl->firstRequest = now;
+  }
+
+  impl->requested = true;
+  impl->requestedID = id;
+  impl->lastRequest = now;
+}
+
+void StashWorker::poll(const Document* doc, AppStorage::Observer* observer)
+{
+  if (impl->requested && impl->due()) {
+    impl->start(doc);
+  }
+
+  impl->handleResults(observer);
+}
+
+#ifdef PXEDIT_DESKTOP
+
+void StashWorkerImpl::run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (;;) {
+
+    condition.wait(lock, [this]() { return stopping || pending.doc; });
+
+    if (!pending.doc) {
+      break;
+    }
+
+    auto job = std::move(pending);
+
+    pending = Job();
+
+    busy = true;
+
+    lock.unlock();
+
+    auto error = writeStash(job.doc.get(), job.path);
+
+    // The snapshot may be the last reference, in which
+    // case it's released on this thread, outside of the lock.
+    job.doc.reset();
+
+    lock.lock();
+
+    busy = false;
+
+    results.emplace_back(Result { job.id, std::move(error) });
+
+    condition.notify_all();
+  }
+}
+
+void StashWorkerImpl::wait(std::unique_lock<std::mutex>& lock)
+{
+  condition.wait(lock, [this]() { return !pending.doc && !busy; });
+}
+
+void StashWorkerImpl::start(const Document* doc)
+{
+  requested = false;
+
+  Job job;
+  job.id = requestedID;
+  job.path = AppStorage::getDocumentStashPath(requestedID).string();
+
+  if (job.path.empty()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    results.emplace_back(Result { job.id, "Failed to find the document to stash" });
+    return;
+  }
+
+  job.doc = source->take(doc);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = std::move(job);
+  }
+
+  condition.notify_all();
+}
+
+StashWorker::StashWorker(SnapshotSource* source) : impl(new StashWorkerImpl(source))
+{
+  impl->thread = std::thread([this]() { impl->run(); });
+}
+
+StashWorker::~StashWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->stopping = true;
+  }
+
+  impl->condition.notify_all();
+
+  impl->thread.join();
+
+  delete impl;
+}
+
+void StashWorker::flush(const Document* doc, AppStorage::Observer* observer)
+{
+  if (impl->requested) {
+    impl->start(doc);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(impl->mutex);
+    impl->wait(lock);
+  }
+
+  impl->handleResults(observer);
+}
+
+void StashWorker::cancel() noexcept
+{
+  impl->requested = false;
+
+  {
+    std::unique_lock<std::mutex> lock(impl->mutex);
+    impl->pending = Job();
+    impl->wait(lock);
+    impl->results.clear();
+  }
+
+  impl->unsavedID = -1;
+}
+
+#else // PXEDIT_DESKTOP
+
+void StashWorkerImpl::start(const Document* doc)
+{
+  // There are no threads in the browser, so the
+  // document is written as it is, without a snapshot.
+
+  requested = false;
+
+  auto path = AppStorage::getDocumentStashPath(requestedID).string();
+
+  if (path.empty()) {
+    results.emplace_back(Result { requestedID, "Failed to find the document to stash" });
+    return;
+  }
+
+  results.emplace_back(Result { requestedID, writeStash(doc, path) });
+}
+
+StashWorker::StashWorker(SnapshotSource* source) : impl(new StashWorkerImpl(source)) {}
+
+StashWorker::~StashWorker()
+{
+  delete impl;
+}
+
+void StashWorker::flush(const Document* doc, AppStorage::Observer* observer)
+{
+  if (impl->requested) {
+    impl->start(doc);
+  }
+
+  impl->handleResults(observer);
+}
+
+void StashWorker::cancel() noexcept
+{
+  impl->requested = false;
+  impl->results.clear();
+  impl->unsavedID = -1;
+}
+
+#endif // PXEDIT_DESKTOP
+
+} // namespace px
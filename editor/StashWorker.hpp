@@ -0,0 +1,77 @@
+#ifndef LIBPX_EDITOR_STASH_WORKER_HPP
+#define LIBPX_EDITOR_STASH_WORKER_HPP
+
+#include "AppStorage.hpp"
+
+namespace px {
+
+struct Document;
+
+class SnapshotSource;
+class StashWorkerImpl;
+
+/// Stashes unsaved changes to a document on a background
+/// thread, so that the user interface doesn't have to wait
+/// for the document to be encoded and written.
+///
+/// Stash requests that come in quick succession are coalesced
+/// into one stash, which is taken once no more requests have come
+/// in for a short while. The stash is written to a temporary file
+/// first, which then replaces the previous stash, so that a stash
+/// is never left half written. Only once it has replaced the previous
+/// stash is the document marked as having unsaved changes.
+///
+/// In the browser, where there are no threads,
+/// the stash is written as it is polled.
+class StashWorker final
+{
+  /// A pointer to the implementation data.
+  StashWorkerImpl* impl = nullptr;
+public:
+  /// Starts the stash thread.
+  ///
+  /// @param source Takes the snapshots of the document
+  /// that are stashed. It has to outlive the worker.
+  StashWorker(SnapshotSource* source);
+  /// Stops the stash thread, after writing the
+  /// stash that it may be in the middle of.
+  ~StashWorker();
+  /// Workers are not copied, since they own a thread.
+  StashWorker(const StashWorker&) = delete;
+  /// Workers are not copied, since they own a thread.
+  StashWorker& operator = (const StashWorker&) = delete;
+  /// Requests that the changes to a document be stashed.
+  /// The document is stashed by a later call to @ref poll
+  /// or @ref flush.
+  ///
+  /// @param id The ID of the document to stash.
+  /// If this differs from the document of an earlier request,
+  /// then that request should be flushed first.
+  void request(int id);
+  /// Starts stashing the document if it was requested and no more
+  /// requests have come in for a while. This also marks documents
+  /// whose stashes have been written as having unsaved changes.
+  /// It's meant to be called once per frame.
+  ///
+  /// @param doc The current state of the requested document.
+  /// @param observer Is passed the error of a stash that failed.
+  /// If this is null, then failures are not reported.
+  void poll(const Document* doc, AppStorage::Observer* observer);
+  /// Stashes the document if it was requested, without waiting
+  /// for more requests, and waits for the stash to be written.
+  /// This is done before another document is opened.
+  ///
+  /// @param doc The current state of the requested document.
+  /// @param observer Is passed the error of a stash that failed.
+  /// If this is null, then failures are not reported.
+  void flush(const Document* doc, AppStorage::Observer* observer);
+  /// Drops the requested stash and waits for the stash being written,
+  /// if any, without marking its document as having unsaved changes.
+  /// This is done before the document is saved or its changes discarded,
+  /// so that a stash written afterwards doesn't bring the changes back.
+  void cancel() noexcept;
+};
+
+} // namespace px
+
+#endif // LIBPX_EDITOR_STASH_WORKER_HPP
@@ -1,14 +1,38 @@
 #include "libpx.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <cerrno>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LIBPX_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LIBPX_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace px {
 
 namespace {
@@ -330,6 +354,219 @@ inline constexpr RGBA blend(BlendMode mode, const float* bg, const Color& fg) no
 
 } // namespace
 
+//=======================//
+// Section: Span Kernels //
+//=======================//
+
+namespace {
+
+/// A function that operates on a span of RGBA pixels with a constant color.
+///
+/// @param dst The first pixel of the span.
+/// @param count The number of pixels in the span.
+/// @param c The color to apply to the span.
+using SpanKernel = void (*)(float* dst, std::size_t count, const Color& c);
+
+/// Contains one kernel per operation.
+/// Each kernel has the same result as calling
+/// the scalar function once per pixel.
+struct SpanKernels final
+{
+  /// Equivalent to @ref normalBlend.
+  SpanKernel normal;
+  /// Equivalent to @ref subtractionBlend.
+  SpanKernel subtract;
+  /// Assigns the premultiplied color to each pixel.
+  SpanKernel fill;
+};
+
+void normalSpanScalar(float* dst, std::size_t count, const Color& c)
+{
+  for (std::size_t i = 0; i < count; i++, dst += 4) {
+
+    auto result = normalBlend(RGBA { dst[0], dst[1], dst[2], dst[3] }, c);
+
+    dst[0] = result[0];
+    dst[1] = result[1];
+    dst[2] = result[2];
+    dst[3] = result[3];
+  }
+}
+
+void subtractSpanScalar(float* dst, std::size_t count, const Color& c)
+{
+  for (std::size_t i = 0; i < count; i++, dst += 4) {
+
+    auto result = subtractionBlend(RGBA { dst[0], dst[1], dst[2], dst[3] }, c);
+
+    dst[0] = result[0];
+    dst[1] = result[1];
+    dst[2] = result[2];
+    dst[3] = result[3];
+  }
+}
+
+void fillSpanScalar(float* dst, std::size_t count, const Color& c)
+{
+  for (std::size_t i = 0; i < count; i++, dst += 4) {
+    dst[0] = c.premultiplied[0];
+    dst[1] = c.premultiplied[1];
+    dst[2] = c.premultiplied[2];
+    dst[3] = c.premultiplied[3];
+  }
+}
+
+#ifdef LIBPX_X86_KERNELS
+
+// The vector kernels do the same operations, in the same order,
+// as the scalar functions. Since there's no fused multiply-add,
+// the results are exactly the same as the scalar results.
+
+__attribute__((target("sse2")))
+void normalSpanSSE2(float* dst, std::size_t count, const Color& c)
+{
+  auto fg = _mm_loadu_ps(c.premultiplied.data);
+  auto k = _mm_set1_ps(1.0f - c.premultiplied[3]);
+
+  for (std::size_t i = 0; i < count; i++, dst += 4) {
+    _mm_storeu_ps(dst, _mm_add_ps(fg, _mm_mul_ps(_mm_loadu_ps(dst), k)));
+  }
+}
+
+__attribute__((target("sse2")))
+void subtractSpanSSE2(float* dst, std::size_t count, const Color& c)
+{
+  auto fg = _mm_loadu_ps(c.original.data);
+  auto lo = _mm_setzero_ps();
+  auto hi = _mm_set1_ps(1.0f);
+
+  for (std::size_t i = 0; i < count; i++, dst += 4) {
+    auto diff = _mm_sub_ps(_mm_loadu_ps(dst), fg);
+    _mm_storeu_ps(dst, _mm_min_ps(_mm_max_ps(lo, diff), hi));
+  }
+}
+
+__attribute__((target("sse2")))
+void fillSpanSSE2(float* dst, std::size_t count, const Color& c)
+{
+  auto fg = _mm_loadu_ps(c.premultiplied.data);
+
+  for (std::size_t i = 0; i < count; i++, dst += 4) {
+    _mm_storeu_ps(dst, fg);
+  }
+}
+
+/// Broadcasts an RGBA color to both pixels of an AVX register.
+__attribute__((target("avx2")))
+inline __m256 broadcastAVX2(const RGBA& c) noexcept
+{
+  return _mm256_broadcast_ps(reinterpret_cast<const __m128*>(c.data));
+}
+
+__attribute__((target("avx2")))
+void normalSpanAVX2(float* dst, std::size_t count, const Color& c)
+{
+  auto fg = broadcastAVX2(c.premultiplied);
+  auto k = _mm256_set1_ps(1.0f - c.premultiplied[3]);
+
+  std::size_t i = 0;
+
+  for (; (i + 2) <= count; i += 2, dst += 8) {
+    _mm256_storeu_ps(dst, _mm256_add_ps(fg, _mm256_mul_ps(_mm256_loadu_ps(dst), k)));
+  }
+
+  if (i < count) {
+    normalSpanSSE2(dst, count - i, c);
+  }
+}
+
+__attribute__((target("avx2")))
+void subtractSpanAVX2(float* dst, std::size_t count, const Color& c)
+{
+  auto fg = broadcastAVX2(c.original);
+  auto lo = _mm256_setzero_ps();
+  auto hi = _mm256_set1_ps(1.0f);
+
+  std::size_t i = 0;
+
+  for (; (i + 2) <= count; i += 2, dst += 8) {
+    auto diff = _mm256_sub_ps(_mm256_loadu_ps(dst), fg);
+    _mm256_storeu_ps(dst, _mm256_min_ps(_mm256_max_ps(lo, diff), hi));
+  }
+
+  if (i < count) {
+    subtractSpanSSE2(dst, count - i, c);
+  }
+}
+
+__attribute__((target("avx2")))
+void fillSpanAVX2(float* dst, std::size_t count, const Color& c)
+{
+  auto fg = broadcastAVX2(c.premultiplied);
+
+  std::size_t i = 0;
+
+  for (; (i + 2) <= count; i += 2, dst += 8) {
+    _mm256_storeu_ps(dst, fg);
+  }
+
+  if (i < count) {
+    fillSpanSSE2(dst, count - i, c);
+  }
+}
+
+#endif // LIBPX_X86_KERNELS
+
+/// Selects the span kernels that best
+/// fit the processor the library is running on.
+SpanKernels selectSpanKernels() noexcept
+{
+#ifdef LIBPX_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return SpanKernels { normalSpanAVX2, subtractSpanAVX2, fillSpanAVX2 };
+  }
+
+  if (__builtin_cpu_supports("sse2")) {
+    return SpanKernels { normalSpanSSE2, subtractSpanSSE2, fillSpanSSE2 };
+  }
+#endif
+
+  return SpanKernels { normalSpanScalar, subtractSpanScalar, fillSpanScalar };
+}
+
+/// Gets the span kernels for this processor.
+/// They are selected on the first call.
+const SpanKernels& getSpanKernels() noexcept
+{
+  static const SpanKernels kernels = selectSpanKernels();
+
+  return kernels;
+}
+
+/// Blends a color across a span of pixels.
+///
+/// @param mode The blend mode to use.
+/// @param dst The first pixel of the span.
+/// @param count The number of pixels in the span.
+/// @param c The color to blend.
+inline void blendSpan(BlendMode mode, float* dst, std::size_t count, const Color& c) noexcept
+{
+  const auto& kernels = getSpanKernels();
+
+  switch (mode) {
+    case BlendMode::Normal:
+      kernels.normal(dst, count, c);
+      break;
+    case BlendMode::Subtract:
+      kernels.subtract(dst, count, c);
+      break;
+  }
+}
+
+} // namespace
+
 //===================//
 // Section: Geometry //
 //===================//
@@ -352,21 +589,285 @@ public:
   virtual void access(const Quad& quad) noexcept = 0;
 };
 
+class NodeStore;
+
+struct Node;
+
+/// Gives the documents that share a layer, without owning it,
+/// a copy of it so that the layer can be modified. This is done
+/// before any modification of a layer or of the nodes within it.
+///
+/// @param layer The layer about to be modified. This may be null.
+void detachReaders(Layer* layer) noexcept;
+
+/// Prepares a layer to be modified. The documents sharing the layer
+/// are given their own copy and the layer gets a new revision.
+///
+/// @param layer The layer about to be modified. This may be null.
+/// @param node The node within the layer that is about to be
+/// modified. This is null if the layer itself is being modified.
+void modifyLayer(Layer* layer, const Node* node = nullptr) noexcept;
+
+/// Gives a document a new revision, after it has been modified.
+///
+/// @param doc The document that was modified. This may be null.
+void modifyDoc(Document* doc) noexcept;
+
+/// Gets a new revision number.
+/// Revision numbers are unique across all documents.
+inline std::uint64_t nextRevision() noexcept
+{
+  static std::atomic<std::uint64_t> counter { 0 };
+
+  return ++counter;
+}
+
+/// Identifies the type of a node. Code that paints many
+/// nodes switches on this instead of visiting each node,
+/// so that painting a node doesn't take any virtual calls.
+enum class NodeKind
+{
+  Ellipse,
+  Fill,
+  Line,
+  Quad
+};
+
 /// This is the base of any
 /// class that appears in the scene graph.
 struct Node
 {
+  /// The type of the derived node.
+  NodeKind kind;
+  /// The index of the node within its store, in painting order.
+  std::uint32_t position = 0;
+  /// Assigned a new value whenever the node is created or
+  /// modified. Copies of a node keep the same revision,
+  /// so two nodes with the same revision look the same.
+  std::uint64_t revision = nextRevision();
+  /// The layer that the node is stored in.
+  Layer* layer = nullptr;
+  /// Constructs the base of a node.
+  ///
+  /// @param k The type of the derived node.
+  explicit Node(NodeKind k) noexcept : kind(k) {}
   /// Just a stub.
   virtual ~Node() {}
   /// Allows a node accessor class access
   /// to the derived node type.
   virtual void accept(NodeAccessor& accessor) const noexcept = 0;
-  /// Copies the derived node.
-  virtual Node* copy() const = 0;
+  /// Copies the derived node to the end of a node store.
+  ///
+  /// @param store The store to put the copy into.
+  ///
+  /// @return A pointer to the copy.
+  virtual Node* copy(NodeStore& store) const = 0;
+  /// Indicates whether or not painting the node
+  /// depends on the pixels painted before it.
+  /// Nodes that do cannot be split across tiles.
+  bool readsColorBuffer() const noexcept { return kind == NodeKind::Fill; }
+};
+
+/// The points of all the lines in a layer.
+/// Lines are usually drawn one at a time, so the points
+/// of each line end up next to each other, in painting order.
+struct PointBuffer final
+{
+  /// The points of the lines, including any
+  /// that were left behind when a line was moved.
+  std::vector<Vec2> points;
 };
 
-/// A type definition for a node smart pointer.
-using NodePtr = std::unique_ptr<Node>;
+/// Stores the nodes of a layer.
+/// Nodes are placed one after another in large blocks of memory,
+/// so that painting them walks through memory instead of jumping
+/// between separate allocations. The nodes never move, so pointers
+/// to them stay valid for as long as the store exists.
+class NodeStore final
+{
+public:
+  /// The type of memory that a block is made of,
+  /// so that any node is aligned within a block.
+  using Cell = std::max_align_t;
+  /// The blocks that the nodes are placed in.
+  std::vector<std::unique_ptr<Cell[]>> blocks;
+  /// The number of cells used in the last block.
+  std::size_t used = 0;
+  /// The number of cells in the last block.
+  std::size_t blockSize = 0;
+  /// The number of cells used across all blocks.
+  std::size_t cellCount = 0;
+  /// The number of cells allocated across all blocks.
+  std::size_t reservedCells = 0;
+  /// The nodes, in the order that they are painted.
+  std::vector<Node*> index;
+  /// The points of the lines in the store.
+  PointBuffer pointBuffer;
+  /// The layer that the store belongs to.
+  Layer* layer = nullptr;
+  /// Makes an empty store.
+  ///
+  /// @param l The layer that the store belongs to.
+  explicit NodeStore(Layer* l) noexcept : layer(l) {}
+  /// Copies the nodes of another store.
+  /// The copy is placed into a single block, with the points
+  /// of its lines in painting order, no matter how scattered
+  /// the nodes and points of the other store were.
+  ///
+  /// @param other The store to copy the nodes of.
+  /// @param l The layer that the copy belongs to.
+  NodeStore(const NodeStore& other, Layer* l) : NodeStore(l)
+  {
+    reserve(other.cellCount, other.index.size());
+
+    pointBuffer.points.reserve(other.pointBuffer.points.size());
+
+    for (const auto* node : other.index) {
+      node->copy(*this);
+    }
+  }
+  /// Destroys the nodes in the store.
+  ~NodeStore()
+  {
+    while (!index.empty()) {
+      removeLast();
+    }
+  }
+  /// Stores cannot be assigned, since nodes are referred to by address.
+  NodeStore& operator = (const NodeStore&) = delete;
+  /// Makes a new node at the end of the store.
+  ///
+  /// @tparam NodeType The type of the node to make.
+  ///
+  /// @param args The arguments to pass to the constructor of the node.
+  ///
+  /// @return A pointer to the new node.
+  template <typename NodeType, typename... Args>
+  NodeType* add(Args&&... args)
+  {
+    static_assert(alignof(NodeType) <= alignof(Cell), "Node is over-aligned");
+
+    auto* memory = allocate((sizeof(NodeType) + sizeof(Cell) - 1) / sizeof(Cell));
+
+    if (index.size() == index.capacity()) {
+      index.reserve(index.empty() ? 16 : (index.size() * 2));
+    }
+
+    auto* node = new (memory) NodeType(std::forward<Args>(args)...);
+
+    node->layer = layer;
+
+    node->position = std::uint32_t(index.size());
+
+    index.push_back(node);
+
+    return node;
+  }
+  /// Makes sure that a number of nodes of one type
+  /// can be added without allocating more memory.
+  ///
+  /// @tparam NodeType The type of the nodes to make room for.
+  ///
+  /// @param count The number of nodes to make room for.
+  template <typename NodeType>
+  void reserveNodes(std::size_t count)
+  {
+    auto cells = ((sizeof(NodeType) + sizeof(Cell) - 1) / sizeof(Cell)) * count;
+
+    if ((blockSize - used) < cells) {
+      auto nextSize = blocks.empty() ? minBlockSize() : min(blockSize * 2, maxBlockSize());
+      reserve(max(nextSize, cells), 0);
+    }
+
+    if ((index.capacity() - index.size()) < count) {
+      index.reserve(max(index.size() * 2, index.size() + count));
+    }
+  }
+  /// Removes the last node in the store.
+  /// Its memory is not used again until the store is destroyed.
+  void removeLast() noexcept
+  {
+    index.back()->~Node();
+    index.pop_back();
+  }
+  /// Accesses the first node in painting order.
+  std::vector<Node*>::const_iterator begin() const noexcept
+  {
+    return index.begin();
+  }
+  /// Accesses the end of the nodes.
+  std::vector<Node*>::const_iterator end() const noexcept
+  {
+    return index.end();
+  }
+  /// Indicates the number of nodes in the store.
+  std::size_t size() const noexcept
+  {
+    return index.size();
+  }
+  /// Measures the memory allocated by the store.
+  ///
+  /// @return The number of bytes allocated for the
+  /// nodes, the index and the points of the lines.
+  std::size_t memoryUsage() const noexcept
+  {
+    return (reservedCells * sizeof(Cell))
+         + (blocks.capacity() * sizeof(blocks[0]))
+         + (index.capacity() * sizeof(index[0]))
+         + (pointBuffer.points.capacity() * sizeof(Vec2));
+  }
+protected:
+  /// The number of cells in the first block of a store.
+  static constexpr std::size_t minBlockSize() noexcept { return 4096 / sizeof(Cell); }
+  /// The number of cells that blocks stop growing at.
+  static constexpr std::size_t maxBlockSize() noexcept { return (1 << 20) / sizeof(Cell); }
+  /// Makes sure that nodes and index entries can be added
+  /// without allocating more memory.
+  ///
+  /// @param cells The number of cells to make room for.
+  /// @param nodeCount The number of nodes to make room for.
+  void reserve(std::size_t cells, std::size_t nodeCount)
+  {
+    if ((blockSize - used) < cells) {
+      blocks.emplace_back(new Cell[cells]);
+      blockSize = cells;
+      reservedCells += cells;
+      used = 0;
+    }
+
+    index.reserve(nodeCount);
+  }
+  /// Allocates memory for a node.
+  ///
+  /// @param cells The number of cells to allocate.
+  ///
+  /// @return A pointer to the memory.
+  void* allocate(std::size_t cells)
+  {
+    if ((blockSize - used) < cells) {
+
+      auto nextSize = blocks.empty() ? minBlockSize() : min(blockSize * 2, maxBlockSize());
+
+      nextSize = max(nextSize, cells);
+
+      blocks.emplace_back(new Cell[nextSize]);
+
+      blockSize = nextSize;
+
+      reservedCells += nextSize;
+
+      used = 0;
+    }
+
+    auto* memory = blocks.back().get() + used;
+
+    used += cells;
+
+    cellCount += cells;
+
+    return memory;
+  }
+};
 
 /// This is the base of any class that has
 /// a stroke. It contains the basic properties
@@ -380,6 +881,10 @@ struct StrokeNode : public Node
   BlendMode blendMode = BlendMode::Normal;
   /// The color that the stroke is drawn with.
   RGBA color = black();
+  /// Constructs the base of a stroke node.
+  ///
+  /// @param k The type of the derived node.
+  explicit StrokeNode(NodeKind k) noexcept : Node(k) {}
 };
 
 /// Evaluates a number to a safe pixel size.
@@ -389,6 +894,35 @@ inline constexpr int safePixelSize(int in) noexcept
   return (in <= 0) ? 1 : in;
 }
 
+/// Marks a node as modified.
+///
+/// @param node The node that is being modified.
+inline void touch(Node* node) noexcept
+{
+  modifyLayer(node->layer, node);
+
+  node->revision = nextRevision();
+}
+
+/// Writes the area that a stroke may paint on.
+///
+/// @param lo The minimum point along the stroke.
+/// @param hi The maximum point along the stroke.
+/// @param pixelSize The pixel size of the stroke. Since squares
+/// are drawn up and to the left of each point, this extends @p lo.
+/// @param bounds Receives the inclusive upper left corner
+/// followed by the exclusive lower right corner.
+inline void writeStrokeBounds(const Vec2& lo, const Vec2& hi, std::size_t pixelSize, int* bounds) noexcept
+{
+  auto a = lo - (int(pixelSize) - 1);
+  auto b = hi + 1;
+
+  bounds[0] = a[0];
+  bounds[1] = a[1];
+  bounds[2] = b[0];
+  bounds[3] = b[1];
+}
+
 } // namespace
 
 struct Ellipse final : public StrokeNode
@@ -396,44 +930,58 @@ struct Ellipse final : public StrokeNode
   Vec2 center = Vec2 { 0, 0 };
   Vec2 radius = Vec2 { 0, 0 };
 
+  Ellipse() noexcept : StrokeNode(NodeKind::Ellipse) {}
+
   void accept(NodeAccessor& accessor) const noexcept override
   {
     accessor.access(*this);
   }
 
-  Node* copy() const override
+  Node* copy(NodeStore& store) const override
   {
-    return new Ellipse(*this);
+    return store.add<Ellipse>(*this);
   }
 };
 
 void setBlendMode(Ellipse* ellipse, BlendMode blendMode) noexcept
 {
+  touch(ellipse);
+
   ellipse->blendMode = blendMode;
 }
 
 void setCenter(Ellipse* ellipse, int x, int y) noexcept
 {
+  touch(ellipse);
+
   ellipse->center = Vec2 { x, y };
 }
 
 void setRadius(Ellipse* ellipse, int x, int y) noexcept
 {
+  touch(ellipse);
+
   ellipse->radius = Vec2 { x, y };
 }
 
 void setColor(Ellipse* ellipse, float r, float g, float b, float a) noexcept
 {
+  touch(ellipse);
+
   ellipse->color = clip(RGBA { r, g, b, a });
 }
 
 void setPixelSize(Ellipse* ellipse, int pixelSize) noexcept
 {
+  touch(ellipse);
+
   ellipse->pixelSize = safePixelSize(pixelSize);
 }
 
 void resizeRect(Ellipse* ellipse, int x1, int y1, int x2, int y2) noexcept
 {
+  touch(ellipse);
+
   auto p1 = Vec2 { x1, y1 };
   auto p2 = Vec2 { x2, y2 };
 
@@ -444,6 +992,74 @@ void resizeRect(Ellipse* ellipse, int x1, int y1, int x2, int y2) noexcept
   ellipse->radius = (pMax - pMin) / 2;
 }
 
+bool getBounds(const Ellipse* ellipse, int* bounds) noexcept
+{
+  // Padded by one pixel, in case the rasterizer
+  // steps slightly passed the radius.
+  auto r = absolute(ellipse->radius) + 1;
+
+  writeStrokeBounds(ellipse->center - r, ellipse->center + r, ellipse->pixelSize, bounds);
+
+  return true;
+}
+
+/// A horizontal span of pixels covered by a fill.
+struct FillSpan final
+{
+  /// The row of the span.
+  int y;
+  /// The first pixel of the span.
+  int x1;
+  /// One passed the last pixel of the span.
+  int x2;
+};
+
+/// The pixels covered by a fill the last time that it was painted.
+/// The region is reused as long as the pixels around it are the same.
+struct FillRegion final
+{
+  /// The width of the color buffer the region was found in.
+  std::size_t width = 0;
+  /// The first row of the color buffer the region was found in.
+  std::size_t firstRow = 0;
+  /// The height of the image the region was found in.
+  std::size_t height = 0;
+  /// The origin that the region was found from.
+  Vec2 origin { 0, 0 };
+  /// The ID of the document that the region was found in, or
+  /// zero if it isn't known. Fills are shared between copies of
+  /// a document, so the latest region may be from another copy.
+  std::uint64_t docID = 0;
+  /// The upper left corner of the pixels that decide the region.
+  /// This is the bounding box of the region, grown by one pixel
+  /// to include the pixels that stopped the fill from spreading.
+  Vec2 keyMin { 0, 0 };
+  /// The lower right corner (exclusive) of the pixels that decide the region.
+  Vec2 keyMax { 0, 0 };
+  /// A hash of the pixels that decide the region,
+  /// taken before the fill was painted.
+  std::uint64_t key = 0;
+  /// The spans of the region, from the top row to the bottom row.
+  std::vector<FillSpan> spans;
+};
+
+/// Counts how often the region of a fill is reused.
+struct FillCacheStats final
+{
+  /// The number of fills painted from a cached region.
+  std::atomic<std::size_t> hits { 0 };
+  /// The number of fills whose region had to be searched for.
+  std::atomic<std::size_t> misses { 0 };
+};
+
+/// Accesses the fill cache counters, which are shared by all documents.
+inline FillCacheStats& fillCacheStats() noexcept
+{
+  static FillCacheStats stats;
+
+  return stats;
+}
+
 /// Represents a flood fill operation.
 struct Fill final : public Node
 {
@@ -454,57 +1070,315 @@ struct Fill final : public Node
   /// The position on the image to start the fill operation at.
   /// All pixels connected to this point are filled.
   Vec2 origin = Vec2 { 0, 0 };
+  /// The region found the last time the fill was painted.
+  /// This is only accessed with the atomic shared pointer
+  /// functions, since documents may be rendered concurrently.
+  mutable std::shared_ptr<const FillRegion> region;
+
+  Fill() noexcept : Node(NodeKind::Fill) {}
 
   void accept(NodeAccessor& accessor) const noexcept override
   {
     accessor.access(*this);
   }
 
-  Node* copy() const override
+  Node* copy(NodeStore& store) const override
   {
-    return new Fill(*this);
+    return store.add<Fill>(*this);
   }
 };
 
 void setBlendMode(Fill* fill, BlendMode blendMode) noexcept
 {
+  touch(fill);
+
   fill->blendMode = blendMode;
 }
 
 void setFillOrigin(Fill* fill, int x, int y) noexcept
 {
+  touch(fill);
+
   fill->origin = Vec2 { x, y };
 }
 
 void setColor(Fill* fill, float r, float g, float b, float a) noexcept
 {
+  touch(fill);
+
   fill->color = clip(RGBA { r, g, b, a });
 }
 
-/// Represents a series of straight line segments.
-struct Line final : public StrokeNode
+bool getBounds(const Fill*, int* bounds) noexcept
 {
-  /// The points making up the line.
-  std::vector<Vec2> points;
+  // The area reached by a fill depends on what was painted
+  // before it, so it has to be assumed that it reaches everything.
+  bounds[0] = std::numeric_limits<int>::min();
+  bounds[1] = std::numeric_limits<int>::min();
+  bounds[2] = std::numeric_limits<int>::max();
+  bounds[3] = std::numeric_limits<int>::max();
 
-  void accept(NodeAccessor& accessor) const noexcept override
-  {
-    accessor.access(*this);
-  }
+  return true;
+}
 
-  Node* copy() const override
-  {
-    return new Line(*this);
-  }
-};
+namespace {
 
-void addPoint(Line* line, int x, int y)
+/// Indicates whether or not a fill region covers a pixel.
+///
+/// @param region The region to check.
+/// @param p The pixel to check for.
+///
+/// @return True if the pixel is covered, false otherwise.
+bool regionCovers(const FillRegion& region, const Vec2& p) noexcept
 {
-  line->points.emplace_back(Vec2 { x, y });
-}
+  const auto& spans = region.spans;
+
+  // The spans are ordered by row, then by column.
+  auto after = std::upper_bound(spans.begin(), spans.end(), p, [](const Vec2& q, const FillSpan& span) {
+    return (q[1] < span.y) || ((q[1] == span.y) && (q[0] < span.x1));
+  });
+
+  if (after == spans.begin()) {
+    return false;
+  }
+
+  const auto& span = *(after - 1);
+
+  return (span.y == p[1]) && (p[0] < span.x2);
+}
+
+} // namespace
+
+void getFillCacheStats(std::size_t* hits, std::size_t* misses) noexcept
+{
+  auto& stats = fillCacheStats();
+
+  if (hits) {
+    *hits = stats.hits;
+  }
+
+  if (misses) {
+    *misses = stats.misses;
+  }
+}
+
+void resetFillCacheStats() noexcept
+{
+  auto& stats = fillCacheStats();
+
+  stats.hits = 0;
+  stats.misses = 0;
+}
+
+namespace {
+
+/// The points of a single line, kept in the point buffer of its layer.
+/// The points are always next to each other in the buffer. Space is
+/// reserved at the end of the range when the points have to be moved,
+/// so that a line can grow without being moved on every new point.
+class LinePoints final
+{
+public:
+  /// The buffer that the points are in.
+  PointBuffer* buffer;
+  /// The index of the first point in the buffer.
+  std::size_t offset;
+  /// The number of points in the line.
+  std::size_t count = 0;
+  /// The number of points that fit into the range without moving it.
+  std::size_t capacity = 0;
+  /// Makes an empty range at the end of a point buffer.
+  explicit LinePoints(PointBuffer& b) noexcept : buffer(&b), offset(b.points.size()) {}
+  /// Ranges are not copied, since they would share points.
+  LinePoints(const LinePoints&) = delete;
+  /// Gives the space of the range back to the buffer,
+  /// if it's at the end of the buffer.
+  ~LinePoints()
+  {
+    if (isLast()) {
+      buffer->points.resize(offset);
+    }
+  }
+  /// Indicates the number of points in the line.
+  std::size_t size() const noexcept { return count; }
+  /// Indicates whether or not the line has any points.
+  bool empty() const noexcept { return !count; }
+  /// Accesses the first point of the line.
+  Vec2* begin() noexcept { return buffer->points.data() + offset; }
+  /// Accesses the first point of the line.
+  const Vec2* begin() const noexcept { return buffer->points.data() + offset; }
+  /// Accesses the end of the points.
+  Vec2* end() noexcept { return begin() + count; }
+  /// Accesses the end of the points.
+  const Vec2* end() const noexcept { return begin() + count; }
+  /// Accesses a point without checking the index.
+  Vec2& operator [] (std::size_t index) noexcept { return begin()[index]; }
+  /// Accesses a point without checking the index.
+  const Vec2& operator [] (std::size_t index) const noexcept { return begin()[index]; }
+  /// Accesses a point, throwing std::out_of_range
+  /// if the index is passed the last point.
+  const Vec2& at(std::size_t index) const
+  {
+    if (index >= count) {
+      throw std::out_of_range("Point index is out of range.");
+    }
+
+    return begin()[index];
+  }
+  /// Adds a point to the end of the line.
+  ///
+  /// @param point The point to add. This is taken by value
+  /// since adding a point may move the contents of the buffer.
+  void emplace_back(Vec2 point)
+  {
+    if (count == capacity) {
+      reserve(isLast() ? (count + 1) : max(count * 2, std::size_t(4)));
+    }
+
+    begin()[count++] = point;
+  }
+  /// Adds a series of points to the end of the line.
+  ///
+  /// @param xy The coordinates of the points, as X and Y pairs.
+  /// @param n The number of points to add.
+  void append(const int* xy, std::size_t n)
+  {
+    if ((count + n) > capacity) {
+      reserve(isLast() ? (count + n) : max(count * 2, count + n));
+    }
+
+    auto* dst = end();
+
+    for (std::size_t i = 0; i < n; i++) {
+      dst[i] = Vec2 { xy[i * 2 + 0], xy[i * 2 + 1] };
+    }
+
+    count += n;
+  }
+  /// Removes the points after a certain number of points.
+  ///
+  /// @param size The number of points to keep.
+  void truncate(std::size_t size) noexcept
+  {
+    count = min(count, size);
+  }
+  /// Changes the number of points in the line.
+  /// Any new points are set to zero.
+  void resize(std::size_t size)
+  {
+    reserve(size);
+
+    for (auto i = count; i < size; i++) {
+      begin()[i] = Vec2 { 0, 0 };
+    }
+
+    count = size;
+  }
+  /// Replaces the points of the line.
+  ///
+  /// @param first The first point to copy.
+  /// This must not be in the same buffer as the line.
+  /// @param last The end of the points to copy.
+  void assign(const Vec2* first, const Vec2* last)
+  {
+    auto size = std::size_t(last - first);
+
+    count = 0;
+
+    reserve(size);
+
+    for (auto* dst = begin(); first != last; first++, dst++) {
+      *dst = *first;
+    }
+
+    count = size;
+  }
+protected:
+  /// Indicates whether or not the range is at the end of the buffer,
+  /// in which case it can grow without being moved.
+  bool isLast() const noexcept
+  {
+    return (offset + capacity) == buffer->points.size();
+  }
+  /// Makes room for a number of points.
+  /// If the range can't grow where it is, the points are moved
+  /// to the end of the buffer and their old space is left unused.
+  void reserve(std::size_t size)
+  {
+    if (size <= capacity) {
+      return;
+    }
+
+    auto& points = buffer->points;
+
+    if (isLast()) {
+      points.resize(offset + size);
+    } else {
+
+      auto newOffset = points.size();
+
+      points.resize(newOffset + size);
+
+      for (std::size_t i = 0; i < count; i++) {
+        points[newOffset + i] = points[offset + i];
+      }
+
+      offset = newOffset;
+    }
+
+    capacity = size;
+  }
+};
+
+} // namespace
+
+/// Represents a series of straight line segments.
+struct Line final : public StrokeNode
+{
+  /// The points making up the line.
+  LinePoints points;
+  /// Makes an empty line.
+  ///
+  /// @param buffer The buffer to keep the points in.
+  explicit Line(PointBuffer& buffer) noexcept : StrokeNode(NodeKind::Line), points(buffer) {}
+  /// Copies a line.
+  ///
+  /// @param other The line to copy.
+  /// @param buffer The buffer to put the copied points into.
+  Line(const Line& other, PointBuffer& buffer) : StrokeNode(other), points(buffer)
+  {
+    points.assign(other.points.begin(), other.points.end());
+  }
+
+  void accept(NodeAccessor& accessor) const noexcept override
+  {
+    accessor.access(*this);
+  }
+
+  Node* copy(NodeStore& store) const override
+  {
+    return store.add<Line>(*this, store.pointBuffer);
+  }
+};
+
+void addPoint(Line* line, int x, int y)
+{
+  touch(line);
+
+  line->points.emplace_back(Vec2 { x, y });
+}
+
+void addPoints(Line* line, const int* points, std::size_t count)
+{
+  touch(line);
+
+  line->points.append(points, count);
+}
+
+void setBlendMode(Line* line, BlendMode blendMode) noexcept
+{
+  touch(line);
 
-void setBlendMode(Line* line, BlendMode blendMode) noexcept
-{
   line->blendMode = blendMode;
 }
 
@@ -513,70 +1387,100 @@ namespace {
 /// Removes duplicate neighboring points from a line.
 ///
 /// @param line The line to remove the duplicate neighboring points of.
-void removeDuplicatePoints(Line* line) noexcept
+/// @param first The first point to compare with the point before it.
+void removeDuplicatePoints(Line* line, std::size_t first) noexcept
 {
-  std::size_t i = 1;
+  auto& points = line->points;
 
-  while (i < line->points.size()) {
-    auto a = line->points[i - 1];
-    auto b = line->points[i - 0];
-    if (a == b) {
-      line->points.erase(line->points.begin() + (i - 1));
-    } else {
-      i++;
+  auto kept = max(first, std::size_t(1));
+
+  if (kept >= points.size()) {
+    return;
+  }
+
+  for (auto i = kept; i < points.size(); i++) {
+    if (!(points[i] == points[kept - 1])) {
+      points[kept++] = points[i];
     }
   }
+
+  points.truncate(kept);
 }
 
-/// Removes points that have duplicate neighboring slopes.
-void removeDuplicateSlopes(Line* line) noexcept
+/// Indicates whether or not the middle of three points
+/// is on the same slope as the points around it.
+bool isSameSlope(const Vec2& a, const Vec2& b, const Vec2& c) noexcept
 {
-  std::size_t i = 1;
+  auto diffA = b - a;
+  auto diffB = c - b;
 
-  while (i < (line->points.size() - 1)) {
+  // Two vertical slopes must be handled specifically
+  // because they would otherwise cause a divide by zero exception.
+  if (!diffA[0] && !diffB[0]) {
+    return true;
+  }
 
-    auto a = line->points[i - 1];
-    auto b = line->points[i - 0];
-    auto c = line->points[i + 1];
+  // Same as before, we want to avoid divide by zero errors
+  // by checking either X-delta. Since we know they're not equal,
+  // if one of them is zero then the two slopes are different.
+  if (!diffA[0] || !diffB[0]) {
+    return false;
+  }
 
-    auto diffA = b - a;
-    auto diffB = c - b;
+  auto slopeA = diffA[1] / diffA[0];
+  auto slopeB = diffB[1] / diffB[0];
 
-    // Two vertical slopes must be handled specifically
-    // because they would otherwise cause a divide by zero exception.
-    if (!diffA[0] && !diffB[0]) {
-      line->points.erase(line->points.begin() + i);
-      continue;
-    }
+  auto remA = diffA[1] % diffA[0];
+  auto remB = diffB[1] % diffB[0];
 
-    // Same as before, we want to avoid divide by zero errors
-    // by checking either X-delta. Since we know they're not equal,
-    // if one of them is zero then the two slopes are different.
-    if (!diffA[0] || !diffB[0]) {
-      i++;
-      continue;
-    }
+  return (slopeA == slopeB) && (remA == remB);
+}
 
-    auto slopeA = diffA[1] / diffA[0];
-    auto slopeB = diffB[1] / diffB[0];
+/// Removes points that have duplicate neighboring slopes.
+/// The first and last points of the line are always kept.
+///
+/// @param line The line to remove the points from.
+/// @param first The first point that may be removed.
+void removeDuplicateSlopes(Line* line, std::size_t first) noexcept
+{
+  auto& points = line->points;
 
-    auto remA = diffA[1] % diffA[0];
-    auto remB = diffB[1] % diffB[0];
+  auto kept = max(first, std::size_t(1));
 
-    if ((slopeA == slopeB) && (remA == remB)) {
-      line->points.erase(line->points.begin() + i);
-    } else {
-      i++;
+  if ((kept + 1) >= points.size()) {
+    return;
+  }
+
+  auto last = points.size() - 1;
+
+  for (auto i = kept; i < last; i++) {
+    if (!isSameSlope(points[kept - 1], points[i], points[i + 1])) {
+      points[kept++] = points[i];
     }
   }
+
+  points[kept++] = points[last];
+
+  points.truncate(kept);
 }
 
 } // namespace
 
 void dissolvePoints(Line* line) noexcept
 {
-  removeDuplicatePoints(line);
-  removeDuplicateSlopes(line);
+  dissolvePoints(line, 0);
+}
+
+void dissolvePoints(Line* line, std::size_t first) noexcept
+{
+  touch(line);
+
+  // A point removed from the tail can only change the
+  // slopes of the two points before the tail.
+  auto start = (first > 2) ? (first - 2) : 0;
+
+  removeDuplicatePoints(line, start);
+  removeDuplicateSlopes(line, start);
 }
 
 std::size_t getPointCount(const Line* line) noexcept
@@ -603,6 +1507,8 @@ int getPointY(const Line* line, std::size_t index)
 
 bool setPoint(Line* line, std::size_t index, int x, int y) noexcept
 {
+  touch(line);
+
   if (index >= line->points.size()) {
     return false;
   } else {
@@ -613,14 +1519,40 @@ bool setPoint(Line* line, std::size_t index, int x, int y) noexcept
 
 void setPixelSize(Line* line, int pixelSize) noexcept
 {
+  touch(line);
+
   line->pixelSize = safePixelSize(pixelSize);
 }
 
 void setColor(Line* line, float r, float g, float b, float a) noexcept
 {
+  touch(line);
+
   line->color = clip(RGBA { r, g, b, a });
 }
 
+bool getBounds(const Line* line, int* bounds, std::size_t firstPoint) noexcept
+{
+  // The segment leading up to the first point is included.
+  auto first = firstPoint ? (firstPoint - 1) : 0;
+
+  if ((first + 1) >= line->points.size()) {
+    return false;
+  }
+
+  auto lo = line->points[first];
+  auto hi = line->points[first];
+
+  for (auto i = first + 1; i < line->points.size(); i++) {
+    lo = min(lo, line->points[i]);
+    hi = max(hi, line->points[i]);
+  }
+
+  writeStrokeBounds(lo, hi, line->pixelSize, bounds);
+
+  return true;
+}
+
 /// Represents a quadrilateral shape.
 /// A quadrilateral shape differs from
 /// a rectangle in that the lines do not
@@ -630,18 +1562,22 @@ struct Quad final : public StrokeNode
   /// The points making up the quadrilateral.
   Vec2 points[4] { Vec2 { 0, 0 }, Vec2 { 1, 0 }, Vec2 { 1, 1 }, Vec2 { 0, 1 } };
 
+  Quad() noexcept : StrokeNode(NodeKind::Quad) {}
+
   void accept(NodeAccessor& accessor) const noexcept override
   {
     accessor.access(*this);
   }
-  Node* copy() const override
+  Node* copy(NodeStore& store) const override
   {
-    return new Quad(*this);
+    return store.add<Quad>(*this);
   }
 };
 
 bool setPoint(Quad* quad, std::size_t index, int x, int y) noexcept
 {
+  touch(quad);
+
   if (index >= 4) {
     return false;
   } else {
@@ -652,107 +1588,634 @@ bool setPoint(Quad* quad, std::size_t index, int x, int y) noexcept
 
 void setBlendMode(Quad* quad, BlendMode blendMode) noexcept
 {
+  touch(quad);
+
   quad->blendMode = blendMode;
 }
 
 void setColor(Quad* quad, float r, float g, float b, float a) noexcept
 {
+  touch(quad);
+
   quad->color = clip(RGBA { r, g, b, a });
 }
 
 void setPixelSize(Quad* quad, int pixelSize) noexcept
 {
+  touch(quad);
+
   quad->pixelSize = safePixelSize(pixelSize);
 }
 
+bool getBounds(const Quad* quad, int* bounds) noexcept
+{
+  auto lo = min(min(quad->points[0], quad->points[1]), min(quad->points[2], quad->points[3]));
+  auto hi = max(max(quad->points[0], quad->points[1]), max(quad->points[2], quad->points[3]));
+
+  writeStrokeBounds(lo, hi, quad->pixelSize, bounds);
+
+  return true;
+}
+
 //=================//
 // Section: Layers //
 //=================//
 
-/// A layer here is what it is in most image
-/// editing applications, a collection of 2D data
-/// that is meant for a certain Z index and opacity,
-/// to be drawn in a certain order relative to the other layers.
-struct Layer final
+namespace {
+
+/// Gets the area that a node may paint on.
+///
+/// @param node The node to get the bounds of.
+/// @param bounds Receives the inclusive upper left corner
+/// followed by the exclusive lower right corner.
+///
+/// @return True on success, false if the node paints nothing.
+bool getNodeBounds(const Node& node, int* bounds) noexcept
 {
-  /// The alpha channel value of this layer.
-  float opacity = 1;
-  /// The name given to this layer.
-  std::string name;
-  /// Whether or not the layer is visible.
-  bool visible = true;
-  /// The nodes for this layer
-  std::vector<NodePtr> nodes;
-  /// Just a stub.
-  Layer() {}
-  /// Copies a layer.
-  Layer(const Layer& other)
+  switch (node.kind) {
+    case NodeKind::Ellipse:
+      return getBounds(static_cast<const Ellipse*>(&node), bounds);
+    case NodeKind::Fill:
+      return getBounds(static_cast<const Fill*>(&node), bounds);
+    case NodeKind::Line:
+      return getBounds(static_cast<const Line*>(&node), bounds, 0);
+    case NodeKind::Quad:
+      return getBounds(static_cast<const Quad*>(&node), bounds);
+  }
+
+  return false;
+}
+
+/// Finds the nodes of a layer by their bounds.
+///
+/// The nodes are placed in a uniform grid of cells, by the cells
+/// that their bounds overlap. Nodes that overlap too many cells, like
+/// fills, are kept in a separate list that every query looks through.
+/// The index is brought up to date when it's queried. If the layer
+/// has changed, only the nodes with a new revision are moved.
+class SpatialIndex final
+{
+  /// A node in the index.
+  struct Entry final
   {
-    opacity = other.opacity;
-    name = other.name;
-    visible = other.visible;
+    /// The node that the entry is for.
+    const Node* node = nullptr;
+    /// The revision of the node when its bounds were found.
+    std::uint64_t revision = 0;
+    /// The bounds of the node. See @ref getNodeBounds.
+    int bounds[4] { 0, 0, 0, 0 };
+    /// Whether or not the node paints anything.
+    bool hasBounds = false;
+    /// Whether or not the node is in the list of large nodes.
+    bool large = false;
+  };
+  /// The nodes of the layer, in painting order.
+  std::vector<Entry> entries;
+  /// The entries in each cell of the grid, by the key of the cell.
+  std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> cells;
+  /// The entries that overlap too many cells to be put into them.
+  std::vector<std::uint32_t> largeEntries;
+  /// The revision of the layer that the index is up to date with.
+  std::uint64_t revision = 0;
+  /// The positions of the nodes modified since the index
+  /// was updated, so that only they have to be checked.
+  std::vector<std::uint32_t> modified;
+  /// Whether or not too many nodes were modified to keep track
+  /// of, in which case every node is checked on the next update.
+  bool modifiedOverflow = false;
+  /// Guards the index, since it's updated by const queries
+  /// which may be made from several threads.
+  std::mutex mutex;
+public:
+  /// The width and height of a cell in the grid, in pixels.
+  static constexpr int cellSize() noexcept { return 64; }
+  /// The largest number of cells that a node is put into.
+  static constexpr std::int64_t maxCellsPerNode() noexcept { return 64; }
+  /// The largest number of modified nodes that are kept track of.
+  static constexpr std::size_t maxModified() noexcept { return 1024; }
+  /// Notes that a node is about to be modified.
+  /// This is called by the mutators, which may not
+  /// be called while the layer is being queried.
+  ///
+  /// @param node The node being modified.
+  void markModified(const Node& node) noexcept
+  {
+    if (modifiedOverflow || (node.position >= entries.size())) {
+      return;
+    }
+
+    // A node is usually modified several times in a row.
+    if (!modified.empty() && (modified.back() == node.position)) {
+      return;
+    }
+
+    if (modified.size() >= maxModified()) {
+      modifiedOverflow = true;
+      modified.clear();
+      return;
+    }
 
-    for (const auto& otherNode : other.nodes) {
-      nodes.emplace_back(otherNode->copy());
+    try {
+      modified.emplace_back(node.position);
+    } catch (...) {
+      modifiedOverflow = true;
+      modified.clear();
     }
   }
-  /// Adds a node to the layer.
-  ///
-  /// @tparam NodeType The type of the node to add.
+  /// Finds the nodes whose bounds intersect a rectangle.
   ///
-  /// @param node The node to add to the layer.
-  ///
-  /// @return A pointer to to @p node.
-  template <typename NodeType>
-  NodeType* addNode(NodeType* node)
+  /// @param nodes The nodes of the layer.
+  /// @param layerRevision The revision of the layer.
+  /// @param lo The upper left corner of the rectangle (inclusive.)
+  /// @param hi The lower right corner of the rectangle (exclusive.)
+  /// @param found Receives the indices of the nodes, in painting order.
+  void find(const NodeStore& nodes, std::uint64_t layerRevision, const Vec2& lo, const Vec2& hi, std::vector<std::size_t>& found)
   {
-    // In case an exception gets thrown.
-    std::unique_ptr<NodeType> nodePtr(node);
+    std::lock_guard<std::mutex> lock(mutex);
 
-    nodes.emplace_back(node);
+    update(nodes, layerRevision);
 
-    return nodePtr.release();
-  }
-};
+    found.clear();
 
-/// A type definition for a layer smart pointer.
-using LayerPtr = std::unique_ptr<Layer>;
+    if ((lo[0] >= hi[0]) || (lo[1] >= hi[1])) {
+      return;
+    }
 
-const char* getLayerName(const Layer* layer) noexcept
-{
-  return layer->name.c_str();
-}
+    auto check = [this, &lo, &hi, &found](std::size_t i) {
+      if (intersects(entries[i], lo, hi)) {
+        found.emplace_back(i);
+      }
+    };
 
-float getLayerOpacity(const Layer* layer) noexcept
-{
-  return layer->opacity;
-}
+    auto cellMin = toCell(lo);
+    auto cellMax = toCell(hi - 1);
 
-bool getLayerVisibility(const Layer* layer) noexcept
-{
-  return layer->visible;
-}
+    auto cellCount = std::int64_t(cellMax[0] - cellMin[0] + 1) * std::int64_t(cellMax[1] - cellMin[1] + 1);
 
-void setLayerName(Layer* layer, const char* name)
-{
-  layer->name = name ? name : "";
-}
+    // Looking through every node is faster than
+    // looking through more cells than there are nodes.
+    if (std::size_t(cellCount) >= entries.size()) {
+      for (std::size_t i = 0; i < entries.size(); i++) {
+        check(i);
+      }
+      return;
+    }
 
-void setLayerOpacity(Layer* layer, float opacity) noexcept
-{
-  layer->opacity = clip(opacity);
-}
+    for (auto i : largeEntries) {
+      check(i);
+    }
 
-void setLayerVisibility(Layer* layer, bool visibility) noexcept
-{
-  layer->visible = visibility;
-}
+    for (int y = cellMin[1]; y <= cellMax[1]; y++) {
+      for (int x = cellMin[0]; x <= cellMax[0]; x++) {
 
-//================//
-// Section: Image //
-//================//
+        auto cell = cells.find(cellKey(x, y));
+        if (cell == cells.end()) {
+          continue;
+        }
 
-/// Contains basic image data.
+        for (auto i : cell->second) {
+          check(i);
+        }
+      }
+    }
+
+    // A node is found once for each cell it's in.
+    std::sort(found.begin(), found.end());
+
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+  }
+  /// Finds the last node painted whose bounds contain a point.
+  /// A fill is only found at the pixels it covered the last time
+  /// that it was painted, since its bounds are the whole image.
+  ///
+  /// @param nodes The nodes of the layer.
+  /// @param layerRevision The revision of the layer.
+  /// @param p The point to find the node at.
+  /// @param index Receives the index of the node.
+  ///
+  /// @return True if a node was found, false otherwise.
+  bool findTop(const NodeStore& nodes, std::uint64_t layerRevision, const Vec2& p, std::size_t* index)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    update(nodes, layerRevision);
+
+    auto found = false;
+
+    auto check = [this, &p, &found, index](std::size_t i) {
+      if ((!found || (i > *index)) && contains(entries[i], p)) {
+        *index = i;
+        found = true;
+      }
+    };
+
+    for (auto i : largeEntries) {
+      check(i);
+    }
+
+    auto cellPos = toCell(p);
+
+    auto cell = cells.find(cellKey(cellPos[0], cellPos[1]));
+
+    if (cell != cells.end()) {
+      for (auto i : cell->second) {
+        check(i);
+      }
+    }
+
+    return found;
+  }
+protected:
+  /// Brings the index up to date with the nodes of the layer.
+  /// If memory can't be allocated, the index is emptied and
+  /// built again on the next query.
+  ///
+  /// @param nodes The nodes of the layer.
+  /// @param layerRevision The revision of the layer.
+  void update(const NodeStore& nodes, std::uint64_t layerRevision)
+  {
+    if ((revision == layerRevision) && (entries.size() == nodes.size())) {
+      return;
+    }
+
+    try {
+      sync(nodes);
+    } catch (...) {
+      clear();
+      throw;
+    }
+
+    revision = layerRevision;
+  }
+  /// Moves the nodes that have changed and adds the new ones.
+  ///
+  /// @param nodes The nodes of the layer.
+  void sync(const NodeStore& nodes)
+  {
+    // Nodes are only added and removed at the end of a layer, and
+    // the memory of a removed node isn't reused. If any node in the
+    // index was removed, then so was the last one, and the index has
+    // to be rebuilt.
+    if ((entries.size() > nodes.size())
+     || (!entries.empty() && (entries.back().node != nodes.index[entries.size() - 1]))) {
+      clear();
+    }
+
+    auto move = [this, &nodes](std::size_t i) {
+      if (entries[i].revision != nodes.index[i]->revision) {
+        remove(std::uint32_t(i));
+        insert(std::uint32_t(i), *nodes.index[i]);
+      }
+    };
+
+    if (modifiedOverflow) {
+      for (std::size_t i = 0; i < entries.size(); i++) {
+        move(i);
+      }
+    } else {
+      for (auto i : modified) {
+        if (i < entries.size()) {
+          move(i);
+        }
+      }
+    }
+
+    modified.clear();
+
+    modifiedOverflow = false;
+
+    entries.reserve(nodes.size());
+
+    for (auto i = entries.size(); i < nodes.size(); i++) {
+      entries.emplace_back();
+      insert(std::uint32_t(i), *nodes.index[i]);
+    }
+  }
+  /// Empties the index.
+  void clear() noexcept
+  {
+    entries.clear();
+    cells.clear();
+    largeEntries.clear();
+    modified.clear();
+    modifiedOverflow = false;
+    revision = 0;
+  }
+  /// Finds the bounds of a node and puts it into the grid.
+  ///
+  /// @param i The index of the node.
+  /// @param node The node to insert.
+  void insert(std::uint32_t i, const Node& node)
+  {
+    auto& entry = entries[i];
+
+    entry.node = &node;
+    entry.revision = node.revision;
+    entry.hasBounds = getNodeBounds(node, entry.bounds);
+    entry.large = false;
+
+    if (!entry.hasBounds) {
+      return;
+    }
+
+    Vec2 cellMin;
+    Vec2 cellMax;
+
+    if (!getCells(entry, cellMin, cellMax)) {
+      entry.large = true;
+      largeEntries.emplace_back(i);
+      return;
+    }
+
+    for (int y = cellMin[1]; y <= cellMax[1]; y++) {
+      for (int x = cellMin[0]; x <= cellMax[0]; x++) {
+        cells[cellKey(x, y)].emplace_back(i);
+      }
+    }
+  }
+  /// Takes a node out of the grid.
+  ///
+  /// @param i The index of the node.
+  void remove(std::uint32_t i) noexcept
+  {
+    auto& entry = entries[i];
+
+    if (!entry.hasBounds) {
+      return;
+    }
+
+    auto removeFrom = [i](std::vector<std::uint32_t>& list) {
+      auto it = std::find(list.begin(), list.end(), i);
+      if (it != list.end()) {
+        *it = list.back();
+        list.pop_back();
+      }
+    };
+
+    if (entry.large) {
+      removeFrom(largeEntries);
+      return;
+    }
+
+    Vec2 cellMin;
+    Vec2 cellMax;
+
+    getCells(entry, cellMin, cellMax);
+
+    for (int y = cellMin[1]; y <= cellMax[1]; y++) {
+      for (int x = cellMin[0]; x <= cellMax[0]; x++) {
+        auto cell = cells.find(cellKey(x, y));
+        if (cell != cells.end()) {
+          removeFrom(cell->second);
+        }
+      }
+    }
+  }
+  /// Finds the cells that an entry overlaps.
+  ///
+  /// @param entry The entry to find the cells of.
+  /// @param cellMin Receives the first cell (inclusive.)
+  /// @param cellMax Receives the last cell (inclusive.)
+  ///
+  /// @return True if the entry fits into the grid,
+  /// false if it overlaps too many cells.
+  static bool getCells(const Entry& entry, Vec2& cellMin, Vec2& cellMax) noexcept
+  {
+    cellMin = toCell(Vec2 { entry.bounds[0], entry.bounds[1] });
+    cellMax = toCell(Vec2 { entry.bounds[2] - 1, entry.bounds[3] - 1 });
+
+    auto w = std::int64_t(cellMax[0]) - cellMin[0] + 1;
+    auto h = std::int64_t(cellMax[1]) - cellMin[1] + 1;
+
+    return (w * h) <= maxCellsPerNode();
+  }
+  /// Indicates whether or not the bounds of an entry intersect a rectangle.
+  static bool intersects(const Entry& entry, const Vec2& lo, const Vec2& hi) noexcept
+  {
+    return entry.hasBounds
+        && (entry.bounds[0] < hi[0]) && (entry.bounds[2] > lo[0])
+        && (entry.bounds[1] < hi[1]) && (entry.bounds[3] > lo[1]);
+  }
+  /// Indicates whether or not a node is found at a pixel. Fills
+  /// aren't, since what they cover depends on the nodes painted before
+  /// them, which may be in other layers. The document finds those.
+  static bool contains(const Entry& entry, const Vec2& p) noexcept
+  {
+    if (entry.node->kind == NodeKind::Fill) {
+      return false;
+    }
+
+    return intersects(entry, p, p + 1);
+  }
+  /// Finds the cell that contains a pixel.
+  static Vec2 toCell(const Vec2& p) noexcept
+  {
+    auto floorDiv = [](int n) {
+      return (n >= 0) ? (n / cellSize()) : -((-(n + 1) / cellSize()) + 1);
+    };
+
+    return Vec2 { floorDiv(p[0]), floorDiv(p[1]) };
+  }
+  /// Computes the key of a cell in the grid.
+  static std::uint64_t cellKey(int x, int y) noexcept
+  {
+    return (std::uint64_t(std::uint32_t(x)) << 32) | std::uint32_t(y);
+  }
+};
+
+} // namespace
+
+/// A layer here is what it is in most image
+/// editing applications, a collection of 2D data
+/// that is meant for a certain Z index and opacity,
+/// to be drawn in a certain order relative to the other layers.
+struct Layer final
+{
+  /// The alpha channel value of this layer.
+  float opacity = 1;
+  /// The name given to this layer.
+  std::string name;
+  /// Whether or not the layer is visible.
+  bool visible = true;
+  /// The nodes for this layer, in painting order.
+  NodeStore nodes { this };
+  /// Layers are shared between copies of a document. This is the
+  /// document that has access to modify the layer, which may have
+  /// pointers to the layer or its nodes. It is null if no document
+  /// has asked to modify the layer yet.
+  Document* owner = nullptr;
+  /// The other documents that share the layer. They each get a
+  /// copy of the layer before the layer is modified. This is a set,
+  /// since a layer may be shared by many copies of a document.
+  std::unordered_set<Document*> readers;
+  /// Whether or not the layer belongs to snapshots, which may be read
+  /// from other threads. A frozen layer is never modified and no
+  /// document keeps track of it, so it's copied instead of adopted.
+  bool frozen = false;
+  /// Assigned a new value whenever the layer
+  /// or one of its nodes is modified.
+  std::uint64_t revision = nextRevision();
+  /// Finds the nodes of the layer by their bounds.
+  /// This is built when the layer is first queried.
+  mutable SpatialIndex spatialIndex;
+  /// Just a stub.
+  Layer() {}
+  /// Copies a layer.
+  /// The copy is not shared with any document.
+  Layer(const Layer& other) : nodes(other.nodes, this)
+  {
+    opacity = other.opacity;
+    name = other.name;
+    visible = other.visible;
+    revision = other.revision;
+  }
+};
+
+namespace {
+
+void modifyLayer(Layer* layer, const Node* node) noexcept
+{
+  if (!layer) {
+    return;
+  }
+
+  detachReaders(layer);
+
+  layer->revision = nextRevision();
+
+  if (node) {
+    layer->spatialIndex.markModified(*node);
+  }
+
+  modifyDoc(layer->owner);
+}
+
+} // namespace
+
+/// A type definition for a layer smart pointer.
+/// Layers are reference counted, since copies
+/// of a document share the layers they have in common.
+using LayerPtr = std::shared_ptr<Layer>;
+
+const char* getLayerName(const Layer* layer) noexcept
+{
+  return layer->name.c_str();
+}
+
+float getLayerOpacity(const Layer* layer) noexcept
+{
+  return layer->opacity;
+}
+
+bool getLayerVisibility(const Layer* layer) noexcept
+{
+  return layer->visible;
+}
+
+void setLayerName(Layer* layer, const char* name)
+{
+  modifyLayer(layer);
+
+  layer->name = name ? name : "";
+}
+
+void setLayerOpacity(Layer* layer, float opacity) noexcept
+{
+  modifyLayer(layer);
+
+  layer->opacity = clip(opacity);
+}
+
+void setLayerVisibility(Layer* layer, bool visibility) noexcept
+{
+  modifyLayer(layer);
+
+  layer->visible = visibility;
+}
+
+std::size_t getNodeCount(const Layer* layer) noexcept
+{
+  return layer->nodes.size();
+}
+
+NodeType getNodeType(const Layer* layer, std::size_t index)
+{
+  switch (layer->nodes.index.at(index)->kind) {
+    case NodeKind::Ellipse:
+      return NodeType::Ellipse;
+    case NodeKind::Fill:
+      return NodeType::Fill;
+    case NodeKind::Line:
+      return NodeType::Line;
+    case NodeKind::Quad:
+      return NodeType::Quad;
+  }
+
+  return NodeType::Line;
+}
+
+namespace {
+
+/// Accesses a node of a layer by its type.
+///
+/// @param layer The layer that the node is in.
+/// @param index The index of the node.
+///
+/// @return A pointer to the node, or null if
+/// the node is not of the type requested.
+template <typename NodeType>
+NodeType* getNodeAs(Layer* layer, std::size_t index, NodeKind kind)
+{
+  auto* node = layer->nodes.index.at(index);
+
+  return (node->kind == kind) ? static_cast<NodeType*>(node) : nullptr;
+}
+
+} // namespace
+
+Ellipse* getEllipse(Layer* layer, std::size_t index)
+{
+  return getNodeAs<Ellipse>(layer, index, NodeKind::Ellipse);
+}
+
+Fill* getFill(Layer* layer, std::size_t index)
+{
+  return getNodeAs<Fill>(layer, index, NodeKind::Fill);
+}
+
+Line* getLine(Layer* layer, std::size_t index)
+{
+  return getNodeAs<Line>(layer, index, NodeKind::Line);
+}
+
+Quad* getQuad(Layer* layer, std::size_t index)
+{
+  return getNodeAs<Quad>(layer, index, NodeKind::Quad);
+}
+
+std::size_t findNodes(const Layer* layer, int x1, int y1, int x2, int y2, std::size_t* indices, std::size_t maxCount)
+{
+  std::vector<std::size_t> found;
+
+  layer->spatialIndex.find(layer->nodes, layer->revision, Vec2 { x1, y1 }, Vec2 { x2, y2 }, found);
+
+  for (std::size_t i = 0; (i < found.size()) && (i < maxCount); i++) {
+    indices[i] = found[i];
+  }
+
+  return found.size();
+}
+
+bool findTopNode(const Layer* layer, int x, int y, std::size_t* index)
+{
+  return layer->spatialIndex.findTop(layer->nodes, layer->revision, Vec2 { x, y }, index);
+}
+
+//================//
+// Section: Image //
+//================//
+
+/// Contains basic image data.
 struct Image final
 {
   /// The image colors, formatted
@@ -850,9 +2313,19 @@ struct ErrorList final
 {
   /// The path to the file that was opened.
   std::string filename;
+  /// Keeps the source code alive, if the error list
+  /// owns it. This may be a string or a mapped file.
+  std::shared_ptr<const void> sourceOwner;
   /// The source code that the errors pertain to.
   /// This is all the source code in the original file.
-  std::string source;
+  const char* source = "";
+  /// The number of characters in the source code.
+  std::size_t sourceSize = 0;
+  /// Whether or not the source code is followed by a null terminator.
+  bool sourceTerminated = true;
+  /// A null terminated copy of the source code. This is only
+  /// made if the source code isn't null terminated and it's requested.
+  mutable std::string sourceCopy;
   /// The list of errors that were found.
   std::vector<Error> errors;
 };
@@ -892,7 +2365,19 @@ const char* getErrorSource(const ErrorList* errList) noexcept
     return "";
   }
 
-  return errList->source.c_str();
+  if (errList->sourceTerminated) {
+    return errList->source;
+  }
+
+  if (errList->sourceCopy.size() != errList->sourceSize) {
+    try {
+      errList->sourceCopy.assign(errList->source, errList->sourceSize);
+    } catch (...) {
+      return "";
+    }
+  }
+
+  return errList->sourceCopy.c_str();
 }
 
 std::size_t getErrorSourceSize(const ErrorList* errList) noexcept
@@ -901,7 +2386,7 @@ std::size_t getErrorSourceSize(const ErrorList* errList) noexcept
     return 0;
   }
 
-  return errList->source.size();
+  return errList->sourceSize;
 }
 
 std::size_t getErrorCount(const ErrorList* errList) noexcept
@@ -993,36 +2478,181 @@ constexpr std::size_t colorRes() noexcept
   return 32768;
 }
 
-/// Prints an nth dimensional vector.
-///
-/// @tparam T The type used in the vector components.
-/// @tparam dims The number of dimensions in the vector.
+/// A growable buffer of bytes that documents are encoded into.
 ///
-/// @param v The vector to print.
-template <typename T, std::size_t dims>
-std::ostream& operator << (std::ostream& stream, const Vector<T, dims>& v)
+/// The memory is allocated with malloc() so that it can be given
+/// to the caller of @ref saveDoc without being copied. Like a stream,
+/// a failed allocation doesn't throw an exception. Instead, the buffer
+/// is marked as failed and further writes are ignored.
+class ByteBuffer final
 {
-  for (std::size_t i = 0; i < dims; i++) {
-
-    stream << v[i];
-
-    if ((i + 1) < dims) {
-      stream << ' ';
+  /// The bytes in the buffer.
+  char* data = nullptr;
+  /// The number of bytes in the buffer.
+  std::size_t size = 0;
+  /// The number of bytes allocated for the buffer.
+  std::size_t capacity = 0;
+  /// Whether or not an allocation has failed.
+  bool failedFlag = false;
+public:
+  ByteBuffer() noexcept {}
+  ByteBuffer(const ByteBuffer&) = delete;
+  /// Releases the memory of the buffer,
+  /// unless it was taken with @ref ByteBuffer::release
+  ~ByteBuffer()
+  {
+    std::free(data);
+  }
+  /// Indicates whether or not an allocation failed.
+  inline bool failed() const noexcept { return failedFlag; }
+  /// Marks the buffer as failed, so that further writes are
+  /// ignored. This is used when a part of the output that was
+  /// built in another buffer couldn't be allocated.
+  inline void fail() noexcept { failedFlag = true; }
+  /// Accesses the bytes in the buffer.
+  inline const char* getData() const noexcept { return data; }
+  /// Indicates the number of bytes in the buffer.
+  inline std::size_t getSize() const noexcept { return size; }
+  /// Takes the memory of the buffer. The memory
+  /// should be released with free() by the caller.
+  ///
+  /// @return The bytes in the buffer. This may be
+  /// a null pointer if nothing was written.
+  char* release() noexcept
+  {
+    auto* tmp = data;
+    data = nullptr;
+    size = 0;
+    capacity = 0;
+    return tmp;
+  }
+  /// Appends bytes to the buffer.
+  ///
+  /// @param bytes The bytes to append.
+  /// @param count The number of bytes to append.
+  void append(const char* bytes, std::size_t count) noexcept
+  {
+    if (count && reserve(count)) {
+      std::memcpy(data + size, bytes, count);
+      size += count;
     }
   }
-
-  return stream;
-}
-
-/// Prints an array of vectors.
-/// The appear as a single list of numbers this way.
-///
-/// @tparam T The type used in the vector components.
-/// @tparam dims The number of dimensions in the vector.
-///
-/// @param v The vector array to print.
+  /// Appends a single byte to the buffer.
+  ///
+  /// @param c The byte to append.
+  inline void push_back(char c) noexcept
+  {
+    if (reserve(1)) {
+      data[size++] = c;
+    }
+  }
+  /// Appends a string, without the null terminator.
+  ByteBuffer& operator << (const char* str) noexcept
+  {
+    append(str, std::strlen(str));
+    return *this;
+  }
+  /// Appends a single character.
+  ByteBuffer& operator << (char c) noexcept
+  {
+    push_back(c);
+    return *this;
+  }
+  /// Appends a signed integer, in decimal.
+  ByteBuffer& operator << (int value) noexcept
+  {
+    auto magnitude = (unsigned long long) value;
+
+    if (value < 0) {
+      push_back('-');
+      magnitude = 0 - magnitude;
+    }
+
+    appendDecimal(magnitude);
+
+    return *this;
+  }
+  /// Appends an unsigned integer, in decimal.
+  ByteBuffer& operator << (std::size_t value) noexcept
+  {
+    appendDecimal(value);
+    return *this;
+  }
+protected:
+  /// Appends the decimal digits of an unsigned integer.
+  ///
+  /// @param value The integer to append the digits of.
+  void appendDecimal(unsigned long long value) noexcept
+  {
+    char digits[24];
+
+    auto* end = digits + sizeof(digits);
+    auto* begin = end;
+
+    do {
+      *(--begin) = char('0' + (value % 10));
+      value /= 10;
+    } while (value);
+
+    append(begin, std::size_t(end - begin));
+  }
+  /// Makes room for more bytes in the buffer.
+  ///
+  /// @param count The number of bytes to make room for.
+  ///
+  /// @return True if there is room, false if the allocation failed.
+  bool reserve(std::size_t count) noexcept
+  {
+    if (failedFlag) {
+      return false;
+    }
+
+    if ((capacity - size) >= count) {
+      return true;
+    }
+
+    auto newCapacity = max(capacity * 2, max(size + count, std::size_t(256)));
+
+    auto* newData = static_cast<char*>(std::realloc(data, newCapacity));
+    if (!newData) {
+      failedFlag = true;
+      return false;
+    }
+
+    data = newData;
+
+    capacity = newCapacity;
+
+    return true;
+  }
+};
+
+/// Prints an nth dimensional vector.
+///
+/// @tparam T The type used in the vector components.
+/// @tparam dims The number of dimensions in the vector.
+///
+/// @param v The vector to print.
 template <typename T, std::size_t dims>
-std::ostream& operator << (std::ostream& stream, const std::vector<Vector<T, dims>>& v)
+ByteBuffer& operator << (ByteBuffer& stream, const Vector<T, dims>& v)
+{
+  for (std::size_t i = 0; i < dims; i++) {
+
+    stream << v[i];
+
+    if ((i + 1) < dims) {
+      stream << ' ';
+    }
+  }
+
+  return stream;
+}
+
+/// Prints the points of a line.
+/// The appear as a single list of numbers this way.
+///
+/// @param v The points to print.
+ByteBuffer& operator << (ByteBuffer& stream, const LinePoints& v)
 {
   for (std::size_t i = 0; i < v.size(); i++) {
 
@@ -1039,12 +2669,12 @@ std::ostream& operator << (std::ostream& stream, const std::vector<Vector<T, dim
 /// Used for encoding documents into files.
 class Encoder final : public NodeAccessor
 {
-  /// The stream being written to.
-  std::ostream& stream;
+  /// The buffer being written to.
+  ByteBuffer& stream;
   /// The indentation level for the output file.
   std::size_t indentation = 0;
 public:
-  Encoder(std::ostream& stream_) : stream(stream_) {}
+  Encoder(ByteBuffer& stream_) : stream(stream_) {}
   /// Encodes a single color channel.
   ///
   /// @param name The name to give the channel.
@@ -1059,7 +2689,7 @@ public:
   /// @param c The color to encode.
   void encodeColor(const char* name, const RGBA& c)
   {
-    indent() << name << ' ' << convertColor(c) << std::endl;
+    indent() << name << ' ' << convertColor(c) << '\n';
   }
   /// Encodes a size field.
   ///
@@ -1067,7 +2697,7 @@ public:
   /// @param value The value to print.
   void encodeSize(const char* name, std::size_t value)
   {
-    indent() << name << ' ' << value << std::endl;
+    indent() << name << ' ' << value << '\n';
   }
   /// Encodes a boolean value.
   ///
@@ -1075,7 +2705,7 @@ public:
   /// @parma value The value to encode.
   void encodeBool(const char* name, bool value)
   {
-    indent() << name << ' ' << (value ? "true" : "false") << std::endl;
+    indent() << name << ' ' << (value ? "true" : "false") << '\n';
   }
   /// Encodes a string onto the document.
   ///
@@ -1094,7 +2724,7 @@ public:
       stream << value[i];
     }
 
-    stream << "\"" << std::endl;
+    stream << "\"" << '\n';
   }
   /// Encodes a layer.
   void encodeLayer(const Layer& layer)
@@ -1130,7 +2760,7 @@ protected:
         break;
     }
 
-    stream << std::endl;
+    stream << '\n';
   }
   /// Converts a color into a 4 dimensional integer vector.
   ///
@@ -1145,7 +2775,7 @@ protected:
     };
   }
   /// Prints indentation.
-  std::ostream& indent() {
+  ByteBuffer& indent() {
     for (std::size_t i = 0; i < indentation; i++) {
       stream << "  ";
     }
@@ -1158,7 +2788,7 @@ protected:
   template <typename Functor>
   void encodeStruct(const char* name, Functor func)
   {
-    indent() << name << std::endl;
+    indent() << name << '\n';
 
     indentation++;
 
@@ -1166,32 +2796,32 @@ protected:
 
     indentation--;
 
-    indent() << "end" << std::endl;
+    indent() << "end" << '\n';
   }
   /// Encodes a stroke node.
   /// This is used by all derived of this class,
   /// so it must be called explicitly.
   void encodeStrokeNode(const StrokeNode& strokeNode)
   {
-    indent() << "pixel_size " << strokeNode.pixelSize << std::endl;
-    indent() << "color " << convertColor(strokeNode.color) << std::endl;
+    indent() << "pixel_size " << strokeNode.pixelSize << '\n';
+    indent() << "color " << convertColor(strokeNode.color) << '\n';
     encodeBlendMode("blend_mode", strokeNode.blendMode);
   }
   void access(const Ellipse& ellipse) noexcept override
   {
-    auto encoder = [this, ellipse] () {
+    auto encoder = [this, &ellipse] () {
       encodeStrokeNode(ellipse);
-      indent() << "center " << ellipse.center << std::endl;
-      indent() << "radius " << ellipse.radius << std::endl;
+      indent() << "center " << ellipse.center << '\n';
+      indent() << "radius " << ellipse.radius << '\n';
     };
 
     encodeStruct("ellipse", encoder);
   }
   void access(const Fill& fill) noexcept override
   {
-    auto encoder = [this, fill] () {
-      indent() << "origin " << fill.origin << std::endl;
-      indent() << "color " << convertColor(fill.color) << std::endl;
+    auto encoder = [this, &fill] () {
+      indent() << "origin " << fill.origin << '\n';
+      indent() << "color " << convertColor(fill.color) << '\n';
       encodeBlendMode("blend_mode", fill.blendMode);
     };
 
@@ -1199,23 +2829,23 @@ protected:
   }
   void access(const Line& line) noexcept override
   {
-    auto encoder = [this, line] () {
+    auto encoder = [this, &line] () {
       encodeStrokeNode(line);
-      indent() << "points " << line.points << " end" << std::endl;
+      indent() << "points " << line.points << " end" << '\n';
     };
 
     encodeStruct("line", encoder);
   }
   void access(const Quad& quad) noexcept override
   {
-    auto encoder = [this, quad] () {
+    auto encoder = [this, &quad] () {
       encodeStrokeNode(quad);
       indent();
       stream << "points ";
       stream << quad.points[0] << ' ';
       stream << quad.points[1] << ' ';
       stream << quad.points[2] << ' ';
-      stream << quad.points[3] << std::endl;
+      stream << quad.points[3] << '\n';
     };
 
     encodeStruct("quad", encoder);
@@ -1614,57 +3244,74 @@ struct Optional final
   constexpr Optional(const T& v) : value(v), valid(true) {}
 };
 
+/// Describes the source code of a document.
+struct Source final
+{
+  /// Keeps the source code alive, if it isn't owned by the caller.
+  std::shared_ptr<const void> owner;
+  /// The characters of the source code.
+  const char* data = "";
+  /// The number of characters in the source code.
+  std::size_t size = 0;
+  /// Whether or not the source code is followed by a null terminator.
+  bool terminated = true;
+};
+
+/// The number of tokens kept by the parser at a time.
+/// This has to cover the lookahead of the parser
+/// and the furthest that the parser backtracks.
+constexpr std::size_t tokenWindowSize() noexcept { return 8; }
+
 /// A recursive-decent parser for parsing
 /// document files. The parser fails immediately
 /// after finding the first error.
+///
+/// Tokens are scanned from the input as the parser reaches
+/// them, and only the last few are kept. The input is read
+/// in place, so it has to outlive the parser.
 class Parser final
 {
   /// Suppressed error messages go here.
   std::ostringstream suppressed;
-  /// The tokens found by the lexer.
-  std::vector<Token> tokens;
+  /// Scans the tokens from the input.
+  Lexer lexer;
+  /// The most recently scanned tokens, indexed
+  /// by their position modulo the window size.
+  Token window[tokenWindowSize()];
+  /// The number of tokens scanned so far,
+  /// not counting spaces and comments.
+  std::size_t scanned = 0;
   /// The position of the parser among the tokens.
   std::size_t pos = 0;
+  /// Whether or not the lexer has reached the
+  /// end of the input or an invalid token.
+  bool lexerDone = false;
   /// Whether or not the parser has failed.
   bool failedFlag = false;
+  /// Whether or not an invalid token was found.
+  bool invalidFlag = false;
   /// The list of errors found by the parser.
   ErrorList errorList;
 public:
   /// Constructs a new parser instance.
-  /// This function will parse the string and
-  /// filter out any tokens that the parser
-  /// will not need.
   ///
   /// @param str The string to parse.
   /// @param size The number of characters in @p str.
-  Parser(const char* str, std::size_t size)
-  {
-    Lexer lexer(str, size);
-
-    while (lexer.remaining() && !failed()) {
-      auto t = lexer.scan();
-      if (t == TokenType::Invalid) {
-        formatError(t) << "Invalid token " << t;
-        break;
-      } else if (t == TokenType::None) {
-        break;
-      } else if ((t == TokenType::Space) || (t == TokenType::Comment)) {
-        continue;
-      } else {
-        tokens.emplace_back(t);
-      }
-    }
-  }
+  Parser(const char* str, std::size_t size) : lexer(str, size) {}
   /// Indicates whether or not the parser failed.
   inline constexpr bool failed() const noexcept { return failedFlag; }
+  /// Indicates whether or not the input has an invalid token.
+  /// When it does, none of the parsed data should be used, since
+  /// an input with an invalid token isn't parsed at all.
+  inline constexpr bool foundInvalidToken() const noexcept { return invalidFlag; }
   /// Gets the error list found by the parser.
   /// Future calls to this function will return
   /// an empty error list.
   ///
-  /// @param content The variable containing the origin source code.
-  /// This is assigned to the error list so that the context of the
-  /// error can be shown if needed.
-  ErrorList* getErrorList(const char* filename, std::string&& content)
+  /// @param source The origin source code. This is referred to by
+  /// the error list so that the context of the error can be shown if
+  /// needed. It is not copied.
+  ErrorList* getErrorList(const char* filename, Source&& source)
   {
     // Resolve the stream contents to the descriptions.
     for (auto& err : errorList.errors) {
@@ -1672,7 +3319,10 @@ public:
     }
 
     errorList.filename = filename;
-    errorList.source = std::move(content);
+    errorList.sourceOwner = std::move(source.owner);
+    errorList.source = source.data;
+    errorList.sourceSize = source.size;
+    errorList.sourceTerminated = source.terminated;
 
     return new ErrorList(std::move(errorList));
   }
@@ -1720,9 +3370,7 @@ public:
         continue;
       }
 
-      auto node = parseNode();
-      if (node) {
-        layer->nodes.emplace_back(std::move(node));
+      if (parseNode(layer->nodes)) {
         continue;
       }
 
@@ -1738,31 +3386,15 @@ public:
   }
   /// Parses for a node.
   ///
-  /// @return On success, a pointer to a node.
-  /// On failure, a null pointer.
-  NodePtr parseNode()
+  /// @param nodes The node store to add the node to.
+  ///
+  /// @return True if a node was added, false otherwise.
+  bool parseNode(NodeStore& nodes)
   {
-    auto node = parseLineNode();
-    if (node) {
-      return node;
-    }
-
-    node = parseEllipseNode();
-    if (node) {
-      return node;
-    }
-
-    node = parseQuadNode();
-    if (node) {
-      return node;
-    }
-
-    node = parseFillNode();
-    if (node) {
-      return node;
-    }
-
-    return NodePtr();
+    return parseLineNode(nodes)
+        || parseEllipseNode(nodes)
+        || parseQuadNode(nodes)
+        || parseFillNode(nodes);
   }
   /// Attempts to make a boolean value.
   ///
@@ -2017,10 +3649,10 @@ public:
 
     return Optional<std::size_t>(tmp.value);
   }
-  /// Indicates the number of tokens remaining to be parsed.
-  inline std::size_t remaining() const noexcept
+  /// Indicates whether or not there are tokens remaining to be parsed.
+  inline bool remaining()
   {
-    return (pos < tokens.size()) ? tokens.size() - pos : 0;
+    return inBounds(0);
   }
 protected:
   /// Parses for common data found in stroke node derived classes.
@@ -2058,7 +3690,7 @@ protected:
   /// @param vertices The array to put the vertices into.
   ///
   /// @return True on success, false on failure.
-  bool parseVertices(const char* name, std::vector<Vec2>& vertices)
+  bool parseVertices(const char* name, LinePoints& vertices)
   {
     if (!matchID(name)) {
       return false;
@@ -2104,12 +3736,12 @@ protected:
     return true;
   }
   /// Attempts to parse a fill node.
-  NodePtr parseFillNode()
+  bool parseFillNode(NodeStore& nodes)
   {
     auto firstTok = look();
 
     if (!matchID("fill")) {
-      return NodePtr();
+      return false;
     }
 
     Fill fill;
@@ -2137,26 +3769,28 @@ protected:
       if (matchID("end")) {
         break;
       } else if (failed()) {
-        return NodePtr();
+        return false;
       } else {
         formatError(firstTok) << "Missing 'end' statement";
-        return NodePtr();
+        return false;
       }
     }
 
     if (failed()) {
-      return NodePtr();
-    } else {
-      return NodePtr(new Fill(std::move(fill)));
+      return false;
     }
+
+    nodes.add<Fill>(std::move(fill));
+
+    return true;
   }
   /// Attempts to parse an ellipse node.
-  NodePtr parseEllipseNode()
+  bool parseEllipseNode(NodeStore& nodes)
   {
     auto firstTok = look();
 
     if (!matchID("ellipse")) {
-      return NodePtr();
+      return false;
     }
 
     Ellipse ellipse;
@@ -2185,26 +3819,30 @@ protected:
         break;
       } else {
         formatError(firstTok) << "Missing 'end' statement.";
-        return NodePtr();
+        return false;
       }
     }
 
     if (failed()) {
-      return NodePtr();
-    } else {
-      return NodePtr(new Ellipse(std::move(ellipse)));
+      return false;
     }
+
+    nodes.add<Ellipse>(std::move(ellipse));
+
+    return true;
   }
   /// Attempts to parse a line node.
-  NodePtr parseLineNode()
+  /// The points are parsed straight into the point buffer
+  /// of the store, so the line is removed again if it fails.
+  bool parseLineNode(NodeStore& nodes)
   {
     auto firstTok = look();
 
     if (!matchID("line")) {
-      return NodePtr();
+      return false;
     }
 
-    Line line;
+    auto& line = *nodes.add<Line>(nodes.pointBuffer);
 
     while (remaining() && !failed() && !matchID("end")) {
 
@@ -2218,23 +3856,24 @@ protected:
 
       if (!failed()) {
         formatError(firstTok) << "Missing 'end' statement.";
-        return NodePtr();
+        break;
       }
     }
 
     if (failed()) {
-      return NodePtr();
-    } else {
-      return NodePtr(new Line(std::move(line)));
+      nodes.removeLast();
+      return false;
     }
+
+    return true;
   }
   /// Parses for a quadrilateral node.
-  NodePtr parseQuadNode()
+  bool parseQuadNode(NodeStore& nodes)
   {
     auto firstTok = look();
 
     if (!matchID("quad")) {
-      return NodePtr();
+      return false;
     }
 
     Quad quad;
@@ -2251,15 +3890,17 @@ protected:
 
       if (!failed()) {
         formatError(firstTok) << "Missing 'end' statement.";
-        return NodePtr();
+        return false;
       }
     }
 
     if (failed()) {
-      return NodePtr();
-    } else {
-      return NodePtr(new Quad(std::move(quad)));
+      return false;
     }
+
+    nodes.add<Quad>(std::move(quad));
+
+    return true;
   }
   /// Converts an integer vector to a color value.
   RGBA toColor(const Vector<int, 4>& v)
@@ -2339,11 +3980,11 @@ protected:
   /// has moved passed.
   Token previousTok(std::size_t offset = 1) const noexcept
   {
-    if (offset > pos) {
+    if ((offset > pos) || (((pos - offset) + tokenWindowSize()) < scanned)) {
       return Token();
     }
 
-    return tokens[pos - offset];
+    return window[(pos - offset) % tokenWindowSize()];
   }
   /// Goes to the next number of tokens.
   ///
@@ -2353,18 +3994,75 @@ protected:
     pos += count;
   }
   /// Gets a token at a certain offset.
-  Token look(std::size_t offset = 0) const noexcept
+  Token look(std::size_t offset = 0)
   {
     if (inBounds(offset)) {
-      return tokens[pos + offset];
+      return window[(pos + offset) % tokenWindowSize()];
     } else {
       return Token();
     }
   }
   /// Indicates if a certain offset is in bounds.
-  inline bool inBounds(std::size_t offset) const noexcept
+  /// Tokens are scanned up to the offset, if they
+  /// haven't been scanned already.
+  inline bool inBounds(std::size_t offset)
+  {
+    return scanTo(pos + offset + 1) > (pos + offset);
+  }
+  /// Scans tokens until a certain number of them have been scanned.
+  /// Spaces and comments are skipped. If an invalid token is found,
+  /// an error is emitted and no more tokens are scanned.
+  ///
+  /// @param count The number of tokens to scan up to.
+  ///
+  /// @return The number of tokens that were scanned.
+  std::size_t scanTo(std::size_t count)
+  {
+    while ((scanned < count) && !lexerDone) {
+
+      auto t = lexer.scan();
+
+      if (t == TokenType::Invalid) {
+        lexerDone = true;
+        if (!failedFlag) {
+          invalidFlag = true;
+          addError(t) << "Invalid token " << t;
+        }
+      } else if (t == TokenType::None) {
+        lexerDone = true;
+      } else if ((t != TokenType::Space) && (t != TokenType::Comment)) {
+        window[scanned % tokenWindowSize()] = t;
+        scanned++;
+      }
+    }
+
+    return scanned;
+  }
+  /// Looks for an invalid token in the input
+  /// that hasn't been scanned yet.
+  ///
+  /// @return The first invalid token, if one is found.
+  /// Otherwise, an empty token is returned.
+  Token findInvalidToken() const noexcept
   {
-    return (pos + offset) < tokens.size();
+    if (lexerDone) {
+      return Token();
+    }
+
+    auto ahead = lexer;
+
+    while (ahead.remaining()) {
+
+      auto t = ahead.scan();
+
+      if (t == TokenType::Invalid) {
+        return t;
+      } else if (t == TokenType::None) {
+        break;
+      }
+    }
+
+    return Token();
   }
   /// Emits an error indicating that an internal parser
   /// error has occurred.
@@ -2391,6 +4089,27 @@ protected:
       return suppressed;
     }
 
+    // An invalid token is always the first error reported, regardless
+    // of where it is in the input. The rest of the input is scanned for
+    // one before reporting anything else.
+
+    auto invalidToken = findInvalidToken();
+    if (invalidToken) {
+      invalidFlag = true;
+      addError(invalidToken) << "Invalid token " << invalidToken;
+      return suppressed;
+    }
+
+    return addError(t);
+  }
+  /// Adds an error to the error list and marks the parser as failed.
+  ///
+  /// @param t The token that caused the error.
+  ///
+  /// @return A reference to the stream that can be
+  /// used to format the error.
+  std::ostream& addError(const Token& t)
+  {
     failedFlag = true;
 
     Error error {
@@ -2410,787 +4129,4458 @@ protected:
 
 } // namespace
 
-//===================//
-// Section: Document //
-//===================//
+//========================//
+// Section: Binary Format //
+//========================//
 
-/// Contains the implementation data of the document class.
-struct Document final
+namespace {
+
+/// The bytes that begin a binary document.
+/// The first byte can't start a text document,
+/// which is how the two formats are told apart.
+constexpr unsigned char binaryMagic[4] { 0x89, 'P', 'X', 'B' };
+
+/// The version of the binary format
+/// written by this version of the library.
+constexpr std::uint64_t binaryVersion() noexcept { return 1; }
+
+/// Identifies the type of a node in a binary document.
+enum class BinaryNodeType : unsigned char
 {
-  /// The layers of the document, each containing the
-  /// draw operations to be completed by the painer.
-  /// The first layer is returned first and is therefore
-  /// the "bottom" layer.
-  std::vector<LayerPtr> layers;
-  /// The width of the document, in pixels.
-  std::size_t width = 64;
-  /// The height of the document, in pixels.
-  std::size_t height = 64;
-  /// The default background color.
-  RGBA background = transparent();
-  /// Makes a new document.
-  Document()
+  Line,
+  Ellipse,
+  Quad,
+  Fill
+};
+
+/// Indicates whether or not a buffer contains a binary document.
+///
+/// @param data The data to check.
+/// @param size The number of bytes in @p data.
+///
+/// @return True if the data begins with the binary magic bytes.
+bool isBinaryDoc(const char* data, std::size_t size) noexcept
+{
+  return (size >= sizeof(binaryMagic)) && (std::memcmp(data, binaryMagic, sizeof(binaryMagic)) == 0);
+}
+
+/// Encodes documents into the binary format.
+///
+/// Integers are written as variable length quantities, with signed
+/// integers zig-zag encoded first. Colors are written the same way the
+/// text encoder writes them, as multiples of @ref colorRes, so that both
+/// formats produce the same document when they're opened. Points in a
+/// line are written as the difference from the point before them. Each
+/// layer is prefixed by its size in bytes so that it can be skipped.
+class BinaryEncoder final : public NodeAccessor
+{
+  /// The buffer being written to.
+  ByteBuffer& buffer;
+public:
+  BinaryEncoder(ByteBuffer& buffer_) : buffer(buffer_) {}
+  /// Encodes the magic bytes and the format version.
+  void encodeMagic()
   {
-    addLayer(this);
+    buffer.append(reinterpret_cast<const char*>(binaryMagic), sizeof(binaryMagic));
+
+    encodeUnsigned(binaryVersion());
   }
-  /// Makes a copy of the document.
+  /// Encodes an unsigned integer.
   ///
-  /// @param other The document to copy.
-  Document(const Document& other)
+  /// @param value The value to encode.
+  void encodeUnsigned(std::uint64_t value)
   {
-    width = other.width;
-    height = other.height;
-    background = other.background;
-
-    for (const auto& otherLayer : other.layers) {
-      layers.emplace_back(new Layer(*otherLayer));
+    while (value >= 0x80) {
+      buffer.push_back(char((value & 0x7f) | 0x80));
+      value >>= 7;
     }
+
+    buffer.push_back(char(value));
   }
-  /// Resets back to initial state.
-  void reset()
+  /// Encodes a signed integer.
+  ///
+  /// @param value The value to encode.
+  void encodeSigned(int value)
   {
-    *this = Document();
+    auto u = std::uint32_t(value);
+
+    encodeUnsigned((u << 1) ^ ((value < 0) ? 0xffffffffu : 0u));
   }
-  /// Moves a document to a new variable
-  /// via move semantics.
-  Document& operator = (Document&& other)
+  /// Encodes a color, the same way the text encoder does.
+  ///
+  /// @param c The color to encode.
+  void encodeColor(const RGBA& c)
   {
-    layers = std::move(other.layers);
-    width = other.width;
-    height = other.height;
-    background = other.background;
-    return *this;
+    for (std::size_t i = 0; i < 4; i++) {
+      encodeSigned(int(c[i] * colorRes()));
+    }
   }
-};
+  /// Encodes a string, prefixed by its size.
+  ///
+  /// @param str The string to encode.
+  void encodeString(const std::string& str)
+  {
+    encodeUnsigned(str.size());
 
-namespace {
+    buffer.append(str.data(), str.size());
+  }
+  /// Encodes a layer, prefixed by its size.
+  ///
+  /// @param layer The layer to encode.
+  void encodeLayer(const Layer& layer)
+  {
+    ByteBuffer body;
 
-/// Indicates if a layer name exists already.
-/// This is used when automatically naming layers,
-/// so that the automatically generated layer has a
-/// unique name (even though it doesn't need one.)
-///
-/// @param doc The document to check the layer names for.
-/// @param name The name to search for.
-///
-/// @return True if the name exists, false if it does not.
-bool layerNameExists(const Document* doc, const char* name) noexcept
-{
-  for (const auto& l : doc->layers) {
-    if (l->name == name) {
-      return true;
+    BinaryEncoder bodyEncoder(body);
+
+    bodyEncoder.encodeString(layer.name);
+    bodyEncoder.encodeUnsigned(std::size_t(clip(layer.opacity) * colorRes()));
+    bodyEncoder.encodeUnsigned(layer.visible ? 1 : 0);
+    bodyEncoder.encodeUnsigned(layer.nodes.size());
+
+    for (const auto& node : layer.nodes) {
+      node->accept(bodyEncoder);
     }
-  }
 
-  return false;
-}
+    // The layer would be cut short, so the whole document fails.
+    if (body.failed()) {
+      buffer.fail();
+      return;
+    }
+
+    encodeUnsigned(body.getSize());
+
+    buffer.append(body.getData(), body.getSize());
+  }
+protected:
+  /// Encodes a point.
+  ///
+  /// @param p The point to encode.
+  /// @param prev The point that @p p is encoded relative to.
+  void encodePoint(const Vec2& p, const Vec2& prev = Vec2 { 0, 0 })
+  {
+    // The difference wraps around instead of overflowing,
+    // and wraps back around when the point is decoded.
+    encodeSigned(int(std::uint32_t(p[0]) - std::uint32_t(prev[0])));
+    encodeSigned(int(std::uint32_t(p[1]) - std::uint32_t(prev[1])));
+  }
+  /// Encodes the data common to all stroke nodes.
+  ///
+  /// @param strokeNode The stroke node to encode.
+  void encodeStrokeNode(const StrokeNode& strokeNode)
+  {
+    encodeUnsigned(strokeNode.pixelSize);
+    encodeUnsigned(std::uint64_t(strokeNode.blendMode));
+    encodeColor(strokeNode.color);
+  }
+  /// Encodes the type of a node.
+  ///
+  /// @param type The type of the node being encoded.
+  void encodeType(BinaryNodeType type)
+  {
+    buffer.push_back(char(type));
+  }
+  void access(const Ellipse& ellipse) noexcept override
+  {
+    encodeType(BinaryNodeType::Ellipse);
+    encodeStrokeNode(ellipse);
+    encodePoint(ellipse.center);
+    encodePoint(ellipse.radius);
+  }
+  void access(const Fill& fill) noexcept override
+  {
+    encodeType(BinaryNodeType::Fill);
+    encodeUnsigned(std::uint64_t(fill.blendMode));
+    encodeColor(fill.color);
+    encodePoint(fill.origin);
+  }
+  void access(const Line& line) noexcept override
+  {
+    encodeType(BinaryNodeType::Line);
+    encodeStrokeNode(line);
+    encodeUnsigned(line.points.size());
+
+    Vec2 prev { 0, 0 };
+
+    for (const auto& p : line.points) {
+      encodePoint(p, prev);
+      prev = p;
+    }
+  }
+  void access(const Quad& quad) noexcept override
+  {
+    encodeType(BinaryNodeType::Quad);
+    encodeStrokeNode(quad);
+
+    for (const auto& p : quad.points) {
+      encodePoint(p);
+    }
+  }
+};
+
+/// Decodes documents from the binary format.
+/// Like the text parser, decoding stops at the first error.
+class BinaryParser final
+{
+  /// Suppressed error messages go here.
+  std::ostringstream suppressed;
+  /// The data being decoded.
+  const unsigned char* data = nullptr;
+  /// The number of bytes in the data.
+  std::size_t size = 0;
+  /// The position of the parser within the data.
+  std::size_t pos = 0;
+  /// Whether or not the parser has failed.
+  bool failedFlag = false;
+  /// The list of errors found by the parser.
+  ErrorList errorList;
+public:
+  /// Constructs a new binary parser.
+  ///
+  /// @param d The data to decode.
+  /// @param s The number of bytes in @p d.
+  BinaryParser(const char* d, std::size_t s)
+    : data(reinterpret_cast<const unsigned char*>(d)), size(s) {}
+  /// Indicates whether or not the parser failed.
+  inline constexpr bool failed() const noexcept { return failedFlag; }
+  /// Indicates whether or not there is data left to decode.
+  inline constexpr bool remaining() const noexcept { return pos < size; }
+  /// Gets the error list found by the parser.
+  ///
+  /// @param filename The name to give the source in the error list.
+  /// @param source The data that was decoded.
+  ErrorList* getErrorList(const char* filename, Source&& source)
+  {
+    for (auto& err : errorList.errors) {
+      err.description = err.stream.str();
+    }
+
+    errorList.filename = filename;
+    errorList.sourceOwner = std::move(source.owner);
+    errorList.source = source.data;
+    errorList.sourceSize = source.size;
+    errorList.sourceTerminated = source.terminated;
+
+    return new ErrorList(std::move(errorList));
+  }
+  /// Decodes the magic bytes and checks the format version.
+  void parseMagic()
+  {
+    if (!isBinaryDoc(reinterpret_cast<const char*>(data), size)) {
+      formatError(0) << "Missing binary document signature.";
+      return;
+    }
+
+    pos += sizeof(binaryMagic);
+
+    auto version = parseUnsigned();
+    if (!failed() && (version > binaryVersion())) {
+      formatError(pos) << "Unsupported binary document version " << version << '.';
+    }
+  }
+  /// Decodes an unsigned integer.
+  std::uint64_t parseUnsigned()
+  {
+    auto start = pos;
+
+    std::uint64_t value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+
+      if (pos >= size) {
+        formatError(start) << "Unexpected end of data.";
+        return 0;
+      }
+
+      auto b = data[pos++];
+
+      value |= std::uint64_t(b & 0x7f) << shift;
+
+      if (!(b & 0x80)) {
+        return value;
+      }
+    }
+
+    formatError(start) << "Integer is too large.";
+
+    return 0;
+  }
+  /// Decodes a signed integer.
+  int parseSigned()
+  {
+    auto u = std::uint32_t(parseUnsigned());
+
+    return int(u >> 1) ^ -int(u & 1);
+  }
+  /// Decodes a count of items, making sure that
+  /// there is enough data left for that many items.
+  ///
+  /// @param minItemSize The minimum number of bytes in each item.
+  std::size_t parseCount(std::size_t minItemSize)
+  {
+    auto start = pos;
+
+    auto count = parseUnsigned();
+
+    if (failed()) {
+      return 0;
+    } else if (count > ((size - pos) / minItemSize)) {
+      formatError(start) << "Count of " << count << " exceeds the remaining data.";
+      return 0;
+    }
+
+    return std::size_t(count);
+  }
+  /// Decodes a color, the same way the text parser does.
+  RGBA parseColor()
+  {
+    RGBA c;
+
+    for (std::size_t i = 0; i < 4; i++) {
+      c[i] = float(parseSigned()) / colorRes();
+    }
+
+    return c;
+  }
+  /// Decodes a layer.
+  ///
+  /// @return On success, a pointer to the layer.
+  /// On failure, a null pointer.
+  LayerPtr parseLayer()
+  {
+    auto layerStart = pos;
+
+    auto layerSize = parseCount(1);
+
+    auto bodyStart = pos;
+
+    LayerPtr layer(new Layer());
+
+    layer->name = parseString();
+    layer->opacity = float(parseUnsigned()) / colorRes();
+    layer->visible = parseUnsigned() != 0;
+
+    auto nodeCount = parseCount(1);
+
+    for (std::size_t i = 0; (i < nodeCount) && !failed(); i++) {
+      parseNode(layer->nodes);
+    }
+
+    if (!failed() && ((pos - bodyStart) != layerSize)) {
+      formatError(layerStart) << "Layer size does not match its contents.";
+    }
+
+    return failed() ? LayerPtr() : std::move(layer);
+  }
+  /// Checks that there is no data after the end of the document.
+  void parseEnd()
+  {
+    if (!failed() && remaining()) {
+      formatError(pos) << "Unexpected data after the end of the document.";
+    }
+  }
+protected:
+  /// Decodes a string.
+  std::string parseString()
+  {
+    auto length = parseCount(1);
+
+    if (failed()) {
+      return std::string();
+    }
+
+    std::string str(reinterpret_cast<const char*>(data + pos), length);
+
+    pos += length;
+
+    return str;
+  }
+  /// Decodes a point.
+  ///
+  /// @param prev The point that the point was encoded relative to.
+  Vec2 parsePoint(const Vec2& prev = Vec2 { 0, 0 })
+  {
+    auto x = std::uint32_t(parseSigned()) + std::uint32_t(prev[0]);
+    auto y = std::uint32_t(parseSigned()) + std::uint32_t(prev[1]);
+
+    return Vec2 { int(x), int(y) };
+  }
+  /// Decodes a blend mode.
+  BlendMode parseBlendMode()
+  {
+    auto start = pos;
+
+    auto value = parseUnsigned();
+
+    switch (value) {
+      case std::uint64_t(BlendMode::Normal):
+        return BlendMode::Normal;
+      case std::uint64_t(BlendMode::Subtract):
+        return BlendMode::Subtract;
+    }
+
+    formatError(start) << value << " is not a blend mode.";
+
+    return BlendMode::Normal;
+  }
+  /// Decodes the data common to all stroke nodes.
+  ///
+  /// @param strokeNode The stroke node to assign the data to.
+  void parseStrokeNode(StrokeNode& strokeNode)
+  {
+    strokeNode.pixelSize = safePixelSize(int(parseUnsigned()));
+    strokeNode.blendMode = parseBlendMode();
+    strokeNode.color = parseColor();
+  }
+  /// Decodes a node.
+  /// Nodes are decoded straight into the node store. If decoding
+  /// fails, the layer that the store belongs to is discarded.
+  ///
+  /// @param nodes The node store to add the node to.
+  void parseNode(NodeStore& nodes)
+  {
+    if (!remaining()) {
+      formatError(pos) << "Unexpected end of data.";
+      return;
+    }
+
+    auto typeStart = pos;
+
+    switch (BinaryNodeType(data[pos++])) {
+      case BinaryNodeType::Line:
+        parseLine(*nodes.add<Line>(nodes.pointBuffer));
+        return;
+      case BinaryNodeType::Ellipse:
+        parseEllipse(*nodes.add<Ellipse>());
+        return;
+      case BinaryNodeType::Quad:
+        parseQuad(*nodes.add<Quad>());
+        return;
+      case BinaryNodeType::Fill:
+        parseFill(*nodes.add<Fill>());
+        return;
+    }
+
+    formatError(typeStart) << "Unknown node type " << int(data[typeStart]) << '.';
+  }
+  /// Decodes an ellipse node.
+  void parseEllipse(Ellipse& ellipse)
+  {
+    parseStrokeNode(ellipse);
+
+    ellipse.center = parsePoint();
+    ellipse.radius = parsePoint();
+  }
+  /// Decodes a fill node.
+  void parseFill(Fill& fill)
+  {
+    fill.blendMode = parseBlendMode();
+    fill.color = parseColor();
+    fill.origin = parsePoint();
+  }
+  /// Decodes a line node.
+  void parseLine(Line& line)
+  {
+    parseStrokeNode(line);
+
+    auto pointCount = parseCount(2);
+
+    line.points.resize(pointCount);
+
+    Vec2 prev { 0, 0 };
+
+    for (std::size_t i = 0; (i < pointCount) && !failed(); i++) {
+      prev = parsePoint(prev);
+      line.points[i] = prev;
+    }
+  }
+  /// Decodes a quadrilateral node.
+  void parseQuad(Quad& quad)
+  {
+    parseStrokeNode(quad);
+
+    for (auto& p : quad.points) {
+      p = parsePoint();
+    }
+  }
+  /// Creates an error and returns it for formatting.
+  /// Binary data has no lines, so the column
+  /// is one passed the byte offset of the error.
+  ///
+  /// @param offset The byte offset of the error.
+  ///
+  /// @return A reference to the stream that can be
+  /// used to format the error.
+  std::ostream& formatError(std::size_t offset)
+  {
+    if (failedFlag) {
+      return suppressed;
+    }
+
+    failedFlag = true;
+
+    Error error {
+      std::ostringstream(),
+      std::string(),
+      1,
+      offset + 1,
+      offset,
+      1
+    };
+
+    errorList.errors.emplace_back(std::move(error));
+
+    return errorList.errors[errorList.errors.size() - 1].stream;
+  }
+};
+
+} // namespace
+
+//===================//
+// Section: Document //
+//===================//
+
+/// Contains the implementation data of the document class.
+struct Document final
+{
+  /// The layers of the document, each containing the
+  /// draw operations to be completed by the painer.
+  /// The first layer is returned first and is therefore
+  /// the "bottom" layer.
+  ///
+  /// Layers may be shared with other documents. They're only
+  /// modified through @ref editLayer, which makes sure that
+  /// the layer belongs to this document first.
+  std::vector<LayerPtr> layers;
+  /// The width of the document, in pixels.
+  std::size_t width = 64;
+  /// The height of the document, in pixels.
+  std::size_t height = 64;
+  /// The default background color.
+  RGBA background = transparent();
+  /// Changes whenever the document or any of its layers is
+  /// modified. Copies keep the revision, since they look the same.
+  std::uint64_t revision = nextRevision();
+  /// Tells the document apart from its copies, which share its
+  /// nodes. Revisions are never reused, so one is taken as the ID.
+  /// This is kept when the document is modified or assigned to.
+  const std::uint64_t id = nextRevision();
+  /// Makes a new document.
+  Document()
+  {
+    addLayer(this);
+  }
+  /// Makes a copy of the document.
+  /// The layers are shared with the other
+  /// document, instead of being copied.
+  ///
+  /// @param other The document to copy.
+  Document(const Document& other)
+  {
+    width = other.width;
+    height = other.height;
+    background = other.background;
+    revision = other.revision;
+
+    layers.reserve(other.layers.size());
+
+    try {
+      for (const auto& layer : other.layers) {
+        if (!layer->frozen) {
+          layer->readers.emplace(this);
+        }
+        layers.emplace_back(layer);
+      }
+    } catch (...) {
+      clearLayers();
+      throw;
+    }
+  }
+  /// Stops sharing the layers of the document.
+  ~Document()
+  {
+    clearLayers();
+  }
+  /// Resets back to initial state.
+  void reset()
+  {
+    *this = Document();
+  }
+  /// Moves a document to a new variable
+  /// via move semantics.
+  Document& operator = (Document&& other)
+  {
+    clearLayers();
+
+    layers = std::move(other.layers);
+
+    // The layers refer to the document
+    // they belong to, which has just moved.
+    for (auto& layer : layers) {
+      rebind(*layer, &other, this);
+    }
+
+    width = other.width;
+    height = other.height;
+    background = other.background;
+    revision = other.revision;
+    return *this;
+  }
+  /// Removes all of the layers from the document.
+  void clearLayers() noexcept
+  {
+    for (auto& layer : layers) {
+      rebind(*layer, this, nullptr);
+    }
+
+    layers.clear();
+  }
+  /// Removes a layer from the document.
+  ///
+  /// @param index The index of the layer to remove.
+  void removeLayer(std::size_t index) noexcept
+  {
+    rebind(*layers[index], this, nullptr);
+
+    layers.erase(layers.begin() + index);
+  }
+protected:
+  /// Replaces a document in the list of documents that share a layer.
+  ///
+  /// @param layer The layer to update.
+  /// @param from The document to replace.
+  /// @param to The document to replace it with. If this
+  /// is null, then @p from is removed from the layer.
+  static void rebind(Layer& layer, Document* from, Document* to) noexcept
+  {
+    if (layer.owner == from) {
+      layer.owner = to;
+    }
+
+    if (!layer.readers.erase(from) || !to) {
+      return;
+    }
+
+    try {
+      layer.readers.emplace(to);
+    } catch (...) {
+      // The document keeps sharing the layer, but it sees the
+      // modifications of the owner, like it does when there isn't
+      // enough memory to copy the layer in @ref detachReaders.
+    }
+  }
+};
+
+namespace {
+
+void modifyDoc(Document* doc) noexcept
+{
+  if (doc) {
+    doc->revision = nextRevision();
+  }
+}
+
+/// Accesses a layer of a document so that it can be modified.
+/// If the layer is shared with another document that may modify
+/// it, then this document is given its own copy of the layer.
+///
+/// @exception std::out_of_range If the index is out of range.
+/// @exception std::bad_alloc If the layer has to be copied
+/// and there isn't enough memory for the copy.
+///
+/// @param doc The document that the layer is in.
+/// @param index The index of the layer.
+///
+/// @return The layer belonging to the document.
+Layer& editLayer(Document* doc, std::size_t index)
+{
+  auto& layer = doc->layers.at(index);
+
+  if (layer->owner == doc) {
+    return *layer;
+  }
+
+  if (!layer->owner && !layer->frozen) {
+
+    // No document can have modified the layer yet,
+    // so this document can take it over as it is.
+
+    layer->readers.erase(doc);
+
+    layer->owner = doc;
+
+    return *layer;
+  }
+
+  LayerPtr copy(new Layer(*layer));
+
+  copy->owner = doc;
+
+  layer->readers.erase(doc);
+
+  layer = std::move(copy);
+
+  return *layer;
+}
+
+void detachReaders(Layer* layer) noexcept
+{
+  if (!layer || layer->readers.empty()) {
+    return;
+  }
+
+  // The readers share a single copy of the layer,
+  // since none of them can modify it without copying it.
+
+  LayerPtr copy;
+
+  try {
+    copy = LayerPtr(new Layer(*layer));
+    copy->readers = layer->readers;
+  } catch (...) {
+    // The readers keep sharing the layer, so they
+    // see the modification. This is only the case
+    // when there isn't enough memory for the copy.
+    return;
+  }
+
+  for (auto* reader : layer->readers) {
+
+    for (auto& readerLayer : reader->layers) {
+      if (readerLayer.get() == layer) {
+        readerLayer = copy;
+      }
+    }
+  }
+
+  layer->readers.clear();
+}
+
+} // namespace
+
+namespace {
+
+/// Indicates if a layer name exists already.
+/// This is used when automatically naming layers,
+/// so that the automatically generated layer has a
+/// unique name (even though it doesn't need one.)
+///
+/// @param doc The document to check the layer names for.
+/// @param name The name to search for.
+///
+/// @return True if the name exists, false if it does not.
+bool layerNameExists(const Document* doc, const char* name) noexcept
+{
+  for (const auto& l : doc->layers) {
+    if (l->name == name) {
+      return true;
+    }
+  }
+
+  return false;
+}
 
 /// Formats a layer name.
 ///
-/// @param index The index to put into the layer name.
+/// @param index The index to put into the layer name.
+///
+/// @return The formatted layer name.
+std::string formatLayerName(std::size_t index)
+{
+  std::stringstream stream;
+  stream << "Layer ";
+  stream << index;
+  return stream.str();
+}
+
+/// Generates a unique layer name.
+///
+/// @param doc The document to generate the layer name for.
+///
+/// @return The unique layer name.
+std::string uniqueLayerName(const Document* doc)
+{
+  for (std::size_t i = doc->layers.size() + 1; i < SIZE_MAX; i++) {
+
+    auto name = formatLayerName(i);
+    if (!layerNameExists(doc, name.c_str())) {
+      return name;
+    }
+  }
+
+  // It would be odd if this was reached.
+
+  return "";
+}
+
+} // namespace
+
+Document* createDoc()
+{
+  return new Document();
+}
+
+void closeDoc(Document* doc) noexcept
+{
+  delete doc;
+}
+
+Document* copyDoc(const Document* doc)
+{
+  return new Document(*doc);
+}
+
+Document* snapshotDoc(const Document* doc, const Document* previous)
+{
+  std::unique_ptr<Document> snapshot(new Document());
+
+  snapshot->clearLayers();
+
+  snapshot->width = doc->width;
+  snapshot->height = doc->height;
+  snapshot->background = doc->background;
+  snapshot->revision = doc->revision;
+
+  snapshot->layers.reserve(doc->layers.size());
+
+  for (const auto& layer : doc->layers) {
+
+    LayerPtr frozenLayer;
+
+    // A layer with the same revision looks the same,
+    // so it doesn't have to be copied again.
+    if (previous) {
+      for (const auto& previousLayer : previous->layers) {
+        if (previousLayer->frozen && (previousLayer->revision == layer->revision)) {
+          frozenLayer = previousLayer;
+          break;
+        }
+      }
+    }
+
+    if (!frozenLayer) {
+      frozenLayer = LayerPtr(new Layer(*layer));
+      frozenLayer->frozen = true;
+    }
+
+    snapshot->layers.emplace_back(std::move(frozenLayer));
+  }
+
+  return snapshot.release();
+}
+
+namespace {
+
+/// Parses a document from the binary format.
+///
+/// @param doc The document to put the decoded data into.
+/// @param filename The name to give the data in the error list.
+/// @param source The data to decode.
+/// @param errListPtr Receives the error list, if an error occurs.
+///
+/// @return Zero on success, EINVAL if the data has an error.
+int parseBinaryDoc(Document* doc, const char* filename, Source&& source, ErrorList** errListPtr)
+{
+  BinaryParser parser(source.data, source.size);
+
+  parser.parseMagic();
+
+  doc->width = std::size_t(parser.parseUnsigned());
+  doc->height = std::size_t(parser.parseUnsigned());
+  doc->background = parser.parseColor();
+
+  auto layerCount = parser.parseCount(1);
+
+  for (std::size_t i = 0; (i < layerCount) && !parser.failed(); i++) {
+
+    auto layer = parser.parseLayer();
+
+    if (layer) {
+      doc->layers.emplace_back(std::move(layer));
+    }
+  }
+
+  parser.parseEnd();
+
+  if (parser.failed()) {
+
+    if (errListPtr) {
+      *errListPtr = parser.getErrorList(filename, std::move(source));
+    }
+
+    return EINVAL;
+  }
+
+  return 0;
+}
+
+/// Parses a document from its source code.
+/// Binary documents are detected and decoded as well.
+///
+/// @param doc The document to put the parsed data into.
+/// @param filename The name to give the source code in the error list.
+/// @param source The source code to parse.
+/// @param errListPtr Receives the error list, if an error occurs.
+///
+/// @return Zero on success, EINVAL if the source code has an error.
+int parseDoc(Document* doc, const char* filename, Source&& source, ErrorList** errListPtr)
+{
+  if (isBinaryDoc(source.data, source.size)) {
+    return parseBinaryDoc(doc, filename, std::move(source), errListPtr);
+  }
+
+  Parser parser(source.data, source.size);
+
+  while (parser.remaining() && !parser.failed()) {
+
+    auto w = parser.parseSize("width");
+    if (w.valid) {
+      doc->width = w.value;
+      continue;
+    } else if (parser.failed()) {
+      break;
+    }
+
+    auto h = parser.parseSize("height");
+    if (h.valid) {
+      doc->height = h.value;
+      continue;
+    } else if (parser.failed()) {
+      break;
+    }
+
+    auto bg = parser.parseColor("background");
+    if (bg.valid) {
+      doc->background = bg.value;
+      continue;
+    } else if (parser.failed()) {
+      break;
+    }
+
+    // Nodes outside of a layer go into the first layer,
+    // which is only kept if a node is actually found.
+    auto addedLayer = doc->layers.empty();
+    if (addedLayer) {
+      addLayer(doc);
+    }
+
+    if (parser.parseNode(doc->layers[0]->nodes)) {
+      continue;
+    } else if (addedLayer) {
+      doc->layers.pop_back();
+    }
+
+    if (parser.failed()) {
+      break;
+    }
+
+    auto layer = parser.parseLayer();
+    if (layer) {
+      doc->layers.emplace_back(std::move(layer));
+      continue;
+    } else if (parser.failed()) {
+      break;
+    }
+
+    parser.badToken();
+    break;
+  }
+
+  if (parser.failed()) {
+
+    // Tokens are only scanned as they're needed, so part of the
+    // document may have been parsed before an invalid token was
+    // found. The document is left empty, as if it was never parsed.
+    if (parser.foundInvalidToken()) {
+      *doc = Document();
+      doc->clearLayers();
+    }
+
+    if (errListPtr) {
+      *errListPtr = parser.getErrorList(filename, std::move(source));
+    }
+
+    return EINVAL;
+  }
+
+  return 0;
+}
+
+/// Reads a file into a string.
+///
+/// @param filename The path of the file to read.
+/// @param source Receives the contents of the file.
+///
+/// @return Zero on success, an error code on failure.
+int readSource(const char* filename, Source& source)
+{
+  errno = 0;
+
+  std::ifstream file(filename);
+  if (!file.good()) {
+    return errno;
+  }
+
+  // The size is an upper bound, since newline
+  // sequences may be converted while reading.
+  file.seekg(0, std::ios::end);
+  auto fileSize = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  auto content = std::make_shared<std::string>();
+
+  if (fileSize > 0) {
+    content->resize(std::size_t(fileSize));
+    file.read(&(*content)[0], fileSize);
+    content->resize(std::size_t(file.gcount()));
+  }
+
+  source.data = content->c_str();
+  source.size = content->size();
+  source.terminated = true;
+  source.owner = std::move(content);
+
+  return 0;
+}
+
+#ifdef LIBPX_MMAP
+
+/// A file that is mapped into memory.
+struct MappedFile final
+{
+  /// The address of the mapping.
+  void* data = nullptr;
+  /// The number of bytes in the mapping.
+  std::size_t size = 0;
+  /// Unmaps the file.
+  ~MappedFile()
+  {
+    munmap(data, size);
+  }
+};
+
+/// Maps a file into memory, so that it can be parsed in place.
+/// Files that can't be mapped, such as empty files or pipes, are read instead.
+///
+/// @param filename The path of the file to map.
+/// @param source Receives the contents of the file.
+///
+/// @return Zero on success, an error code on failure.
+int loadSource(const char* filename, Source& source)
+{
+  errno = 0;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return errno;
+  }
+
+  struct stat info;
+
+  void* data = MAP_FAILED;
+
+  std::size_t size = 0;
+
+  if ((fstat(fd, &info) == 0) && S_ISREG(info.st_mode) && (info.st_size > 0)) {
+    size = std::size_t(info.st_size);
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return readSource(filename, source);
+  }
+
+  std::shared_ptr<MappedFile> mapping;
+
+  try {
+    mapping = std::make_shared<MappedFile>();
+  } catch (...) {
+    munmap(data, size);
+    throw;
+  }
+
+  mapping->data = data;
+  mapping->size = size;
+
+  source.data = static_cast<const char*>(data);
+  source.size = size;
+  source.terminated = false;
+  source.owner = std::move(mapping);
+
+  return 0;
+}
+
+#else // LIBPX_MMAP
+
+/// Reads a file, so that it can be parsed.
+///
+/// @param filename The path of the file to read.
+/// @param source Receives the contents of the file.
+///
+/// @return Zero on success, an error code on failure.
+int loadSource(const char* filename, Source& source)
+{
+  return readSource(filename, source);
+}
+
+#endif // LIBPX_MMAP
+
+} // namespace
+
+int openDoc(Document* doc, const char* filename, ErrorList** errListPtr)
+{
+  if (errListPtr) {
+    *errListPtr = nullptr;
+  }
+
+  *doc = Document();
+
+  doc->clearLayers();
+
+  if (!filename) {
+    return EFAULT;
+  }
+
+  Source source;
+
+  auto err = loadSource(filename, source);
+  if (err) {
+    return err;
+  }
+
+  return parseDoc(doc, filename, std::move(source), errListPtr);
+}
+
+int openDoc(Document* doc, const void* data, std::size_t size, ErrorList** errListPtr)
+{
+  if (errListPtr) {
+    *errListPtr = nullptr;
+  }
+
+  *doc = Document();
+
+  doc->clearLayers();
+
+  if (!data && size) {
+    return EFAULT;
+  }
+
+  Source source;
+
+  source.data = data ? static_cast<const char*>(data) : "";
+  source.size = size;
+  source.terminated = false;
+
+  return parseDoc(doc, "<memory>", std::move(source), errListPtr);
+}
+
+namespace {
+
+/// Encodes the document as text.
+///
+/// @param doc The document to encode.
+/// @param buffer The buffer to encode the document to.
+void encodeDoc(const Document* doc, ByteBuffer& buffer)
+{
+  Encoder encoder(buffer);
+
+  encoder.encodeSize("width", doc->width);
+  encoder.encodeSize("height", doc->height);
+  encoder.encodeColor("background", doc->background);
+
+  for (const auto& layer : doc->layers) {
+    encoder.encodeLayer(*layer);
+  }
+}
+
+/// Encodes the document in the binary format.
+///
+/// @param doc The document to encode.
+/// @param buffer The buffer to encode the document to.
+void encodeBinaryDoc(const Document* doc, ByteBuffer& buffer)
+{
+  BinaryEncoder encoder(buffer);
+
+  encoder.encodeMagic();
+  encoder.encodeUnsigned(doc->width);
+  encoder.encodeUnsigned(doc->height);
+  encoder.encodeColor(doc->background);
+  encoder.encodeUnsigned(doc->layers.size());
+
+  for (const auto& layer : doc->layers) {
+    encoder.encodeLayer(*layer);
+  }
+}
+
+/// Encodes the document in the specified format.
+///
+/// @param doc The document to encode.
+/// @param buffer The buffer to encode the document to.
+/// @param format The format to encode the document in.
+void encodeDoc(const Document* doc, ByteBuffer& buffer, DocFormat format)
+{
+  if (format == DocFormat::Binary) {
+    encodeBinaryDoc(doc, buffer);
+  } else {
+    encodeDoc(doc, buffer);
+  }
+}
+
+} // namespace
+
+bool saveDoc(const Document* doc, const char* filename, DocFormat format)
+{
+  ByteBuffer buffer;
+
+  encodeDoc(doc, buffer, format);
+
+  if (buffer.failed()) {
+    return false;
+  }
+
+  // Text documents are opened in text mode so
+  // that line endings match the platform.
+  auto mode = (format == DocFormat::Binary) ? (std::ios::out | std::ios::binary) : std::ios::out;
+
+  std::ofstream file(filename, mode);
+  if (!file.good()) {
+    return false;
+  }
+
+  file.write(buffer.getData(), std::streamsize(buffer.getSize()));
+
+  return file.good();
+}
+
+void saveDoc(const Document* doc, void** data, std::size_t* size, DocFormat format)
+{
+  ByteBuffer buffer;
+
+  encodeDoc(doc, buffer, format);
+
+  if (buffer.failed()) {
+    throw std::bad_alloc();
+  }
+
+  // The buffer was allocated with malloc(), so
+  // it can be given to the caller without a copy.
+
+  *size = buffer.getSize();
+
+  *data = buffer.release();
+}
+
+Layer* addLayer(Document* doc)
+{
+  LayerPtr layer(new Layer());
+
+  layer->name = uniqueLayerName(doc);
+
+  layer->owner = doc;
+
+  doc->layers.emplace_back(layer);
+
+  modifyDoc(doc);
+
+  return layer.get();
+}
+
+void removeLayer(Document* doc, std::size_t layer)
+{
+  // std::vector::erase causes UB if the index
+  // is out of bounds, so we have to manually check
+  // and throw an exception if that's the case.
+
+  if (layer >= doc->layers.size()) {
+    throw std::out_of_range("Layer index is out of range");
+  }
+
+  doc->removeLayer(layer);
+
+  modifyDoc(doc);
+}
+
+Layer* getLayer(Document* doc, std::size_t layer)
+{
+  return &editLayer(doc, layer);
+}
+
+const Layer* getLayer(const Document* doc, std::size_t layer)
+{
+  return doc->layers.at(layer).get();
+}
+
+std::size_t getLayerCount(const Document* doc) noexcept
+{
+  return doc->layers.size();
+}
+
+namespace {
+
+/// Finds the topmost fill of a document that covers a pixel, by
+/// painting the document up to it. This is defined with the painter.
+///
+/// @param doc The document to search.
+/// @param p The pixel to find a fill at.
+/// @param firstLayer The layer of the first node that may be found.
+/// @param firstIndex The index of the first node that may be found.
+/// @param layer Receives the layer of the fill, if one is found.
+/// @param index Receives the index of the fill, if one is found.
+///
+/// @return True if a fill was found, false otherwise.
+bool findTopFill(const Document& doc, const Vec2& p, std::size_t firstLayer, std::size_t firstIndex, std::size_t* layer, std::size_t* index);
+
+} // namespace
+
+bool findTopNode(const Document* doc, int x, int y, std::size_t* layer, std::size_t* index)
+{
+  // The fills painted over the topmost stroke at the point may cover it.
+
+  for (auto i = doc->layers.size(); i > 0; i--) {
+
+    const auto& l = *doc->layers[i - 1];
+
+    if (l.visible && findTopNode(&l, x, y, index)) {
+
+      if (!findTopFill(*doc, Vec2 { x, y }, i - 1, *index + 1, layer, index)) {
+        *layer = i - 1;
+      }
+
+      return true;
+    }
+  }
+
+  return findTopFill(*doc, Vec2 { x, y }, 0, 0, layer, index);
+}
+
+std::size_t getDocMemoryUsage(const Document* doc, const Document* base) noexcept
+{
+  std::size_t total = sizeof(Document) + (doc->layers.capacity() * sizeof(LayerPtr));
+
+  for (const auto& layer : doc->layers) {
+
+    auto shared = false;
+
+    if (base) {
+      for (const auto& baseLayer : base->layers) {
+        shared = shared || (baseLayer == layer);
+      }
+    }
+
+    if (!shared) {
+      total += sizeof(Layer) + layer->name.capacity() + layer->nodes.memoryUsage();
+    }
+  }
+
+  return total;
+}
+
+void moveLayer(Document* doc, std::size_t src, std::size_t dst)
+{
+  LayerPtr tmp = std::move(doc->layers.at(src));
+
+  for (std::size_t i = src; i < dst; i++) {
+    doc->layers.at(i) = std::move(doc->layers.at(i + 1));
+  }
+
+  for (std::size_t i = src; i > dst; i--) {
+    doc->layers.at(i) = std::move(doc->layers.at(i - 1));
+  }
+
+  doc->layers.at(dst) = std::move(tmp);
+
+  modifyDoc(doc);
+}
+
+Ellipse* addEllipse(Document* doc, std::size_t layer)
+{
+  auto& l = editLayer(doc, layer);
+
+  modifyLayer(&l);
+
+  return l.nodes.add<Ellipse>();
+}
+
+Fill* addFill(Document* doc, std::size_t layer)
+{
+  auto& l = editLayer(doc, layer);
+
+  modifyLayer(&l);
+
+  return l.nodes.add<Fill>();
+}
+
+Line* addLine(Document* doc, std::size_t layer)
+{
+  auto& l = editLayer(doc, layer);
+
+  modifyLayer(&l);
+
+  return l.nodes.add<Line>(l.nodes.pointBuffer);
+}
+
+Quad* addQuad(Document* doc, std::size_t layer)
+{
+  auto& l = editLayer(doc, layer);
+
+  modifyLayer(&l);
+
+  return l.nodes.add<Quad>();
+}
+
+namespace {
+
+/// Adds a number of nodes of one type to a layer.
+/// Memory for all of the nodes is reserved up front,
+/// so either all of the nodes are added or none are.
+///
+/// @param nodes Receives the pointers to the new nodes.
+/// @param args The arguments to construct each node with.
+template <typename NodeType, typename... Args>
+void addNodes(Document* doc, std::size_t layer, std::size_t count, NodeType** nodes, Args&... args)
+{
+  if (!count) {
+    return;
+  }
+
+  auto& l = editLayer(doc, layer);
+
+  l.nodes.reserveNodes<NodeType>(count);
+
+  modifyLayer(&l);
+
+  for (std::size_t i = 0; i < count; i++) {
+    nodes[i] = l.nodes.add<NodeType>(args...);
+  }
+}
+
+} // namespace
+
+void addEllipses(Document* doc, std::size_t count, Ellipse** ellipses, std::size_t layer)
+{
+  addNodes(doc, layer, count, ellipses);
+}
+
+void addFills(Document* doc, std::size_t count, Fill** fills, std::size_t layer)
+{
+  addNodes(doc, layer, count, fills);
+}
+
+void addLines(Document* doc, std::size_t count, Line** lines, std::size_t layer)
+{
+  auto& l = editLayer(doc, layer);
+
+  addNodes(doc, layer, count, lines, l.nodes.pointBuffer);
+}
+
+void addQuads(Document* doc, std::size_t count, Quad** quads, std::size_t layer)
+{
+  addNodes(doc, layer, count, quads);
+}
+
+std::size_t getDocWidth(const Document* doc) noexcept { return doc->width; }
+
+std::size_t getDocHeight(const Document* doc) noexcept { return doc->height; }
+
+void getBackground(const Document* doc, float* bg) noexcept
+{
+  bg[0] = doc->background[0];
+  bg[1] = doc->background[1];
+  bg[2] = doc->background[2];
+  bg[3] = doc->background[3];
+}
+
+void resizeDoc(Document* doc, std::size_t width, std::size_t height) noexcept
+{
+  modifyDoc(doc);
+
+  doc->width = width;
+  doc->height = height;
+}
+
+void setBackground(Document* doc, float r, float g, float b, float a) noexcept
+{
+  modifyDoc(doc);
+
+  doc->background = clip(RGBA { r, g, b, a });
+}
+
+std::uint64_t getDocRevision(const Document* doc) noexcept
+{
+  return doc->revision;
+}
+
+//============================//
+// Section: Render Algorithms //
+//============================//
+
+/// This function is based on the algorithm
+/// described by John Kennedy on rasterizing
+/// an ellipse.
+///
+/// @param cx The center X component.
+/// @param cy The center Y component.
+/// @param xRadius The X radius
+/// @param yRadius The Y radius
+/// @param functor Receives the points to plot on the ellipse.
+template <typename Functor>
+void renderEllipse(int cx, int cy, int xRadius, int yRadius, Functor functor)
+{
+  if (!xRadius || !yRadius) {
+    return;
+  }
+
+  auto plot4 = [cx, cy, functor](int x, int y) {
+    functor(cx + x, cy + y);
+    functor(cx - x, cy + y);
+    functor(cx - x, cy - y);
+    functor(cx + x, cy - y);
+  };
+
+  int twoASquare = 2 * xRadius * xRadius;
+  int twoBSquare = 2 * yRadius * yRadius;
+
+  int x = xRadius;
+  int y = 0;
+
+  int xChange = yRadius * yRadius * (1 - (2 * xRadius));
+  int yChange = xRadius * xRadius;
+
+  int ellipseError = 0;
+
+  int stoppingX = twoBSquare * xRadius;
+  int stoppingY = 0;
+
+  while (stoppingX >= stoppingY) {
+
+    plot4(x, y);
+
+    y++;
+    stoppingY += twoASquare;
+    ellipseError += yChange;
+    yChange += twoASquare;
+
+    if (((2 * ellipseError) + xChange) > 0) {
+      x--;
+      stoppingX -= twoBSquare;
+      ellipseError += xChange;
+      xChange += twoBSquare;
+    }
+  }
+
+  x = 0;
+  y = yRadius;
+
+  xChange = yRadius * yRadius;
+  yChange = xRadius * xRadius * (1 - (2 * yRadius));
+
+  ellipseError = 0;
+
+  stoppingX = 0;
+  stoppingY = twoASquare * yRadius;
+
+  while (stoppingX <= stoppingY) {
+
+    plot4(x, y);
+
+    x++;
+    stoppingX += twoBSquare;
+    ellipseError += xChange;
+    xChange += twoBSquare;
+    if (((2 * ellipseError) + yChange) > 0) {
+      y--;
+      stoppingY -= twoASquare;
+      ellipseError += yChange;
+      yChange += twoASquare;
+    }
+  }
+
+  // 1st point set done
+}
+
+/// Walks the points of a line segment,
+/// using Bresenham's line algorithm.
+///
+/// @param a The first point of the line segment.
+/// @param b The last point of the line segment.
+/// @param functor Receives each point along the segment,
+/// including @p a and @p b.
+template <typename Functor>
+void renderLine(const Vec2& a, const Vec2& b, Functor functor)
+{
+  auto diff = absolute(a - b);
+
+  diff[1] = -diff[1];
+
+  int signX = (a[0] < b[0]) ? 1 : -1;
+  int signY = (a[1] < b[1]) ? 1 : -1;
+
+  int err = diff[0] + diff[1];
+
+  auto p = a;
+
+  for (;;) {
+
+    functor(p[0], p[1]);
+
+    if (p == b) {
+      break;
+    }
+
+    int err2 = 2 * err;
+
+    if (err2 >= diff[1]) {
+      err += diff[1];
+      p[0] += signX;
+    }
+
+    if (err2 <= diff[0]) {
+      err += diff[0];
+      p[1] += signY;
+    }
+  }
+}
+
+//============================//
+// Section: Stroke Rasterizer //
+//============================//
+
+namespace {
+
+/// Converts the squares plotted along a stroke into
+/// horizontal spans that do not overlap one another.
 ///
-/// @return The formatted layer name.
-std::string formatLayerName(std::size_t index)
+/// The points of a stroke are grouped into runs. A run is a
+/// sequence of connected points that moves in one direction
+/// along each axis, like a line segment or an arc of an ellipse.
+/// The squares covering a row of the image then come from a
+/// contiguous part of the run and, since neighboring points are
+/// at most one pixel apart, they cover a single span of the row.
+///
+/// Spans from different runs may still overlap, so this is only
+/// used when blending a pixel twice has the same result as blending
+/// it once.
+class StrokeRasterizer final
+{
+  /// The points of the current run.
+  std::vector<Vec2> run;
+  /// The direction that the current run is moving in.
+  /// A component is zero until the run moves along that axis.
+  Vec2 direction { 0, 0 };
+  /// The size of the squares being plotted.
+  int size = 1;
+  /// The upper left corner of the clip rectangle (inclusive.)
+  Vec2 clipMin { 0, 0 };
+  /// The lower right corner of the clip rectangle (exclusive.)
+  Vec2 clipMax { 0, 0 };
+public:
+  /// Prepares for a new stroke.
+  ///
+  /// @param pixelSize The size of the squares along the stroke.
+  /// @param cMin The upper left corner of the clip rectangle (inclusive.)
+  /// @param cMax The lower right corner of the clip rectangle (exclusive.)
+  void begin(std::size_t pixelSize, const Vec2& cMin, const Vec2& cMax) noexcept
+  {
+    size = int(pixelSize);
+    clipMin = cMin;
+    clipMax = cMax;
+    run.clear();
+    direction = Vec2 { 0, 0 };
+  }
+  /// Plots a square. The square extends up and
+  /// to the left of the point, like @ref Painter::plot.
+  ///
+  /// @param x The X coordinate of the point to plot.
+  /// @param y The Y coordinate of the point to plot.
+  /// @param functor Receives the spans of any run that is completed.
+  template <typename SpanFunctor>
+  void plot(int x, int y, SpanFunctor& functor) noexcept
+  {
+    Vec2 p { x, y };
+
+    if (!run.empty() && !continuesRun(p)) {
+      flush(functor);
+    }
+
+    try {
+      run.emplace_back(p);
+    } catch (...) {
+      // The point gets to be its own run.
+      flush(functor);
+      paintRun(&p, 1, functor);
+      return;
+    }
+
+    if (run.size() > 1) {
+      auto step = p - run[run.size() - 2];
+      direction[0] = step[0] ? step[0] : direction[0];
+      direction[1] = step[1] ? step[1] : direction[1];
+    }
+  }
+  /// Completes the stroke.
+  ///
+  /// @param functor Receives the spans of the last run.
+  template <typename SpanFunctor>
+  void finish(SpanFunctor& functor) noexcept
+  {
+    flush(functor);
+  }
+protected:
+  /// Indicates whether or not a point can be added to the current run.
+  bool continuesRun(const Vec2& p) const noexcept
+  {
+    auto step = p - run[run.size() - 1];
+
+    for (std::size_t i = 0; i < 2; i++) {
+
+      if (absolute(step[i]) > 1) {
+        return false;
+      }
+
+      if (step[i] && direction[i] && (step[i] != direction[i])) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+  /// Paints the current run and starts a new one.
+  template <typename SpanFunctor>
+  void flush(SpanFunctor& functor) noexcept
+  {
+    paintRun(run.data(), run.size(), functor);
+    run.clear();
+    direction = Vec2 { 0, 0 };
+  }
+  /// Passes the spans of a run to a functor.
+  ///
+  /// @param points The points of the run.
+  /// @param count The number of points in the run.
+  /// @param functor Receives the row, the first pixel
+  /// and one passed the last pixel of each span.
+  template <typename SpanFunctor>
+  void paintRun(const Vec2* points, std::size_t count, SpanFunctor& functor) noexcept
+  {
+    if (!count) {
+      return;
+    }
+
+    // Points are visited so that Y is increasing.
+    // X is then either increasing or decreasing.
+
+    auto yReversed = points[count - 1][1] < points[0][1];
+
+    auto at = [points, count, yReversed](std::size_t i) noexcept {
+      return points[yReversed ? (count - 1 - i) : i];
+    };
+
+    auto xReversed = at(count - 1)[0] < at(0)[0];
+
+    int yFirst = max(at(0)[1] - size + 1, clipMin[1]);
+    int yLast = min(at(count - 1)[1] + 1, clipMax[1]);
+
+    // The squares covering a row are between 'lo' and 'hi'.
+    std::size_t lo = 0;
+    std::size_t hi = 0;
+
+    for (int y = yFirst; y < yLast; y++) {
+
+      while ((lo < count) && (at(lo)[1] < y)) {
+        lo++;
+      }
+
+      while ((hi < count) && (at(hi)[1] < (y + size))) {
+        hi++;
+      }
+
+      auto left = xReversed ? at(hi - 1)[0] : at(lo)[0];
+      auto right = xReversed ? at(lo)[0] : at(hi - 1)[0];
+
+      auto x1 = max(left - size + 1, clipMin[0]);
+      auto x2 = min(right + 1, clipMax[0]);
+
+      if (x1 < x2) {
+        functor(y, x1, x2);
+      }
+    }
+  }
+};
+
+} // namespace
+
+//=====================//
+// Section: Flood Fill //
+//=====================//
+
+namespace {
+
+/// Counts the trailing zero bits of a word.
+///
+/// @param w The word to count the bits of. This must not be zero.
+inline int countTrailingZeros(std::uint64_t w) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(w);
+#else
+  int n = 0;
+  while (!(w & 1)) {
+    w >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/// Counts the leading zero bits of a word.
+///
+/// @param w The word to count the bits of. This must not be zero.
+inline int countLeadingZeros(std::uint64_t w) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_clzll(w);
+#else
+  int n = 0;
+  while (!(w & (std::uint64_t(1) << 63))) {
+    w <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/// The minimum number of pixels in the region of a fill
+/// for it to be searched or painted with several threads.
+constexpr std::size_t minParallelFillSize() noexcept { return 1 << 20; }
+
+/// Calls a function for a number of tasks,
+/// spreading the tasks across several threads.
+///
+/// @param taskCount The number of tasks to run.
+/// @param threadCount The maximum number of threads to run them on.
+/// This includes the calling thread.
+/// @param func Receives the index of each task.
+template <typename TaskFunctor>
+void runTasks(std::size_t taskCount, std::size_t threadCount, TaskFunctor func) noexcept
+{
+  std::atomic<std::size_t> nextTask { 0 };
+
+  auto worker = [taskCount, &nextTask, &func]() noexcept {
+    for (;;) {
+
+      auto task = nextTask++;
+      if (task >= taskCount) {
+        break;
+      }
+
+      func(task);
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  try {
+    for (std::size_t i = 1; (i < threadCount) && (i < taskCount); i++) {
+      threads.emplace_back(worker);
+    }
+  } catch (...) {
+    // Any tasks not taken by the threads that
+    // did start are run on the calling thread.
+  }
+
+  worker();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/// Mixes a word into one lane of a hash.
+inline std::uint64_t mixHash(std::uint64_t h, std::uint64_t word) noexcept
+{
+  h ^= word * 0x9e3779b97f4a7c15ull;
+  h = (h << 31) | (h >> 33);
+  return h * 0xbf58476d1ce4e5b9ull;
+}
+
+/// Hashes the pixels within a rectangle of a color buffer.
+/// This is used to tell if the pixels that decided the region
+/// of a fill have changed since the region was found.
+///
+/// @param c The color buffer containing the pixels.
+/// @param w The width of the color buffer, in pixels.
+/// @param y The first row of the image in the color buffer.
+/// @param pMin The upper left corner of the rectangle.
+/// @param pMax The lower right corner of the rectangle (exclusive.)
+///
+/// @return The hash of the pixels.
+std::uint64_t hashPixels(const float* c, std::size_t w, std::size_t y, const Vec2& pMin, const Vec2& pMax) noexcept
+{
+  // Each pixel is two words. Four lanes are used,
+  // so that the multiplications can overlap.
+  std::uint64_t lanes[4] {
+    0x243f6a8885a308d3ull,
+    0x13198a2e03707344ull,
+    0xa4093822299f31d0ull,
+    0x082efa98ec4e6c89ull
+  };
+
+  auto wordCount = std::size_t(pMax[0] - pMin[0]) * 2;
+
+  for (auto row = pMin[1]; row < pMax[1]; row++) {
+
+    const auto* src = reinterpret_cast<const unsigned char*>(&c[((std::size_t(row) - y) * w + std::size_t(pMin[0])) * 4]);
+
+    std::uint64_t words[4];
+
+    std::size_t i = 0;
+
+    for (; (i + 4) <= wordCount; i += 4) {
+
+      std::memcpy(words, src + (i * 8), sizeof(words));
+
+      for (std::size_t j = 0; j < 4; j++) {
+        lanes[j] = mixHash(lanes[j], words[j]);
+      }
+    }
+
+    for (; i < wordCount; i++) {
+      std::memcpy(words, src + (i * 8), 8);
+      lanes[i % 4] = mixHash(lanes[i % 4], words[0]);
+    }
+  }
+
+  auto h = lanes[0] ^ mixHash(lanes[1], lanes[2]) ^ mixHash(lanes[3], wordCount);
+
+  // Spreads the bits of the result, like the
+  // finalizer of the SplitMix64 generator.
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+
+  return h ^ (h >> 31);
+}
+
+/// Finds the pixels covered by a fill.
+///
+/// Each pixel is tested against the color of the origin once, when its
+/// row is first reached, and the result is kept as one bit per pixel.
+/// A bit is cleared as soon as its pixel is added to a span, and the
+/// pixel is marked in a bitmap of visited pixels. The region is found
+/// one span at a time, using a stack of spans whose neighboring rows
+/// haven't been searched yet.
+///
+/// The region is searched for entirely within the bitmaps, which are
+/// small enough to stay in the cache. The spans are only listed once
+/// the search is done, in order from the top row to the bottom one, so
+/// that the color buffer is accessed sequentially when they're painted.
+/// Since each pixel is visited once, no spans overlap.
+///
+/// When a region turns out to have more pixels than a few threads are
+/// worth, the search gives up and the region is found with several
+/// threads instead, from the rows computed so far. The image is split into bands of rows and the runs of
+/// matching pixels in each band are connected on their own, with a
+/// union-find structure. The bands are then connected to each other,
+/// at their borders, and the runs that are connected to the origin
+/// are listed. Since runs are connected when they touch vertically,
+/// this finds exactly the same pixels as the search from the origin.
+class FloodFill final
+{
+  /// The bits of the pixels that match the origin and haven't
+  /// been visited yet, with @ref FloodFill::wordsPerRow words per row.
+  std::vector<std::uint64_t> open;
+  /// The bits of the pixels that have been visited.
+  std::vector<std::uint64_t> visited;
+  /// Whether or not each row of @ref FloodFill::open has been computed.
+  std::vector<unsigned char> rowReady;
+  /// A band of rows that is searched on its own thread.
+  struct Band final
+  {
+    /// The first row of the band.
+    int y1 = 0;
+    /// One passed the last row of the band.
+    int y2 = 0;
+    /// The runs of matching pixels in the band, row by row.
+    std::vector<FillSpan> runs;
+    /// The index of the first run in each row, followed
+    /// by the total number of runs in the band.
+    std::vector<std::size_t> rowStart;
+    /// The index of the first run of the band,
+    /// among the runs of all of the bands.
+    std::size_t offset = 0;
+  };
+  /// The spans whose neighboring rows have yet to be searched.
+  std::vector<FillSpan> stack;
+  /// The number of pixels found by the serial search so far.
+  std::size_t regionSize = 0;
+  /// The bands of a parallel search.
+  std::vector<Band> bands;
+  /// The parent of each run in a parallel search,
+  /// indexed by the position of the run among all bands.
+  /// A run that is its own parent is the root of its set.
+  std::vector<std::size_t> parent;
+  /// The maximum number of threads to search with.
+  std::size_t threadCount = 1;
+  /// The color buffer being searched.
+  const float* colorBuffer = nullptr;
+  /// The width of the color buffer, in pixels.
+  int width = 0;
+  /// The first row in the color buffer.
+  int firstRow = 0;
+  /// One passed the last row in the color buffer.
+  int lastRow = 0;
+  /// The number of words used for each row.
+  std::size_t wordsPerRow = 0;
+  /// The color of the pixels that are part of the region.
+  RGBA prev = transparent();
+public:
+  /// Finds the region of pixels that are connected to the origin
+  /// and are almost equal in color to it.
+  ///
+  /// @param c The color buffer to search.
+  /// @param w The width of the image, in pixels.
+  /// @param y The first row of the image in the color buffer.
+  /// @param h The height of the image, in pixels.
+  /// @param origin The point to start at. This must be within the color buffer.
+  /// @param spans Receives the spans of the region, in order from the top
+  /// row to the bottom row. Any spans already in the vector are removed.
+  void fill(const float* c, std::size_t w, std::size_t y, std::size_t h, const Vec2& origin, std::vector<FillSpan>& spans)
+  {
+    colorBuffer = c;
+    width = int(w);
+    firstRow = int(y);
+    lastRow = int(h);
+    wordsPerRow = (w + 63) / 64;
+
+    prev = pixel(origin[0], origin[1]);
+
+    open.resize(wordsPerRow * (h - y));
+
+    rowReady.assign(h - y, 0);
+
+    spans.clear();
+
+    // Most fills cover a small part of the image, so the search starts
+    // on the calling thread and only moves to several threads once the
+    // region turns out to be large. The rows searched so far are kept.
+
+    auto limit = std::numeric_limits<std::size_t>::max();
+
+    if ((threadCount > 1) && ((w * (h - y)) >= minParallelFillSize())) {
+      limit = minParallelFillSize();
+    }
+
+    if (fillSerial(origin, spans, limit)) {
+      return;
+    }
+
+    reopenVisited();
+
+    if (fillParallel(origin, spans)) {
+      return;
+    }
+
+    fillSerial(origin, spans, std::numeric_limits<std::size_t>::max());
+  }
+  /// Sets the maximum number of threads that fills are searched with.
+  ///
+  /// @param count The maximum number of threads, including the calling thread.
+  inline void setThreadCount(std::size_t count) noexcept
+  {
+    threadCount = count ? count : 1;
+  }
+protected:
+  /// Searches for the region from the origin on the calling thread.
+  ///
+  /// @param origin The point to start at.
+  /// @param spans Receives the spans of the region.
+  /// @param limit The number of pixels to find before giving up.
+  ///
+  /// @return True if the region was found, false if it
+  /// has more pixels than @p limit and the search gave up.
+  bool fillSerial(const Vec2& origin, std::vector<FillSpan>& spans, std::size_t limit)
+  {
+    visited.assign(open.size(), 0);
+
+    stack.clear();
+
+    regionSize = 0;
+
+    if (!testBit(prepareRow(origin[1]), origin[0])) {
+      // The origin has a color that isn't equal to itself.
+      return true;
+    }
+
+    addSpan(origin[1], origin[0]);
+
+    while (!stack.empty()) {
+
+      if (regionSize > limit) {
+        return false;
+      }
+
+      auto s = stack.back();
+
+      stack.pop_back();
+
+      if (s.y > firstRow) {
+        searchRow(s.y - 1, s.x1, s.x2);
+      }
+
+      if ((s.y + 1) < lastRow) {
+        searchRow(s.y + 1, s.x1, s.x2);
+      }
+    }
+
+    for (int row = firstRow; row < lastRow; row++) {
+
+      if (!rowReady[std::size_t(row - firstRow)]) {
+        continue;
+      }
+
+      const auto* bits = &visited[std::size_t(row - firstRow) * wordsPerRow];
+
+      auto x1 = findNext(bits, 0, width, 0);
+
+      while (x1 < width) {
+
+        auto x2 = findNext(bits, x1, width, ~std::uint64_t(0));
+
+        spans.emplace_back(FillSpan { row, x1, x2 });
+
+        x1 = findNext(bits, x2, width, 0);
+      }
+    }
+
+    return true;
+  }
+  /// Sets the bits of the pixels visited by a search that gave up
+  /// again, so that the rows it computed can be searched once more.
+  void reopenVisited() noexcept
+  {
+    for (std::size_t i = 0; i < open.size(); i++) {
+      open[i] |= visited[i];
+    }
+  }
+  /// Searches for the region with several threads.
+  ///
+  /// @param origin The point to start at.
+  /// @param spans Receives the spans of the region.
+  ///
+  /// @return True if the region was found, false if memory ran out.
+  bool fillParallel(const Vec2& origin, std::vector<FillSpan>& spans)
+  {
+    auto rowCount = std::size_t(lastRow - firstRow);
+
+    // A few bands per thread keeps the threads busy
+    // when some bands have more runs than others.
+    auto bandCount = min(rowCount, threadCount * 4);
+
+    try {
+      bands.resize(bandCount);
+    } catch (...) {
+      return false;
+    }
+
+    for (std::size_t i = 0; i < bandCount; i++) {
+      bands[i].y1 = firstRow + int((i * rowCount) / bandCount);
+      bands[i].y2 = firstRow + int(((i + 1) * rowCount) / bandCount);
+    }
+
+    std::atomic<bool> failed { false };
+
+    runTasks(bandCount, threadCount, [this, &failed](std::size_t i) noexcept {
+      try {
+        findRuns(bands[i]);
+      } catch (...) {
+        failed = true;
+      }
+    });
+
+    if (failed) {
+      return false;
+    }
+
+    std::size_t runCount = 0;
+
+    for (auto& band : bands) {
+      band.offset = runCount;
+      runCount += band.runs.size();
+    }
+
+    try {
+      parent.resize(runCount);
+    } catch (...) {
+      return false;
+    }
+
+    runTasks(bandCount, threadCount, [this](std::size_t i) noexcept {
+      connectBand(bands[i]);
+    });
+
+    for (std::size_t i = 1; i < bandCount; i++) {
+
+      const auto& upper = bands[i - 1];
+      const auto& lower = bands[i];
+
+      connectRows(upper, std::size_t(upper.y2 - upper.y1 - 1), lower, 0);
+    }
+
+    auto originRun = findRun(origin);
+    if (originRun == runCount) {
+      // The origin has a color that isn't equal to itself.
+      return true;
+    }
+
+    auto originRoot = rootOf(originRun);
+
+    // The runs of each band are narrowed down, in place,
+    // to the runs that are connected to the origin.
+
+    runTasks(bandCount, threadCount, [this, originRoot](std::size_t i) noexcept {
+
+      auto& band = bands[i];
+
+      std::size_t count = 0;
+
+      for (std::size_t j = 0; j < band.runs.size(); j++) {
+        if (rootOf(band.offset + j) == originRoot) {
+          band.runs[count++] = band.runs[j];
+        }
+      }
+
+      band.runs.resize(count);
+    });
+
+    std::size_t spanCount = 0;
+
+    for (const auto& band : bands) {
+      spanCount += band.runs.size();
+    }
+
+    try {
+      spans.reserve(spanCount);
+    } catch (...) {
+      return false;
+    }
+
+    for (const auto& band : bands) {
+      spans.insert(spans.end(), band.runs.begin(), band.runs.end());
+    }
+
+    return true;
+  }
+  /// Finds the runs of matching pixels in a band.
+  ///
+  /// @param band The band to find the runs of.
+  void findRuns(Band& band)
+  {
+    band.runs.clear();
+    band.rowStart.clear();
+
+    for (int y = band.y1; y < band.y2; y++) {
+
+      band.rowStart.emplace_back(band.runs.size());
+
+      const auto* row = prepareRow(y);
+
+      auto x1 = findNext(row, 0, width, 0);
+
+      while (x1 < width) {
+
+        auto x2 = findNext(row, x1, width, ~std::uint64_t(0));
+
+        band.runs.emplace_back(FillSpan { y, x1, x2 });
+
+        x1 = findNext(row, x2, width, 0);
+      }
+    }
+
+    band.rowStart.emplace_back(band.runs.size());
+  }
+  /// Connects the runs within a band. Only the parents of the
+  /// band's own runs are modified, so bands can be connected
+  /// at the same time.
+  ///
+  /// @param band The band to connect the runs of.
+  void connectBand(const Band& band) noexcept
+  {
+    for (std::size_t i = 0; i < band.runs.size(); i++) {
+      parent[band.offset + i] = band.offset + i;
+    }
+
+    for (std::size_t row = 1; row < (band.rowStart.size() - 1); row++) {
+      connectRows(band, row - 1, band, row);
+    }
+
+    // Since a root always has the smallest index of its set, every
+    // parent comes before its child and has already been compressed.
+
+    for (std::size_t i = 0; i < band.runs.size(); i++) {
+      auto& p = parent[band.offset + i];
+      p = parent[p];
+    }
+  }
+  /// Connects the runs of two neighboring rows that touch.
+  ///
+  /// @param upper The band containing the upper row.
+  /// @param upperRow The upper row, relative to the first row of its band.
+  /// @param lower The band containing the lower row.
+  /// @param lowerRow The lower row, relative to the first row of its band.
+  void connectRows(const Band& upper, std::size_t upperRow, const Band& lower, std::size_t lowerRow) noexcept
+  {
+    auto a = upper.rowStart[upperRow];
+    auto aEnd = upper.rowStart[upperRow + 1];
+
+    auto b = lower.rowStart[lowerRow];
+    auto bEnd = lower.rowStart[lowerRow + 1];
+
+    while ((a < aEnd) && (b < bEnd)) {
+
+      const auto& runA = upper.runs[a];
+      const auto& runB = lower.runs[b];
+
+      if (runA.x2 <= runB.x1) {
+        a++;
+        continue;
+      } else if (runB.x2 <= runA.x1) {
+        b++;
+        continue;
+      }
+
+      connect(upper.offset + a, lower.offset + b);
+
+      if (runA.x2 < runB.x2) {
+        a++;
+      } else {
+        b++;
+      }
+    }
+  }
+  /// Merges the sets of two runs.
+  /// The root with the smaller index becomes the root of both.
+  void connect(std::size_t a, std::size_t b) noexcept
+  {
+    a = compressRoot(a);
+    b = compressRoot(b);
+
+    if (a < b) {
+      parent[b] = a;
+    } else if (b < a) {
+      parent[a] = b;
+    }
+  }
+  /// Finds the root of a run, shortening
+  /// the path to the root along the way.
+  std::size_t compressRoot(std::size_t i) noexcept
+  {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+
+    return i;
+  }
+  /// Finds the root of a run without modifying the
+  /// parents, so that it may be called from several threads.
+  std::size_t rootOf(std::size_t i) const noexcept
+  {
+    while (parent[i] != i) {
+      i = parent[i];
+    }
+
+    return i;
+  }
+  /// Finds the run containing a pixel.
+  ///
+  /// @return The index of the run, among all bands. If the pixel
+  /// isn't in a run, the total number of runs is returned.
+  std::size_t findRun(const Vec2& p) const noexcept
+  {
+    for (const auto& band : bands) {
+
+      if ((p[1] < band.y1) || (p[1] >= band.y2)) {
+        continue;
+      }
+
+      auto row = std::size_t(p[1] - band.y1);
+
+      for (auto i = band.rowStart[row]; i < band.rowStart[row + 1]; i++) {
+        if ((band.runs[i].x1 <= p[0]) && (p[0] < band.runs[i].x2)) {
+          return band.offset + i;
+        }
+      }
+    }
+
+    return parent.size();
+  }
+  /// Adds the spans of a row that touch a range of pixels.
+  ///
+  /// @param y The row to search.
+  /// @param x1 The first pixel of the range.
+  /// @param x2 One passed the last pixel of the range.
+  void searchRow(int y, int x1, int x2)
+  {
+    const auto* row = prepareRow(y);
+
+    auto x = findNext(row, x1, x2, 0);
+
+    while (x < x2) {
+      x = findNext(row, addSpan(y, x), x2, 0);
+    }
+  }
+  /// Adds the span that contains an open pixel.
+  ///
+  /// @param y The row of the pixel.
+  /// @param x The column of the pixel.
+  ///
+  /// @return One passed the last pixel of the span.
+  int addSpan(int y, int x)
+  {
+    auto offset = std::size_t(y - firstRow) * wordsPerRow;
+
+    auto* row = &open[offset];
+
+    auto x1 = findRunStart(row, x);
+    auto x2 = findNext(row, x, width, ~std::uint64_t(0));
+
+    flipBits(row, x1, x2);
+    flipBits(&visited[offset], x1, x2);
+
+    stack.emplace_back(FillSpan { y, x1, x2 });
+
+    regionSize += std::size_t(x2 - x1);
+
+    return x2;
+  }
+  /// Computes the bits of a row, if they haven't been computed yet.
+  ///
+  /// @param y The row to compute the bits of.
+  ///
+  /// @return The bits of the row.
+  std::uint64_t* prepareRow(int y) noexcept
+  {
+    auto* row = &open[std::size_t(y - firstRow) * wordsPerRow];
+
+    auto& ready = rowReady[std::size_t(y - firstRow)];
+    if (ready) {
+      return row;
+    }
+
+    ready = 1;
+
+    for (std::size_t i = 0; i < wordsPerRow; i++) {
+
+      auto x1 = int(i * 64);
+      auto x2 = min(x1 + 64, width);
+
+      std::uint64_t word = 0;
+
+      for (int x = x1; x < x2; x++) {
+        word |= std::uint64_t(almostEqual(pixel(x, y), prev)) << (x - x1);
+      }
+
+      row[i] = word;
+    }
+
+    return row;
+  }
+  /// Finds the first pixel in a range whose bit is set.
+  ///
+  /// @param row The bits of the row to search.
+  /// @param x The first pixel of the range.
+  /// @param limit One passed the last pixel of the range.
+  /// @param flip Is combined with each word, using exclusive or,
+  /// so that all bits set can be used to find a bit that is clear.
+  ///
+  /// @return The pixel that was found, or @p limit if there is none.
+  int findNext(const std::uint64_t* row, int x, int limit, std::uint64_t flip) const noexcept
+  {
+    if (x >= limit) {
+      return limit;
+    }
+
+    auto i = std::size_t(x / 64);
+
+    auto word = (row[i] ^ flip) & (~std::uint64_t(0) << (x % 64));
+
+    while (!word) {
+
+      i++;
+
+      if (int(i * 64) >= limit) {
+        return limit;
+      }
+
+      word = row[i] ^ flip;
+    }
+
+    return min(int(i * 64) + countTrailingZeros(word), limit);
+  }
+  /// Finds the first pixel of the run of set bits that ends at a pixel.
+  ///
+  /// @param row The bits of the row to search.
+  /// @param x A pixel whose bit is set.
+  ///
+  /// @return The first pixel of the run.
+  int findRunStart(const std::uint64_t* row, int x) const noexcept
+  {
+    auto i = std::size_t(x / 64);
+
+    auto word = ~row[i] & ((std::uint64_t(1) << (x % 64)) - 1);
+
+    while (!word) {
+
+      if (!i) {
+        return 0;
+      }
+
+      word = ~row[--i];
+    }
+
+    return int(i * 64) + (63 - countLeadingZeros(word)) + 1;
+  }
+  /// Flips the bits of a range of pixels.
+  ///
+  /// @param row The bits of the row to modify.
+  /// @param x1 The first pixel of the range.
+  /// @param x2 One passed the last pixel of the range.
+  void flipBits(std::uint64_t* row, int x1, int x2) noexcept
+  {
+    while (x1 < x2) {
+
+      auto i = std::size_t(x1 / 64);
+
+      auto count = min(x2 - x1, 64 - (x1 % 64));
+
+      auto mask = (count == 64) ? ~std::uint64_t(0) : (((std::uint64_t(1) << count) - 1) << (x1 % 64));
+
+      row[i] ^= mask;
+
+      x1 += count;
+    }
+  }
+  /// Indicates whether or not the bit of a pixel is set.
+  inline static bool testBit(const std::uint64_t* row, int x) noexcept
+  {
+    return (row[x / 64] >> (x % 64)) & 1;
+  }
+  /// Gets the color of a pixel.
+  inline RGBA pixel(int x, int y) const noexcept
+  {
+    const float* src = &colorBuffer[((std::size_t(y - firstRow) * std::size_t(width)) + std::size_t(x)) * 4];
+
+    return RGBA { src[0], src[1], src[2], src[3] };
+  }
+};
+
+} // namespace
+
+//================================//
+// Section: Display List Commands //
+//================================//
+
+namespace {
+
+/// A horizontal span of pixels that
+/// a display list blends a color across.
+struct DisplaySpan final
+{
+  /// The row of the span.
+  int y;
+  /// The first pixel of the span.
+  int x1;
+  /// One passed the last pixel of the span.
+  int x2;
+};
+
+/// A run of commands in a display list that share a style.
+/// A run either blends a color across a range of spans
+/// or paints a fill.
+struct DisplayRun final
+{
+  /// The blend mode of the run.
+  BlendMode blendMode = BlendMode::Normal;
+  /// The color of the run, with the layer opacity applied.
+  Color color = Color(transparent());
+  /// The first span of the run.
+  std::size_t firstSpan = 0;
+  /// One passed the last span of the run.
+  std::size_t lastSpan = 0;
+  /// The index of the fill painted by the run,
+  /// or @ref DisplayRun::noFill for a run of spans.
+  std::size_t fill = noFill();
+  /// Indicates that a run does not paint a fill.
+  static constexpr std::size_t noFill() noexcept
+  {
+    return std::numeric_limits<std::size_t>::max();
+  }
+};
+
+/// The commands compiled from a single layer.
+/// Strokes are recorded as the spans of pixels that they blend,
+/// in the order that they're blended. Fills depend on the pixels
+/// painted before them, so they're kept as nodes and painted when
+/// the commands are replayed.
+struct LayerCommands final
+{
+  /// The key of the layer that was compiled,
+  /// which includes the opacity of the layer.
+  std::uint64_t key = 0;
+  /// The opacity of the layer that was compiled.
+  float opacity = 1;
+  /// The spans of every run, in painting order.
+  std::vector<DisplaySpan> spans;
+  /// The runs of the layer, in painting order.
+  std::vector<DisplayRun> runs;
+  /// Copies of the fills in the layer. Each copy keeps
+  /// its own region, so it is reused between replays.
+  std::vector<Fill> fills;
+  /// Whether or not a command failed to be recorded,
+  /// because memory couldn't be allocated for it.
+  bool failed = false;
+  /// Records a span of pixels.
+  /// A span that continues the last span on the
+  /// same row, with the same style, is merged into it.
+  ///
+  /// @param mode The blend mode of the span.
+  /// @param color The color blended across the span.
+  /// @param y The row of the span.
+  /// @param x1 The first pixel of the span.
+  /// @param x2 One passed the last pixel of the span.
+  void addSpan(BlendMode mode, const Color& color, int y, int x1, int x2) noexcept
+  {
+    try {
+
+      if (!hasStyle(mode, color)) {
+        DisplayRun run;
+        run.blendMode = mode;
+        run.color = color;
+        run.firstSpan = spans.size();
+        run.lastSpan = spans.size();
+        runs.emplace_back(run);
+      }
+
+      auto& run = runs.back();
+
+      if (run.lastSpan > run.firstSpan) {
+        auto& last = spans.back();
+        if ((last.y == y) && (last.x2 == x1)) {
+          last.x2 = x2;
+          return;
+        }
+      }
+
+      spans.emplace_back(DisplaySpan { y, x1, x2 });
+
+      run.lastSpan = spans.size();
+
+    } catch (...) {
+      failed = true;
+    }
+  }
+  /// Records a fill.
+  ///
+  /// @param fill The fill to record.
+  void addFill(const Fill& fill) noexcept
+  {
+    try {
+
+      fills.emplace_back(fill);
+
+      DisplayRun run;
+      run.firstSpan = spans.size();
+      run.lastSpan = spans.size();
+      run.fill = fills.size() - 1;
+      runs.emplace_back(run);
+
+    } catch (...) {
+      failed = true;
+    }
+  }
+protected:
+  /// Indicates whether or not the last run
+  /// is a run of spans with a certain style.
+  ///
+  /// @param mode The blend mode of the style.
+  /// @param color The color of the style.
+  bool hasStyle(BlendMode mode, const Color& color) const noexcept
+  {
+    if (runs.empty()) {
+      return false;
+    }
+
+    const auto& run = runs.back();
+
+    return (run.fill == DisplayRun::noFill())
+        && (run.blendMode == mode)
+        && (run.color.original[0] == color.original[0])
+        && (run.color.original[1] == color.original[1])
+        && (run.color.original[2] == color.original[2])
+        && (run.color.original[3] == color.original[3]);
+  }
+};
+
+} // namespace
+
+//==================//
+// Section: Painter //
+//==================//
+
+#ifdef LIBPX_BENCH
+
+namespace {
+
+/// Whether or not strokes may be painted as spans. The benchmarks
+/// turn this off to compare the spans against the square stamps.
+/// This is shared by all documents.
+inline std::atomic<bool>& strokeSpansEnabled() noexcept
 {
-  std::stringstream stream;
-  stream << "Layer ";
-  stream << index;
-  return stream.str();
+  static std::atomic<bool> enabled { true };
+
+  return enabled;
+}
+
+} // namespace
+
+/// This is declared by the benchmarks, instead of the public header.
+void setStrokeSpans(bool enabled) noexcept
+{
+  strokeSpansEnabled() = enabled;
 }
 
-/// Generates a unique layer name.
-///
-/// @param doc The document to generate the layer name for.
-///
-/// @return The unique layer name.
-std::string uniqueLayerName(const Document* doc)
-{
-  for (std::size_t i = doc->layers.size() + 1; i < SIZE_MAX; i++) {
+#else // LIBPX_BENCH
+
+namespace {
+
+/// Strokes are always painted as spans where possible.
+constexpr bool strokeSpansEnabled() noexcept { return true; }
+
+} // namespace
+
+#endif // LIBPX_BENCH
+
+/// Used for rasterizing the document.
+class Painter final : public NodeAccessor
+{
+  /// The current pixel size.
+  std::size_t pixelSize = 1;
+  /// The blend mode of the painter.
+  BlendMode blendMode = BlendMode::Normal;
+  /// The current material used to paint with.
+  Color primaryColor = RGBA { 0, 0, 0, 0 };
+  /// The current layer opacity.
+  float layerOpacity = 1.0f;
+  /// The color of the last stroke that was painted, before
+  /// the layer opacity was applied to it. Only valid when
+  /// @ref Painter::hasStrokeStyle is true.
+  RGBA strokeColor = transparent();
+  /// Whether or not the painter state still has the style of the
+  /// last stroke. Nodes are often painted with the same style as
+  /// the node before them, in which case the state is kept as is.
+  bool hasStrokeStyle = false;
+  /// Whether or not strokes are painted with spans,
+  /// which only changes when the stroke style does.
+  bool spanMode = false;
+  /// The color buffer being rendered to.
+  float* colorBuffer = nullptr;
+  /// The width of the color buffer, in pixels.
+  std::size_t width = 0;
+  /// The height of the color buffer, in pixels.
+  /// This includes the rows before @ref Painter::firstRow.
+  std::size_t height = 0;
+  /// The row of the image that the first
+  /// row of the color buffer contains.
+  std::size_t firstRow = 0;
+  /// The upper left corner of the area that may
+  /// be painted on. This is inclusive.
+  Vec2 clipMin { 0, 0 };
+  /// The lower right corner of the area that may
+  /// be painted on. This is exclusive.
+  Vec2 clipMax { 0, 0 };
+  /// Converts thick strokes into spans.
+  StrokeRasterizer rasterizer;
+  /// Finds the pixels covered by fills.
+  FloodFill floodFill;
+  /// The points of the last ellipse that was traced,
+  /// in the order that the ellipse algorithm plots them.
+  std::vector<Vec2> ellipsePoints;
+  /// The maximum number of threads to paint fills with.
+  std::size_t threadCount = 1;
+  /// When not null, the spans that would be blended are
+  /// recorded here instead of being painted. Fills can't be
+  /// recorded this way and have to be recorded by the caller.
+  LayerCommands* recorder = nullptr;
+  /// Whether or not a fill was found to depend on pixels outside
+  /// of the clip rectangle, in which case the region it found may
+  /// be wrong and the pixels outside of the clip may be out of date.
+  bool fillEscapedClip = false;
+  /// The ID of the document being rendered, which is kept
+  /// with the regions that fills find. This is zero when the
+  /// painter isn't given the document it renders.
+  std::uint64_t docID = 0;
+public:
+  /// Constructs a new painter.
+  ///
+  /// @param c The color buffer to paint on.
+  /// @param w The width of the image, in pixels.
+  /// @param h The height of the image, in pixels.
+  /// @param y The first row of the image that is contained by
+  /// the color buffer. When this is not zero, the color buffer
+  /// only contains the rows from @p y to @p h.
+  Painter(float* c, std::size_t w, std::size_t h, std::size_t y = 0)
+    : colorBuffer(c), width(w), height(h), firstRow(y), clipMin { 0, int(y) }, clipMax { int(w), int(h) } {}
+  /// Restricts painting to a rectangle within the color buffer.
+  /// Pixels outside of the rectangle are never modified.
+  ///
+  /// @param x1 The left side of the rectangle (inclusive.)
+  /// @param y1 The top side of the rectangle (inclusive.)
+  /// @param x2 The right side of the rectangle (exclusive.)
+  /// @param y2 The bottom side of the rectangle (exclusive.)
+  void setClip(int x1, int y1, int x2, int y2) noexcept
+  {
+    clipMin = max(Vec2 { x1, y1 }, Vec2 { 0, int(firstRow) });
+    clipMax = min(Vec2 { x2, y2 }, Vec2 { int(width), int(height) });
+  }
+  /// Sets the ID of the document being rendered. The regions that
+  /// fills find are only reused by a clipped render of the same
+  /// document, since that's the one whose pixels are in the buffer.
+  void setDocID(std::uint64_t id) noexcept
+  {
+    docID = id;
+  }
+  /// Indicates whether or not a fill was painted from
+  /// pixels outside of the clip rectangle. When this happens,
+  /// the clipped render has to be replaced by a full one.
+  ///
+  /// @return True if a fill reached outside of the clip, false otherwise.
+  bool hasFillEscapedClip() const noexcept
+  {
+    return fillEscapedClip;
+  }
+  /// Renders an ellipse.
+  void access(const Ellipse& ellipse) noexcept override
+  {
+    // Padded by one pixel, in case the rasterizer
+    // steps slightly passed the radius.
+    auto r = absolute(ellipse.radius) + 1;
+
+    if (!overlapsClip(ellipse.center - r, ellipse.center + r, ellipse.pixelSize)) {
+      return;
+    }
+
+    setStrokeStyle(ellipse);
+
+    // When spans are used, the points of the ellipse are passed to
+    // the stroke rasterizer one quadrant at a time, so that it gets
+    // connected arcs. The ellipse algorithm plots the quadrants in
+    // turn, so the points are traced once and then taken four apart.
+
+    auto tracer = [this, &ellipse](auto plotter) {
+
+      if (!usesSpans()) {
+        renderEllipse(ellipse.center[0],
+                      ellipse.center[1],
+                      ellipse.radius[0],
+                      ellipse.radius[1],
+                      plotter);
+        return;
+      }
+
+      if (traceEllipse(ellipse)) {
+
+        auto count = ellipsePoints.size();
+
+        for (std::size_t quadrant = 0; quadrant < 4; quadrant++) {
+          for (auto i = quadrant; i < count; i += 4) {
+            plotter(ellipsePoints[i][0], ellipsePoints[i][1]);
+          }
+        }
+
+        return;
+      }
+
+      // Without the memory to buffer the points,
+      // the ellipse is traced once per quadrant.
+
+      for (int quadrant = 0; quadrant < 4; quadrant++) {
+
+        int i = 0;
+
+        auto quadrantPlotter = [plotter, quadrant, &i](int x, int y) {
+          if (((i++) % 4) == quadrant) {
+            plotter(x, y);
+          }
+        };
+
+        renderEllipse(ellipse.center[0],
+                      ellipse.center[1],
+                      ellipse.radius[0],
+                      ellipse.radius[1],
+                      quadrantPlotter);
+      }
+    };
+
+    paintStroke(tracer);
+  }
+  /// Traces the points of an ellipse into @ref Painter::ellipsePoints.
+  ///
+  /// @return True on success, false if there wasn't enough memory.
+  bool traceEllipse(const Ellipse& ellipse) noexcept
+  {
+    ellipsePoints.clear();
+
+    try {
+      renderEllipse(ellipse.center[0],
+                    ellipse.center[1],
+                    ellipse.radius[0],
+                    ellipse.radius[1],
+                    [this](int x, int y) { ellipsePoints.emplace_back(Vec2 { x, y }); });
+    } catch (...) {
+      return false;
+    }
+
+    return true;
+  }
+  /// Fills an area on the image
+  /// with a certain color.
+  void access(const Fill& fill) noexcept override
+  {
+    if (!inBounds(fill.origin)) {
+      return;
+    }
+
+    blendMode = fill.blendMode;
+
+    auto prev = getPixel(fill.origin);
+
+    setPrimaryColor(fill.color);
+
+    hasStrokeStyle = false;
+
+    if (almostEqual(prev, primaryColor.premultiplied)) {
+      return;
+    }
+
+    try {
+      this->fill(fill);
+    } catch (...) { }
+  }
+  /// Renders a line.
+  void access(const Line& line) noexcept override
+  {
+    // A line needs two points to paint anything.
+    if (line.points.size() < 2) {
+      return;
+    }
+
+    setStrokeStyle(line);
+
+    auto tracer = [this, &line](auto plotter) {
+      for (std::size_t i = 1; i < line.points.size(); i++) {
+        drawLine(line.points[i - 1], line.points[i - 0], plotter);
+      }
+    };
+
+    paintStroke(tracer);
+  }
+  /// Draws a quadrilateral.
+  void access(const Quad& quad) noexcept override
+  {
+    setStrokeStyle(quad);
+
+    auto tracer = [this, &quad](auto plotter) {
+      drawLine(quad.points[0], quad.points[1], plotter);
+      drawLine(quad.points[1], quad.points[2], plotter);
+      drawLine(quad.points[2], quad.points[3], plotter);
+      drawLine(quad.points[3], quad.points[0], plotter);
+    };
+
+    paintStroke(tracer);
+  }
+  /// Paints a node. Documents are painted this way instead of
+  /// by visiting each node, since switching on the type of the
+  /// node lets the painting functions be called directly.
+  ///
+  /// @param node The node to paint.
+  void paint(const Node& node) noexcept
+  {
+    switch (node.kind) {
+      case NodeKind::Ellipse:
+        access(static_cast<const Ellipse&>(node));
+        break;
+      case NodeKind::Fill:
+        access(static_cast<const Fill&>(node));
+        break;
+      case NodeKind::Line:
+        access(static_cast<const Line&>(node));
+        break;
+      case NodeKind::Quad:
+        access(static_cast<const Quad&>(node));
+        break;
+    }
+  }
+  /// Clears the contents of the color buffer.
+  /// Only the area within the clip rectangle is cleared.
+  ///
+  /// @param c The color to clear the color buffer with.
+  /// This is premultiplied within the function call.
+  void clear(const RGBA& c) noexcept
+  {
+    Color bg(c);
+
+    if (clipMin[0] >= clipMax[0]) {
+      return;
+    }
+
+    auto fill = getSpanKernels().fill;
+
+    auto count = std::size_t(clipMax[0] - clipMin[0]);
+
+    for (int y = clipMin[1]; y < clipMax[1]; y++) {
+      fill(pixelAt(clipMin[0], y), count, bg);
+    }
+  }
+  /// Draws a line segment.
+  ///
+  /// @param a The first point of the line segment.
+  /// @param b The last point of the line segment.
+  /// @param plotter Receives each point along the line segment.
+  template <typename Plotter>
+  void drawLine(const Vec2& a, const Vec2& b, Plotter plotter)
+  {
+    if (overlapsClip(min(a, b), max(a, b), pixelSize)) {
+      renderLine(a, b, plotter);
+    }
+  }
+  /// Paints a stroke. If the pixel size is larger than one and
+  /// blending a pixel twice has the same result as blending it once,
+  /// then the squares along the stroke are converted to spans that
+  /// are each blended once. Otherwise, each square is plotted so that
+  /// pixels covered by several squares are blended several times.
+  ///
+  /// @param tracer A function that passes each point along the
+  /// stroke to the plotting function that it's given.
+  template <typename Tracer>
+  void paintStroke(Tracer tracer) noexcept
+  {
+    if (!usesSpans()) {
+      plotStroke(tracer);
+      return;
+    }
+
+    auto spanFunctor = [this](int y, int x1, int x2) noexcept {
+      blendSpan(y, x1, x2);
+    };
+
+    rasterizer.begin(pixelSize, clipMin, clipMax);
+
+    // Since the blend is idempotent, splitting a run at
+    // the points that fall outside of the clip rectangle
+    // doesn't change the result.
+
+    tracer([this, &spanFunctor](int x, int y) noexcept {
+      if (overlapsClip(Vec2 { x, y }, Vec2 { x, y }, pixelSize)) {
+        rasterizer.plot(x, y, spanFunctor);
+      }
+    });
+
+    rasterizer.finish(spanFunctor);
+  }
+  /// Plots each point along a stroke. Pixels covered
+  /// by several points are blended several times.
+  ///
+  /// @param tracer A function that passes each point along the
+  /// stroke to the plotting function that it's given.
+  template <typename Tracer>
+  void plotStroke(Tracer tracer) noexcept
+  {
+    if (pixelSize > 1) {
+      tracer([this](int x, int y) { plot(x, y); });
+      return;
+    }
+
+    // Neighboring points on the same row are joined into runs,
+    // so that they're blended with the span kernels. A pixel that
+    // is plotted again is never joined to the run that has it, so
+    // each pixel is still blended once for every time it's plotted.
+
+    PixelRun run;
+
+    tracer([this, &run](int x, int y) {
+      if ((y == run.y) && (x == run.x2)) {
+        run.x2++;
+      } else if ((y == run.y) && (x == (run.x1 - 1))) {
+        run.x1--;
+      } else {
+        blendRun(run);
+        run = PixelRun { y, x, x + 1 };
+      }
+    });
+
+    blendRun(run);
+  }
+  /// Blends the primary color across a horizontal span of pixels.
+  ///
+  /// @note This function does not perform bounds checking.
+  ///
+  /// @param y The row of the span.
+  /// @param x1 The first pixel in the span.
+  /// @param x2 One passed the last pixel in the span.
+  void blendSpan(int y, int x1, int x2) noexcept
+  {
+    if (recorder) {
+      recorder->addSpan(blendMode, primaryColor, y, x1, x2);
+      return;
+    }
+
+    auto* dst = pixelAt(x1, y);
+
+    px::blendSpan(blendMode, dst, std::size_t(x2 - x1), primaryColor);
+  }
+  /// Sets the maximum number of threads that fills
+  /// are painted with. By default, one thread is used.
+  ///
+  /// @param count The maximum number of threads, including the calling thread.
+  inline void setThreadCount(std::size_t count) noexcept
+  {
+    threadCount = count ? count : 1;
+
+    floodFill.setThreadCount(threadCount);
+  }
+  /// Records the spans of strokes instead of painting them.
+  /// The color buffer is not accessed while recording.
+  ///
+  /// @param commands The commands to record the spans into.
+  inline void setRecorder(LayerCommands* commands) noexcept
+  {
+    recorder = commands;
+  }
+  /// Indicates whether or not strokes are currently painted with spans.
+  inline bool usesSpans() const noexcept
+  {
+    return spanMode;
+  }
+  /// Takes the color, blend mode and pixel size of a stroke.
+  /// If they're the same as those of the last stroke, then
+  /// the painter state is left as it is.
+  ///
+  /// @param node The stroke to take the style of.
+  void setStrokeStyle(const StrokeNode& node) noexcept
+  {
+    if (hasStrokeStyle
+     && (node.pixelSize == pixelSize)
+     && (node.blendMode == blendMode)
+     && (node.color[0] == strokeColor[0])
+     && (node.color[1] == strokeColor[1])
+     && (node.color[2] == strokeColor[2])
+     && (node.color[3] == strokeColor[3])) {
+      return;
+    }
+
+    setPrimaryColor(node.color);
+
+    blendMode = node.blendMode;
+    pixelSize = node.pixelSize;
+
+    strokeColor = node.color;
+
+    spanMode = (pixelSize > 1) && isIdempotent() && strokeSpansEnabled();
+
+    hasStrokeStyle = true;
+  }
+  /// Indicates whether blending the primary color onto a pixel
+  /// more than once has the same result as blending it once.
+  inline bool isIdempotent() const noexcept
+  {
+    switch (blendMode) {
+      case BlendMode::Normal:
+        return primaryColor.premultiplied[3] == 1.0f;
+      case BlendMode::Subtract:
+        // Each channel either has no effect or
+        // is clipped to zero on the first blend.
+        for (std::size_t i = 0; i < 4; i++) {
+          auto c = primaryColor.original[i];
+          if ((c != 0.0f) && (c < 1.0f)) {
+            return false;
+          }
+        }
+        return true;
+    }
+
+    return false;
+  }
+  /// A run of neighboring pixels on one row.
+  struct PixelRun final
+  {
+    /// The row of the run.
+    int y = 0;
+    /// The first pixel of the run.
+    int x1 = 0;
+    /// One passed the last pixel of the run.
+    int x2 = 0;
+  };
+  /// Blends the primary color across the part
+  /// of a run that is within the clip rectangle.
+  void blendRun(const PixelRun& run) noexcept
+  {
+    if ((run.y < clipMin[1]) || (run.y >= clipMax[1])) {
+      return;
+    }
+
+    auto x1 = std::max(run.x1, clipMin[0]);
+    auto x2 = std::min(run.x2, clipMax[0]);
+
+    if (x1 < x2) {
+      blendSpan(run.y, x1, x2);
+    }
+  }
+  /// Plots a point onto the color buffer.
+  ///
+  /// @param x The X coordinate of the point to plot.
+  /// @param y The Y coordinate of the point to plot.
+  inline void plot(int x, int y) { plot(Vec2 { x, y }); }
+  /// Plots a point onto the color buffer. The square of the point
+  /// is blended one row at a time, so that pixels covered by several
+  /// squares are blended several times.
+  ///
+  /// @param p The point to plot within the color buffer.
+  void plot(const Vec2& p) noexcept
+  {
+    if (!overlapsClip(p, p, pixelSize)) {
+      return;
+    }
+
+    Vec2 min { p - (int(pixelSize) - 1) };
+
+    for (int y = min[1]; y <= p[1]; y++) {
+      blendRun(PixelRun { y, min[0], p[0] + 1 });
+    }
+  }
+  /// Renders a series of layers.
+  ///
+  /// @param layers The layers to be rendered.
+  void renderLayers(const std::vector<LayerPtr>& layers)
+  {
+    for (const auto& layer : layers) {
+
+      if (!layer->visible) {
+        continue;
+      }
 
-    auto name = formatLayerName(i);
-    if (!layerNameExists(doc, name.c_str())) {
-      return name;
+      setLayerOpacity(layer->opacity);
+
+      for (const auto* node : layer->nodes) {
+        paint(*node);
+      }
+    }
+  }
+  /// Assigns the opacity of the layer that
+  /// the next nodes are being painted from.
+  ///
+  /// @param opacity The opacity of the layer.
+  inline void setLayerOpacity(float opacity) noexcept
+  {
+    if (opacity != layerOpacity) {
+      layerOpacity = opacity;
+      hasStrokeStyle = false;
     }
   }
+  /// Assigns the primary color being used by the painter.
+  ///
+  /// @note This function will premultiply the alpha channel of @p c.
+  ///
+  /// @param c The color to assign to the painter.
+  /// The alpha channel is ignored and the current
+  /// layer opacity is used in place of it.
+  inline void setPrimaryColor(const RGBA& c)
+  {
+    primaryColor = Color(RGBA { c[0], c[1], c[2], layerOpacity * c[3] });
+  }
+  /// Gets the color from a pixel at a certain point.
+  ///
+  /// @note This function does not perform bounds checking.
+  ///
+  /// @param p The point to get the pixel color from.
+  ///
+  /// @return The color at the specified point.
+  inline RGBA getPixel(const Vec2& p) const noexcept
+  {
+    return getPixel(p[0], p[1]);
+  }
+  /// Gets the color from a pixel at a certain point.
+  ///
+  /// @note This function does not perform bounds checking.
+  ///
+  /// @param x The X coordinate of the pixel to get.
+  /// @param y The Y coordinate of the pixel to get.
+  ///
+  /// @return The color at the specified point.
+  inline RGBA getPixel(int x, int y) const noexcept
+  {
+    const float* src = pixelAt(x, y);
 
-  // It would be odd if this was reached.
+    return RGBA { src[0], src[1], src[2], src[3] };
+  }
+  /// Indicates if a point is in bounds or not.
+  ///
+  /// @param p The point to check.
+  ///
+  /// @return True on success, false on failure.
+  inline bool inBounds(const Vec2& p) const noexcept
+  {
+    return ((p[0] >= 0) && (std::size_t(p[0]) < width))
+        && ((p[1] >= int(firstRow)) && (std::size_t(p[1]) < height));
+  }
+  /// Locates a pixel in the color buffer.
+  ///
+  /// @note This function does not perform bounds checking.
+  ///
+  /// @param x The X coordinate of the pixel.
+  /// @param y The Y coordinate of the pixel.
+  ///
+  /// @return A pointer to the pixel's RGBA values.
+  inline float* pixelAt(int x, int y) const noexcept
+  {
+    return &colorBuffer[(((y - firstRow) * width) + x) * 4];
+  }
+  /// Indicates if a stroke may paint within the clip rectangle.
+  ///
+  /// @param a The minimum point of the stroke.
+  /// @param b The maximum point of the stroke.
+  /// @param size The pixel size of the stroke. Since pixels are
+  /// drawn up and to the left of each point, this extends @p a.
+  ///
+  /// @return True if the stroke overlaps the clip rectangle,
+  /// false if it can be skipped.
+  inline bool overlapsClip(const Vec2& a, const Vec2& b, std::size_t size) const noexcept
+  {
+    auto lo = a - (int(size) - 1);
 
-  return "";
-}
+    return (lo[0] < clipMax[0]) && (b[0] >= clipMin[0])
+        && (lo[1] < clipMax[1]) && (b[1] >= clipMin[1]);
+  }
+protected:
+  /// Fills an area on the image with a color.
+  /// The primary color is used as the fill color.
+  ///
+  /// The region found by a fill is kept in the node. If the pixels
+  /// in and around the region haven't changed the next time the node
+  /// is painted, the region is painted again without searching for it.
+  ///
+  /// @param node The fill to paint.
+  void fill(const Fill& node)
+  {
+    if (!inBounds(node.origin)) {
+      return;
+    }
 
-} // namespace
+    auto cached = std::atomic_load(&node.region);
 
-Document* createDoc()
-{
-  return new Document();
-}
+    // A clipped render only changes the pixels within the clip, so a
+    // fill whose region was decided by pixels outside of the clip finds
+    // the same region again and has nothing to paint within the clip.
+    if (cached && isRegionOutsideClip(*cached, node.origin)) {
+      return;
+    }
 
-void closeDoc(Document* doc) noexcept
-{
-  delete doc;
-}
+    if (cached && isRegionCurrent(*cached, node.origin)) {
+      fillCacheStats().hits++;
+      paintRegion(cached->spans);
+      return;
+    }
 
-Document* copyDoc(const Document* doc)
+    fillCacheStats().misses++;
+
+    auto region = std::make_shared<FillRegion>();
+
+    floodFill.fill(colorBuffer, width, firstRow, height, node.origin, region->spans);
+
+    setRegionKey(*region, node.origin);
+
+    // The search only reads the pixels that decide the region,
+    // so it's only affected by pixels outside of the clip if
+    // those pixels are outside of it.
+    if ((region->keyMin[0] < clipMin[0]) || (region->keyMin[1] < clipMin[1])
+     || (region->keyMax[0] > clipMax[0]) || (region->keyMax[1] > clipMax[1])) {
+      fillEscapedClip = true;
+    }
+
+    std::atomic_store(&node.region, std::shared_ptr<const FillRegion>(region));
+
+    paintRegion(region->spans);
+  }
+  /// Indicates whether or not a region found earlier would
+  /// be found again, if the color buffer was searched.
+  ///
+  /// @param region The region to check.
+  /// @param origin The origin of the fill being painted.
+  bool isRegionCurrent(const FillRegion& region, const Vec2& origin) const noexcept
+  {
+    if ((region.width != width)
+     || (region.firstRow != firstRow)
+     || (region.height != height)
+     || (region.origin[0] != origin[0])
+     || (region.origin[1] != origin[1])) {
+      return false;
+    }
+
+    return hashPixels(colorBuffer, width, firstRow, region.keyMin, region.keyMax) == region.key;
+  }
+  /// Indicates whether or not a region found earlier for this
+  /// image is decided entirely by pixels outside of the clip.
+  ///
+  /// @param region The region to check.
+  /// @param origin The origin of the fill being painted.
+  bool isRegionOutsideClip(const FillRegion& region, const Vec2& origin) const noexcept
+  {
+    if (!docID
+     || (region.docID != docID)
+     || (region.width != width)
+     || (region.firstRow != firstRow)
+     || (region.height != height)
+     || !(region.origin == origin)) {
+      return false;
+    }
+
+    return (region.keyMax[0] <= clipMin[0]) || (region.keyMin[0] >= clipMax[0])
+        || (region.keyMax[1] <= clipMin[1]) || (region.keyMin[1] >= clipMax[1]);
+  }
+  /// Computes the key of a region that was just found.
+  /// This has to be done before the region is painted.
+  ///
+  /// @param region The region to compute the key of.
+  /// @param origin The origin that the region was found from.
+  void setRegionKey(FillRegion& region, const Vec2& origin) const noexcept
+  {
+    auto lo = origin;
+    auto hi = origin + 1;
+
+    for (const auto& span : region.spans) {
+      lo = min(lo, Vec2 { span.x1, span.y });
+      hi = max(hi, Vec2 { span.x2, span.y + 1 });
+    }
+
+    // The pixels next to the region are included, since
+    // they're what stopped the fill from spreading further.
+
+    region.width = width;
+    region.firstRow = firstRow;
+    region.height = height;
+    region.origin = origin;
+    region.docID = docID;
+    region.keyMin = max(lo - 1, Vec2 { 0, int(firstRow) });
+    region.keyMax = min(hi + 1, Vec2 { int(width), int(height) });
+    region.key = hashPixels(colorBuffer, width, firstRow, region.keyMin, region.keyMax);
+  }
+  /// Blends the primary color across the spans of a region.
+  /// The spans of large regions are split between several threads.
+  ///
+  /// @param spans The spans to blend. No two spans may overlap.
+  void paintRegion(const std::vector<FillSpan>& spans) noexcept
+  {
+    auto paintSpans = [this, &spans](std::size_t first, std::size_t last) noexcept {
+
+      for (auto i = first; i < last; i++) {
+
+        const auto& span = spans[i];
+
+        if ((span.y < clipMin[1]) || (span.y >= clipMax[1])) {
+          continue;
+        }
+
+        auto x1 = max(span.x1, clipMin[0]);
+        auto x2 = min(span.x2, clipMax[0]);
+
+        if (x1 < x2) {
+          blendSpan(span.y, x1, x2);
+        }
+      }
+    };
+
+    std::size_t regionSize = 0;
+
+    for (const auto& span : spans) {
+      regionSize += std::size_t(span.x2 - span.x1);
+    }
+
+    if ((threadCount <= 1) || (regionSize < minParallelFillSize())) {
+      paintSpans(0, spans.size());
+      return;
+    }
+
+    auto taskCount = threadCount * 4;
+
+    runTasks(taskCount, threadCount, [&spans, taskCount, &paintSpans](std::size_t i) noexcept {
+      paintSpans((i * spans.size()) / taskCount, ((i + 1) * spans.size()) / taskCount);
+    });
+  }
+};
+
+//=============================//
+// Section: Parallel Rendering //
+//=============================//
+
+namespace {
+
+/// A node that is queued to be painted,
+/// along with the opacity of its layer.
+struct PaintItem final
 {
-  return new Document(*doc);
-}
+  /// The opacity of the layer that the node is in.
+  float layerOpacity = 1;
+  /// The node to be painted.
+  const Node* node = nullptr;
+};
 
-int openDoc(Document* doc, const char* filename, ErrorList** errListPtr)
+/// Paints nodes onto a color buffer by splitting the buffer
+/// into horizontal tiles and painting each tile on its own thread.
+/// Each tile replays the entire list of queued nodes, but only the
+/// pixels within the tile are modified. Since every pixel sees the
+/// same sequence of blend operations that it would see with a single
+/// painter, the result is identical to a serial render.
+///
+/// Nodes that read from the color buffer (flood fills) can't be
+/// painted this way, since they may cross tiles. When one of them
+/// is found, the queued nodes are painted, then the node is painted
+/// on the calling thread with access to the entire buffer.
+class TilePainter final
 {
-  if (errListPtr) {
-    *errListPtr = nullptr;
-  }
+  /// The nodes waiting to be painted.
+  std::vector<PaintItem> queue;
+  /// The color buffer being rendered to.
+  float* colorBuffer = nullptr;
+  /// The width of the color buffer, in pixels.
+  std::size_t width = 0;
+  /// The height of the color buffer, in pixels.
+  std::size_t height = 0;
+  /// The maximum number of threads to paint with.
+  std::size_t threadCount = 1;
+  /// The background color to clear with on the first
+  /// tiled pass, so that clearing is done in parallel as well.
+  RGBA background = transparent();
+  /// Whether or not the background still has to be cleared.
+  bool clearPending = true;
+public:
+  TilePainter(float* c, std::size_t w, std::size_t h, std::size_t t)
+    : colorBuffer(c), width(w), height(h), threadCount(t ? t : 1) {}
+  /// Renders a document onto the color buffer.
+  ///
+  /// @param doc The document to render.
+  void renderDoc(const Document& doc) noexcept
+  {
+    background = doc.background;
 
-  *doc = Document();
+    clearPending = true;
 
-  doc->layers.clear();
+    for (const auto& layer : doc.layers) {
 
-  if (!filename) {
-    return EFAULT;
+      if (!layer->visible) {
+        continue;
+      }
+
+      for (const auto& node : layer->nodes) {
+
+        PaintItem item { layer->opacity, node };
+
+        if (node->readsColorBuffer()) {
+          flush();
+          paintSerial(item);
+        } else {
+          queueItem(item);
+        }
+      }
+    }
+
+    flush();
   }
+protected:
+  /// Adds a node to the queue of nodes to be tiled.
+  /// If the queue can't grow, then the queue is painted
+  /// early. The result is the same either way.
+  void queueItem(const PaintItem& item) noexcept
+  {
+    try {
+      queue.emplace_back(item);
+    } catch (...) {
+      flush();
+      paintSerial(item);
+    }
+  }
+  /// Paints all of the queued nodes using tiles.
+  void flush() noexcept
+  {
+    if (queue.empty() && !clearPending) {
+      return;
+    }
 
-  errno = 0;
+    // A few tiles per thread keeps the
+    // threads busy when the work per tile
+    // is not evenly distributed.
+    auto tileCount = min(height, threadCount * 4);
+    if (!tileCount) {
+      queue.clear();
+      clearPending = false;
+      return;
+    }
 
-  std::ifstream file(filename);
-  if (!file.good()) {
-    return errno;
+    std::atomic<std::size_t> nextTile { 0 };
+
+    auto worker = [this, tileCount, &nextTile]() noexcept {
+      for (;;) {
+
+        auto tile = nextTile++;
+        if (tile >= tileCount) {
+          break;
+        }
+
+        paintTile((tile * height) / tileCount, ((tile + 1) * height) / tileCount);
+      }
+    };
+
+    std::vector<std::thread> threads;
+
+    try {
+      for (std::size_t i = 1; (i < threadCount) && (i < tileCount); i++) {
+        threads.emplace_back(worker);
+      }
+    } catch (...) {
+      // Any tiles not taken by the threads that
+      // did start are painted by the calling thread.
+    }
+
+    worker();
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    queue.clear();
+
+    clearPending = false;
   }
+  /// Paints the queued nodes onto a single tile.
+  ///
+  /// @param y1 The first row of the tile.
+  /// @param y2 One passed the last row of the tile.
+  void paintTile(std::size_t y1, std::size_t y2) noexcept
+  {
+    Painter painter(colorBuffer, width, height);
 
-  std::stringstream buf;
+    painter.setClip(0, int(y1), int(width), int(y2));
 
-  buf << file.rdbuf();
+    if (clearPending) {
+      painter.clear(background);
+    }
+
+    for (const auto& item : queue) {
+      painter.setLayerOpacity(item.layerOpacity);
+      painter.paint(*item.node);
+    }
+  }
+  /// Paints a node that reads from the color buffer.
+  /// This is done over the entire color buffer, although
+  /// a fill may still use several threads on its own.
+  ///
+  /// @param item The node to paint.
+  void paintSerial(const PaintItem& item) noexcept
+  {
+    Painter painter(colorBuffer, width, height);
+    painter.setThreadCount(threadCount);
+    painter.setLayerOpacity(item.layerOpacity);
+    painter.paint(*item.node);
+  }
+};
 
-  std::string content(buf.str());
+} // namespace
 
-  Parser parser(content.data(), content.size());
+namespace {
 
-  while (parser.remaining() && !parser.failed()) {
+/// Indicates whether or not a document has a visible
+/// node that reads from the color buffer while painting.
+///
+/// @param doc The document to check.
+///
+/// @return True if the document has a visible flood fill,
+/// false if it has none.
+bool hasVisibleFills(const Document& doc) noexcept
+{
+  for (const auto& layer : doc.layers) {
 
-    auto w = parser.parseSize("width");
-    if (w.valid) {
-      doc->width = w.value;
+    if (!layer->visible) {
       continue;
-    } else if (parser.failed()) {
-      break;
     }
 
-    auto h = parser.parseSize("height");
-    if (h.valid) {
-      doc->height = h.value;
-      continue;
-    } else if (parser.failed()) {
-      break;
+    for (const auto& node : layer->nodes) {
+      if (node->readsColorBuffer()) {
+        return true;
+      }
     }
+  }
+
+  return false;
+}
+
+bool findTopFill(const Document& doc, const Vec2& p, std::size_t firstLayer, std::size_t firstIndex, std::size_t* layer, std::size_t* index)
+{
+  auto w = doc.width;
+  auto h = doc.height;
+
+  if ((p[0] < 0) || (p[1] < 0) || (p[0] >= int(w)) || (p[1] >= int(h))) {
+    return false;
+  }
+
+  auto isCandidate = [&](std::size_t l, std::size_t i) {
+    const auto& node = *doc.layers[l]->nodes.index[i];
+    return ((l > firstLayer) || ((l == firstLayer) && (i >= firstIndex))) && node.readsColorBuffer();
+  };
+
+  // Only the nodes up to the topmost fill have to be painted.
+
+  auto lastLayer = doc.layers.size();
+  auto lastIndex = std::size_t(0);
+
+  for (auto l = firstLayer; l < doc.layers.size(); l++) {
 
-    auto bg = parser.parseColor("background");
-    if (bg.valid) {
-      doc->background = bg.value;
+    const auto& nodes = doc.layers[l]->nodes.index;
+
+    if (!doc.layers[l]->visible) {
       continue;
-    } else if (parser.failed()) {
-      break;
     }
 
-    auto node = parser.parseNode();
-    if (node) {
-      if (doc->layers.empty()) {
-        addLayer(doc);
+    for (auto i = (l == firstLayer) ? firstIndex : 0; i < nodes.size(); i++) {
+      if (isCandidate(l, i)) {
+        lastLayer = l;
+        lastIndex = i;
       }
-      doc->layers[0]->nodes.emplace_back(std::move(node));
-      continue;
-    } else if (parser.failed()) {
-      break;
     }
+  }
 
-    auto layer = parser.parseLayer();
-    if (layer) {
-      doc->layers.emplace_back(std::move(layer));
+  if (lastLayer == doc.layers.size()) {
+    return false;
+  }
+
+  std::vector<float> colorBuffer(w * h * 4);
+
+  Painter painter(colorBuffer.data(), w, h);
+
+  painter.setDocID(doc.id);
+
+  painter.clear(doc.background);
+
+  auto found = false;
+
+  for (std::size_t l = 0; l <= lastLayer; l++) {
+
+    const auto& target = *doc.layers[l];
+
+    if (!target.visible) {
       continue;
-    } else if (parser.failed()) {
-      break;
     }
 
-    parser.badToken();
-    break;
-  }
+    painter.setLayerOpacity(target.opacity);
 
-  if (parser.failed()) {
+    auto count = (l == lastLayer) ? (lastIndex + 1) : target.nodes.index.size();
 
-    if (errListPtr) {
-      *errListPtr = parser.getErrorList(filename, std::move(content));
-    }
+    for (std::size_t i = 0; i < count; i++) {
 
-    return EINVAL;
+      const auto& node = *target.nodes.index[i];
+
+      painter.paint(node);
+
+      if (!isCandidate(l, i)) {
+        continue;
+      }
+
+      // The fill either found its region in this buffer, or reused
+      // a region that it checked against the pixels in this buffer.
+      auto region = std::atomic_load(&static_cast<const Fill&>(node).region);
+
+      if (region
+       && (region->width == w)
+       && (region->firstRow == 0)
+       && (region->height == h)
+       && (region->origin == static_cast<const Fill&>(node).origin)
+       && regionCovers(*region, p)) {
+        *layer = l;
+        *index = i;
+        found = true;
+      }
+    }
   }
 
-  return 0;
+  return found;
 }
 
-namespace {
-
-/// Encodes the document onto a stream.
+/// Grows the region of a region render to include the pixels
+/// that decide the region of every fill that the region reaches.
 ///
-/// @param doc The document to encode.
-/// @param stream The stream to encode the document to.
-void encodeDoc(const Document* doc, std::ostream& stream)
+/// The region of a fill is assumed to be the one it found the last
+/// time that it was painted for this document. A fill whose pixels are entirely outside
+/// of the render region has the same region as it did then, since the
+/// pixels before it are the same, and it doesn't paint any pixel within
+/// the render region. A fill that reaches the render region is painted
+/// again over all of the pixels that decide its region, so whether or
+/// not its region changed can be checked from within the render region.
+///
+/// @param doc The document being rendered.
+/// @param w The width of the image being rendered.
+/// @param h The height of the image being rendered.
+/// @param lo The upper left corner of the render region, which is grown.
+/// @param hi The lower right corner of the render region, which is grown.
+///
+/// @return True on success, false if a fill doesn't have a region from
+/// this document at this image size, which happens when it was last
+/// painted for a copy of the document. The whole image is then rendered.
+bool growRegionForFills(const Document& doc, std::size_t w, std::size_t h, Vec2& lo, Vec2& hi)
 {
-  Encoder encoder(stream);
+  std::vector<std::shared_ptr<const FillRegion>> regions;
 
-  encoder.encodeSize("width", doc->width);
-  encoder.encodeSize("height", doc->height);
-  encoder.encodeColor("background", doc->background);
+  for (const auto& layer : doc.layers) {
 
-  for (const auto& layer : doc->layers) {
-    encoder.encodeLayer(*layer);
-  }
-}
+    if (!layer->visible) {
+      continue;
+    }
 
-} // namespace
+    for (const auto& node : layer->nodes) {
 
-bool saveDoc(const Document* doc, const char* filename)
-{
-  std::ofstream file(filename);
-  if (!file.good()) {
-    return false;
-  }
+      if (!node->readsColorBuffer()) {
+        continue;
+      }
 
-  encodeDoc(doc, file);
+      const auto& fill = static_cast<const Fill&>(*node);
 
-  return true;
-}
+      if ((fill.origin[0] < 0) || (fill.origin[1] < 0)
+       || (fill.origin[0] >= int(w)) || (fill.origin[1] >= int(h))) {
+        continue;
+      }
 
-void saveDoc(const Document* doc, void** data, std::size_t* size)
-{
-  // Hardly the best approach but it's nice and simple.
+      auto region = std::atomic_load(&fill.region);
 
-  std::ostringstream stream;
+      if (!region
+       || (region->docID != doc.id)
+       || (region->width != w)
+       || (region->firstRow != 0)
+       || (region->height != h)
+       || !(region->origin == fill.origin)) {
+        return false;
+      }
+
+      regions.emplace_back(std::move(region));
+    }
+  }
 
-  encodeDoc(doc, stream);
+  // Growing the render region may make it reach
+  // another fill, so this is repeated until it stops growing.
 
-  auto tmp = stream.str();
+  for (bool grown = true; grown; ) {
 
-  *data = std::malloc(tmp.size());
-  *size = tmp.size();
+    grown = false;
 
-  std::memcpy(*data, tmp.data(), tmp.size());
-}
+    for (const auto& region : regions) {
 
-Layer* addLayer(Document* doc)
-{
-  LayerPtr layer(new Layer());
+      auto overlaps = (region->keyMin[0] < hi[0]) && (region->keyMax[0] > lo[0])
+                   && (region->keyMin[1] < hi[1]) && (region->keyMax[1] > lo[1]);
 
-  layer->name = uniqueLayerName(doc);
+      auto nextLo = min(lo, region->keyMin);
+      auto nextHi = max(hi, region->keyMax);
 
-  doc->layers.emplace_back(layer.get());
+      if (overlaps && (!(nextLo == lo) || !(nextHi == hi))) {
+        lo = nextLo;
+        hi = nextHi;
+        grown = true;
+      }
+    }
+  }
 
-  return layer.release();
+  return true;
 }
 
-void removeLayer(Document* doc, std::size_t layer)
+} // namespace
+
+void render(const Document* doc, float* colorBuffer, std::size_t w, std::size_t h) noexcept
 {
-  // std::vector::erase causes UB if the index
-  // is out of bounds, so we have to manually check
-  // and throw an exception if that's the case.
+  Painter painter(colorBuffer, w, h);
 
-  if (layer >= doc->layers.size()) {
-    throw std::out_of_range("Layer index is out of range");
-  }
+  painter.setDocID(doc->id);
+
+  painter.clear(doc->background);
 
-  doc->layers.erase(doc->layers.begin() + layer);
+  painter.renderLayers(doc->layers);
 }
 
-Layer* getLayer(Document* doc, std::size_t layer)
+void render(const Document* doc, Image* image) noexcept
 {
-  return doc->layers.at(layer).get();
+  render(doc, image->colorBuffer.data(), image->width, image->height);
 }
 
-const Layer* getLayer(const Document* doc, std::size_t layer)
+void render(const Document* doc, float* colorBuffer, std::size_t w, std::size_t h, std::size_t threadCount) noexcept
 {
-  return doc->layers.at(layer).get();
+  if (!threadCount) {
+    threadCount = std::thread::hardware_concurrency();
+  }
+
+  if (threadCount <= 1) {
+    render(doc, colorBuffer, w, h);
+    return;
+  }
+
+  TilePainter painter(colorBuffer, w, h, threadCount);
+
+  painter.renderDoc(*doc);
 }
 
-std::size_t getLayerCount(const Document* doc) noexcept
+void render(const Document* doc, Image* image, std::size_t threadCount) noexcept
 {
-  return doc->layers.size();
+  render(doc, image->colorBuffer.data(), image->width, image->height, threadCount);
 }
 
-void moveLayer(Document* doc, std::size_t src, std::size_t dst)
+void render(const Document* doc, float* colorBuffer, std::size_t w, std::size_t h, int x1, int y1, int x2, int y2) noexcept
 {
-  LayerPtr tmp = std::move(doc->layers.at(src));
+  auto lo = max(Vec2 { x1, y1 }, Vec2 { 0, 0 });
+  auto hi = min(Vec2 { x2, y2 }, Vec2 { int(w), int(h) });
 
-  for (std::size_t i = src; i < dst; i++) {
-    doc->layers.at(i) = std::move(doc->layers.at(i + 1));
+  if ((lo[0] >= hi[0]) || (lo[1] >= hi[1])) {
+    return;
   }
 
-  for (std::size_t i = src; i > dst; i--) {
-    doc->layers.at(i) = std::move(doc->layers.at(i - 1));
-  }
+  bool escaped = true;
 
-  doc->layers.at(dst) = std::move(tmp);
-}
+  try {
 
-Ellipse* addEllipse(Document* doc, std::size_t layer)
-{
-  return doc->layers.at(layer)->addNode(new Ellipse());
-}
+    if (growRegionForFills(*doc, w, h, lo, hi)) {
 
-Fill* addFill(Document* doc, std::size_t layer)
-{
-  return doc->layers.at(layer)->addNode(new Fill());
-}
+      Painter painter(colorBuffer, w, h);
 
-Line* addLine(Document* doc, std::size_t layer)
-{
-  return doc->layers.at(layer)->addNode(new Line());
-}
+      painter.setClip(lo[0], lo[1], hi[0], hi[1]);
 
-Quad* addQuad(Document* doc, std::size_t layer)
-{
-  return doc->layers.at(layer)->addNode(new Quad());
-}
+      painter.setDocID(doc->id);
 
-std::size_t getDocWidth(const Document* doc) noexcept { return doc->width; }
+      painter.clear(doc->background);
 
-std::size_t getDocHeight(const Document* doc) noexcept { return doc->height; }
+      painter.renderLayers(doc->layers);
 
-void getBackground(const Document* doc, float* bg) noexcept
-{
-  bg[0] = doc->background[0];
-  bg[1] = doc->background[1];
-  bg[2] = doc->background[2];
-  bg[3] = doc->background[3];
-}
+      escaped = painter.hasFillEscapedClip();
+    }
 
-void resizeDoc(Document* doc, std::size_t width, std::size_t height) noexcept
-{
-  doc->width = width;
-  doc->height = height;
+  } catch (...) { }
+
+  // A fill may have found a different region than it did before,
+  // in which case it may reach pixels outside of the render region.
+  if (escaped) {
+    render(doc, colorBuffer, w, h);
+  }
 }
 
-void setBackground(Document* doc, float r, float g, float b, float a) noexcept
+void render(const Document* doc, Image* image, int x1, int y1, int x2, int y2) noexcept
 {
-  doc->background = clip(RGBA { r, g, b, a });
+  render(doc, image->colorBuffer.data(), image->width, image->height, x1, y1, x2, y2);
 }
 
-//============================//
-// Section: Render Algorithms //
-//============================//
+//=======================//
+// Section: RGBA8 Output //
+//=======================//
 
-/// This function is based on the algorithm
-/// described by John Kennedy on rasterizing
-/// an ellipse.
+namespace {
+
+/// The minimum number of rows painted at a time
+/// when rendering to an 8-bit color buffer.
+constexpr std::size_t minBandHeight() noexcept { return 64; }
+
+/// The maximum number of bands to split an image into.
+/// Each band replays all of the nodes, so this is kept small.
+constexpr std::size_t maxBandCount() noexcept { return 8; }
+
+/// Converts premultiplied floating point colors to bytes.
 ///
-/// @param cx The center X component.
-/// @param cy The center Y component.
-/// @param xRadius The X radius
-/// @param yRadius The Y radius
-/// @param functor Receives the points to plot on the ellipse.
-template <typename Functor>
-void renderEllipse(int cx, int cy, int xRadius, int yRadius, Functor functor) noexcept
+/// @param src The colors to convert.
+/// @param dst Receives the converted colors.
+/// @param count The number of pixels to convert.
+/// @param premultiplied Whether or not to keep the colors
+/// premultiplied. If this is false, the alpha channel is
+/// divided out of the color channels.
+void quantize(const float* src, unsigned char* dst, std::size_t count, bool premultiplied) noexcept
 {
-  if (!xRadius || !yRadius) {
+  using Byte = unsigned char;
+
+  if (premultiplied) {
+
+    for (std::size_t i = 0; i < (count * 4); i++) {
+      dst[i] = Byte(src[i] * 255);
+    }
+
     return;
   }
 
-  auto plot4 = [cx, cy, functor](int x, int y) {
-    functor(cx + x, cy + y);
-    functor(cx - x, cy + y);
-    functor(cx - x, cy - y);
-    functor(cx + x, cy - y);
-  };
+  for (std::size_t i = 0; i < count; i++, src += 4, dst += 4) {
 
-  int twoASquare = 2 * xRadius * xRadius;
-  int twoBSquare = 2 * yRadius * yRadius;
+    auto a = src[3];
 
-  int x = xRadius;
-  int y = 0;
+    for (std::size_t j = 0; j < 3; j++) {
+      dst[j] = (a > 0) ? Byte(min(src[j] / a, 1.0f) * 255) : Byte(0);
+    }
 
-  int xChange = yRadius * yRadius * (1 - (2 * xRadius));
-  int yChange = xRadius * xRadius;
+    dst[3] = Byte(a * 255);
+  }
+}
 
-  int ellipseError = 0;
+} // namespace
 
-  int stoppingX = twoBSquare * xRadius;
-  int stoppingY = 0;
+void render(const Document* doc, unsigned char* rgba, std::size_t w, std::size_t h, bool premultiplied)
+{
+  // A fill may reach across bands,
+  // so the whole image is painted at once.
+  if (hasVisibleFills(*doc)) {
 
-  while (stoppingX >= stoppingY) {
+    std::vector<float> colorBuffer(w * h * 4);
 
-    plot4(x, y);
+    render(doc, colorBuffer.data(), w, h);
 
-    y++;
-    stoppingY += twoASquare;
-    ellipseError += yChange;
-    yChange += twoASquare;
+    quantize(colorBuffer.data(), rgba, w * h, premultiplied);
 
-    if (((2 * ellipseError) + xChange) > 0) {
-      x--;
-      stoppingX -= twoBSquare;
-      ellipseError += xChange;
-      xChange += twoBSquare;
-    }
+    return;
   }
 
-  x = 0;
-  y = yRadius;
+  auto bandHeight = max(minBandHeight(), (h + maxBandCount() - 1) / maxBandCount());
 
-  xChange = yRadius * yRadius;
-  yChange = xRadius * xRadius * (1 - (2 * yRadius));
+  std::vector<float> band(w * min(bandHeight, h) * 4);
 
-  ellipseError = 0;
+  for (std::size_t y1 = 0; y1 < h; y1 += bandHeight) {
 
-  stoppingX = 0;
-  stoppingY = twoASquare * yRadius;
+    auto y2 = min(y1 + bandHeight, h);
 
-  while (stoppingX <= stoppingY) {
+    Painter painter(band.data(), w, y2, y1);
 
-    plot4(x, y);
+    painter.clear(doc->background);
 
-    x++;
-    stoppingX += twoBSquare;
-    ellipseError += xChange;
-    xChange += twoBSquare;
-    if (((2 * ellipseError) + yChange) > 0) {
-      y--;
-      stoppingY -= twoASquare;
-      ellipseError += yChange;
-      yChange += twoASquare;
+    painter.renderLayers(doc->layers);
+
+    quantize(band.data(), rgba + (y1 * w * 4), (y2 - y1) * w, premultiplied);
+  }
+}
+
+//=====================//
+// Section: Compositor //
+//=====================//
+
+namespace {
+
+/// A cached rendering of a layer's nodes.
+struct LayerRaster final
+{
+  /// The key of the layer that was rendered.
+  std::uint64_t key = 0;
+  /// The premultiplied colors of the layer,
+  /// painted onto a transparent buffer.
+  std::vector<float> colorBuffer;
+  /// Whether or not the raster was used in the current frame.
+  bool used = false;
+};
+
+/// The most memory that the rasters of a compositor may take up,
+/// in bytes. Each raster is a full size float buffer, which is about
+/// 33 MB at 1920x1080, so layers past this budget are painted in place.
+constexpr std::size_t maxRasterBytes() noexcept { return std::size_t(256) << 20; }
+
+/// Computes a key from the revisions of the nodes in a layer.
+///
+/// @param layer The layer to compute the key of.
+///
+/// @return The key of the layer.
+std::uint64_t layerKey(const Layer& layer) noexcept
+{
+  std::uint64_t key = 14695981039346656037ULL;
+
+  for (const auto& node : layer.nodes) {
+    key = (key ^ node->revision) * 1099511628211ULL;
+  }
+
+  return key;
+}
+
+/// Computes a key from the nodes and the opacity of a layer.
+/// The painter folds the opacity of a layer into the colors of
+/// its nodes, so two layers with the same key paint the same pixels.
+/// The visibility of a layer is checked while compositing instead.
+///
+/// @param layer The layer to compute the key of.
+///
+/// @return The key of the layer.
+std::uint64_t paintKey(const Layer& layer) noexcept
+{
+  std::uint32_t opacityBits = 0;
+
+  std::memcpy(&opacityBits, &layer.opacity, sizeof(opacityBits));
+
+  return (layerKey(layer) ^ opacityBits) * 1099511628211ULL;
+}
+
+/// Indicates whether or not a layer looks the same when its raster
+/// is composited as it does when its nodes are painted onto the
+/// layers beneath it. This is the case when the layer only has strokes
+/// that are blended normally, since blending normally gives the same
+/// result no matter how the strokes are grouped. The opacity of the
+/// layer is folded into the stroke colors either way.
+///
+/// @param layer The layer to check.
+///
+/// @return True if the layer can be cached as a raster, false
+/// if it has to be painted onto the layers beneath it.
+bool isLayerCacheable(const Layer& layer) noexcept
+{
+  for (const auto* node : layer.nodes) {
+
+    // Fills depend on the layers beneath them.
+    if (node->readsColorBuffer()) {
+      return false;
+    }
+
+    if (static_cast<const StrokeNode*>(node)->blendMode != BlendMode::Normal) {
+      return false;
     }
   }
 
-  // 1st point set done
+  return true;
 }
 
-//==================//
-// Section: Painter //
-//==================//
+/// Composites a layer raster onto a color buffer.
+///
+/// @param dst The color buffer to composite onto.
+/// @param src The layer raster to composite.
+/// @param count The number of pixels in both buffers.
+void composite(float* dst, const float* src, std::size_t count) noexcept
+{
+  for (std::size_t i = 0; i < count; i++, dst += 4, src += 4) {
 
-/// Used for rasterizing the document.
-class Painter final : public NodeAccessor
+    auto k = 1.0f - src[3];
+
+    dst[0] = src[0] + (dst[0] * k);
+    dst[1] = src[1] + (dst[1] * k);
+    dst[2] = src[2] + (dst[2] * k);
+    dst[3] = src[3] + (dst[3] * k);
+  }
+}
+
+} // namespace
+
+struct Compositor final
 {
-  /// The current pixel size.
-  std::size_t pixelSize = 1;
-  /// The blend mode of the painter.
-  BlendMode blendMode = BlendMode::Normal;
-  /// The current material used to paint with.
-  Color primaryColor = RGBA { 0, 0, 0, 0 };
-  /// The current layer opacity.
-  float layerOpacity = 1.0f;
-  /// The color buffer being rendered to.
-  float* colorBuffer = nullptr;
-  /// The width of the color buffer, in pixels.
+  /// The layer rasters from the last frame.
+  std::vector<LayerRaster> rasters;
+  /// The width of the layer rasters, in pixels.
   std::size_t width = 0;
-  /// The height of the color buffer, in pixels.
+  /// The height of the layer rasters, in pixels.
   std::size_t height = 0;
-public:
-  Painter(float* c, std::size_t w, std::size_t h) : colorBuffer(c), width(w), height(h) {}
-  /// Renders an ellipse.
-  void access(const Ellipse& ellipse) noexcept override
+  /// Gets the raster of a layer, painting it if there isn't
+  /// one cached for the layer's nodes and opacity.
+  ///
+  /// @param layer The layer to get the raster for.
+  ///
+  /// @return The raster of the layer, or a null pointer if another
+  /// raster would exceed the memory budget of the compositor.
+  const LayerRaster* getRaster(const Layer& layer)
   {
-    setPrimaryColor(ellipse.color);
+    auto key = paintKey(layer);
 
-    blendMode = ellipse.blendMode;
-    pixelSize = ellipse.pixelSize;
+    for (auto& raster : rasters) {
+      if ((raster.key == key) && !raster.colorBuffer.empty()) {
+        raster.used = true;
+        return &raster;
+      }
+    }
 
-    auto functor = [this] (int x, int y) {
-      plot(x, y);
-    };
+    auto rasterBytes = width * height * 4 * sizeof(float);
 
-    renderEllipse(ellipse.center[0],
-                  ellipse.center[1],
-                  ellipse.radius[0],
-                  ellipse.radius[1],
-                  functor);
-  }
-  /// Fills an area on the image
-  /// with a certain color.
-  void access(const Fill& fill) noexcept override
-  {
-    if (!inBounds(fill.origin)) {
-      return;
+    // Rasters that haven't been used in this frame yet are most
+    // likely of layers that were modified since the last frame.
+    for (auto i = rasters.size(); (i > 0) && (((rasters.size() + 1) * rasterBytes) > maxRasterBytes()); i--) {
+      if (!rasters[i - 1].used) {
+        rasters.erase(rasters.begin() + std::ptrdiff_t(i - 1));
+      }
     }
 
-    blendMode = fill.blendMode;
+    if (((rasters.size() + 1) * rasterBytes) > maxRasterBytes()) {
+      return nullptr;
+    }
 
-    auto prev = getPixel(fill.origin);
+    LayerRaster raster;
 
-    setPrimaryColor(fill.color);
+    raster.key = key;
+    raster.used = true;
+    raster.colorBuffer.resize(width * height * 4);
 
-    if (almostEqual(prev, primaryColor.premultiplied)) {
-      return;
-    }
+    Painter painter(raster.colorBuffer.data(), width, height);
 
-    try {
-      this->fill(fill.origin, prev);
-    } catch (...) { }
-  }
-  /// Renders a line.
-  void access(const Line& line) noexcept override
-  {
-    setPrimaryColor(line.color);
+    painter.clear(transparent());
 
-    blendMode = line.blendMode;
-    pixelSize = line.pixelSize;
+    painter.setLayerOpacity(layer.opacity);
 
-    for (std::size_t i = 1; i < line.points.size(); i++) {
-      drawLine(line.points[i - 1], line.points[i - 0]);
+    for (const auto* node : layer.nodes) {
+      painter.paint(*node);
     }
-  }
-  /// Draws a quadrilateral.
-  void access(const Quad& quad) noexcept override
-  {
-    setPrimaryColor(quad.color);
 
-    blendMode = quad.blendMode;
-    pixelSize = quad.pixelSize;
+    rasters.emplace_back(std::move(raster));
 
-    drawLine(quad.points[0], quad.points[1]);
-    drawLine(quad.points[1], quad.points[2]);
-    drawLine(quad.points[2], quad.points[3]);
-    drawLine(quad.points[3], quad.points[0]);
+    return &rasters.back();
   }
-  /// Clears the contents of the color buffer.
+  /// Prepares the compositor for a new frame.
   ///
-  /// @param c The color to clear the color buffer with.
-  /// This is premultiplied within the function call.
-  void clear(const RGBA& c) noexcept
+  /// @param w The width of the frame.
+  /// @param h The height of the frame.
+  void beginFrame(std::size_t w, std::size_t h) noexcept
   {
-    std::size_t max = width * height * 4;
-
-    RGBA bg = premultiply(c);
+    if ((w != width) || (h != height)) {
+      rasters.clear();
+      width = w;
+      height = h;
+    }
 
-    for (std::size_t i = 0; i < max; i += 4) {
-      colorBuffer[i + 0] = bg[0];
-      colorBuffer[i + 1] = bg[1];
-      colorBuffer[i + 2] = bg[2];
-      colorBuffer[i + 3] = bg[3];
+    for (auto& raster : rasters) {
+      raster.used = false;
     }
   }
-  void drawLine(const Vec2& a, const Vec2& b) noexcept
+  /// Releases the rasters of layers that were not in the frame.
+  void endFrame() noexcept
   {
-    auto diff = absolute(a - b);
+    std::size_t i = 0;
 
-    diff[1] = -diff[1];
+    while (i < rasters.size()) {
+      if (!rasters[i].used) {
+        rasters.erase(rasters.begin() + i);
+      } else {
+        i++;
+      }
+    }
+  }
+};
 
-    int signX = (a[0] < b[0]) ? 1 : -1;
-    int signY = (a[1] < b[1]) ? 1 : -1;
+Compositor* createCompositor()
+{
+  return new Compositor();
+}
 
-    int err = diff[0] + diff[1];
+void closeCompositor(Compositor* compositor) noexcept
+{
+  delete compositor;
+}
 
-    auto p = a;
+void render(const Document* doc, float* colorBuffer, std::size_t w, std::size_t h, Compositor* compositor)
+{
+  compositor->beginFrame(w, h);
 
-    for (;;) {
+  Painter painter(colorBuffer, w, h);
 
-      plot(p[0], p[1]);
+  painter.clear(doc->background);
 
-      if (p == b) {
-        break;
-      }
+  for (const auto& layer : doc->layers) {
 
-      int err2 = 2 * err;
+    if (!layer->visible) {
+      continue;
+    }
 
-      if (err2 >= diff[1]) {
-        err += diff[1];
-        p[0] += signX;
-      }
+    const auto* raster = isLayerCacheable(*layer) ? compositor->getRaster(*layer) : nullptr;
 
-      if (err2 <= diff[0]) {
-        err += diff[0];
-        p[1] += signY;
-      }
+    if (raster) {
+      composite(colorBuffer, raster->colorBuffer.data(), w * h);
+      continue;
     }
-  }
-  /// Plots a point onto the color buffer.
-  ///
-  /// @param x The X coordinate of the point to plot.
-  /// @param y The Y coordinate of the point to plot.
-  inline void plot(int x, int y) { plot(Vec2 { x, y }); }
-  /// Plots a point onto the color buffer.
-  ///
-  /// @param p The point to plot within the color buffer.
-  void plot(const Vec2& p)
-  {
-    Vec2 min { p - (int(pixelSize) - 1) };
-    Vec2 max = p;
 
-    for (int y = min[1]; y <= max[1]; y++) {
-      for (int x = min[0]; x <= max[0]; x++) {
-        blend(x, y, primaryColor);
-      }
+    painter.setLayerOpacity(layer->opacity);
+
+    for (const auto* node : layer->nodes) {
+      painter.paint(*node);
     }
   }
-  /// Renders a series of layers.
-  ///
-  /// @param layers The layers to be rendered.
-  void renderLayers(const std::vector<LayerPtr>& layers)
-  {
-    for (const auto& layer : layers) {
 
-      if (!layer->visible) {
-        continue;
-      }
+  compositor->endFrame();
+}
+
+void render(const Document* doc, Image* image, Compositor* compositor)
+{
+  render(doc, image->colorBuffer.data(), image->width, image->height, compositor);
+}
 
-      layerOpacity = layer->opacity;
+//=======================//
+// Section: Display List //
+//=======================//
 
-      for (const auto& node : layer->nodes) {
-        node->accept(*this);
-      }
+namespace {
+
+/// Computes the key of a layer's commands.
+/// The colors of the commands include the opacity
+/// of the layer, so the opacity is part of the key.
+///
+/// @param layer The layer to compute the key of.
+///
+/// @return The key of the layer's commands.
+std::uint64_t commandKey(const Layer& layer) noexcept
+{
+  return paintKey(layer);
+}
+
+/// Compiles the nodes of a layer into commands.
+///
+/// @exception std::bad_alloc If a command can't be recorded.
+///
+/// @param layer The layer to compile.
+/// @param w The width of the image that the commands are painted on.
+/// @param h The height of the image that the commands are painted on.
+/// @param commands Receives the commands of the layer.
+void compileLayer(const Layer& layer, std::size_t w, std::size_t h, LayerCommands& commands)
+{
+  commands.key = commandKey(layer);
+  commands.opacity = layer.opacity;
+
+  Painter painter(nullptr, w, h);
+
+  painter.setRecorder(&commands);
+
+  painter.setLayerOpacity(layer.opacity);
+
+  for (const auto* node : layer.nodes) {
+    if (node->readsColorBuffer()) {
+      commands.addFill(static_cast<const Fill&>(*node));
+    } else {
+      painter.paint(*node);
     }
   }
-  /// Sets the value of a pixel.
-  ///
-  /// @note This function does not perform bounds checking.
-  ///
-  /// @param x The X coordinate of the pixel to set.
-  /// @param y The Y coordinate of the pixel to set.
-  /// @param c The color to assign the pixel.
-  void blend(int x, int y, const Color& c) noexcept
-  {
-    if ((std::size_t(x) >= width)
-     || (std::size_t(y) >= height)) {
-      return;
+
+  if (commands.failed) {
+    throw std::bad_alloc();
+  }
+}
+
+/// Paints the commands of a layer onto a color buffer.
+///
+/// @param commands The commands to paint.
+/// @param colorBuffer The color buffer to paint on.
+/// @param w The width of the color buffer.
+/// @param h The height of the color buffer.
+void replay(const LayerCommands& commands, float* colorBuffer, std::size_t w, std::size_t h) noexcept
+{
+  for (const auto& run : commands.runs) {
+
+    if (run.fill != DisplayRun::noFill()) {
+      Painter painter(colorBuffer, w, h);
+      painter.setLayerOpacity(commands.opacity);
+      painter.paint(commands.fills[run.fill]);
+      continue;
     }
 
-    auto* dst = &colorBuffer[((y * width) + x) * 4];
+    for (auto i = run.firstSpan; i < run.lastSpan; i++) {
 
-    auto result = px::blend(blendMode, dst, c);
+      const auto& span = commands.spans[i];
 
-    dst[0] = result[0];
-    dst[1] = result[1];
-    dst[2] = result[2];
-    dst[3] = result[3];
-  }
-  /// Sets the value of a pixel.
-  ///
-  /// @note This function does not perform bounds checking.
-  ///
-  /// @param p The position of the pixel to set.
-  /// @param c The color to assign the pixel.
-  inline void blend(const Vec2& p, const RGBA& c)
-  {
-    return blend(p[0], p[1], c);
-  }
-  /// Assigns the primary color being used by the painter.
-  ///
-  /// @note This function will premultiply the alpha channel of @p c.
-  ///
-  /// @param c The color to assign to the painter.
-  /// The alpha channel is ignored and the current
-  /// layer opacity is used in place of it.
-  inline void setPrimaryColor(const RGBA& c)
-  {
-    primaryColor = Color(RGBA { c[0], c[1], c[2], layerOpacity * c[3] });
-  }
-  /// Gets the color from a pixel at a certain point.
-  ///
-  /// @note This function does not perform bounds checking.
-  ///
-  /// @param p The point to get the pixel color from.
-  ///
-  /// @return The color at the specified point.
-  inline RGBA getPixel(const Vec2& p) const noexcept
-  {
-    return getPixel(p[0], p[1]);
-  }
-  /// Gets the color from a pixel at a certain point.
-  ///
-  /// @note This function does not perform bounds checking.
-  ///
-  /// @param x The X coordinate of the pixel to get.
-  /// @param y The Y coordinate of the pixel to get.
-  ///
-  /// @return The color at the specified point.
-  inline RGBA getPixel(int x, int y) const noexcept
-  {
-    const float* src = &colorBuffer[((y * width) + x) * 4];
+      auto* dst = colorBuffer + (((std::size_t(span.y) * w) + std::size_t(span.x1)) * 4);
 
-    return RGBA { src[0], src[1], src[2], src[3] };
-  }
-  /// Indicates if a point is in bounds or not.
-  ///
-  /// @param p The point to check.
-  ///
-  /// @return True on success, false on failure.
-  inline bool inBounds(const Vec2& p) const noexcept
-  {
-    return ((p[0] >= 0) && (std::size_t(p[0]) < width))
-        && ((p[1] >= 0) && (std::size_t(p[1]) < height));
-  }
-protected:
-  /// Fills an area on the image with a color.
-  /// The primary color is used as the fill color.
-  ///
-  /// @param origin The point to start at.
-  ///
-  /// @param prev The previous color.
-  void fill(const Vec2& origin, const RGBA& prev)
-  {
-    if (!inBounds(origin)) {
-      return;
+      blendSpan(run.blendMode, dst, std::size_t(span.x2 - span.x1), run.color);
     }
+  }
+}
 
-    int xMax = int(width);
-    int yMax = int(height);
+} // namespace
 
-    std::vector<Vec2> stack;
+struct DisplayList final
+{
+  /// The width of the image that the list was compiled for.
+  std::size_t width = 0;
+  /// The height of the image that the list was compiled for.
+  std::size_t height = 0;
+  /// The background color of the document.
+  RGBA background = transparent();
+  /// The commands of each visible layer, in painting order.
+  std::vector<LayerCommands> layers;
+};
 
-    stack.push_back(origin);
+DisplayList* createDisplayList()
+{
+  return new DisplayList();
+}
 
-    auto pop = [](std::vector<Vec2>& stk) {
-      auto poppedItem = stk[stk.size() - 1];
-      stk.pop_back();
-      return poppedItem;
-    };
+void closeDisplayList(DisplayList* list) noexcept
+{
+  delete list;
+}
 
-    while (!stack.empty()) {
+void compileDoc(const Document* doc, std::size_t w, std::size_t h, DisplayList* list)
+{
+  auto resized = (w != list->width) || (h != list->height);
 
-      auto p = pop(stack);
+  // The layers are compiled before the list is modified,
+  // so that the list is left as it was if compiling fails.
+  // Each old layer is reused at most once.
 
-      auto x1 = p[0];
+  constexpr auto none = std::numeric_limits<std::size_t>::max();
 
-      while ((x1 >= 0) && almostEqual(getPixel(x1, p[1]), prev)) {
-        x1--;
-      }
+  std::vector<std::size_t> sources;
 
-      x1++;
+  std::vector<bool> taken(resized ? 0 : list->layers.size(), false);
 
-      auto spanAbove = false;
-      auto spanBelow = false;
+  std::vector<LayerCommands> compiled;
 
-      while ((x1 >= 0) && (x1 < xMax) && almostEqual(getPixel(x1, p[1]), prev)) {
+  for (const auto& layer : doc->layers) {
 
-        blend(x1, p[1], primaryColor);
+    if (!layer->visible) {
+      continue;
+    }
 
-        if (!spanAbove && (p[1] > 0) && almostEqual(getPixel(x1, p[1] - 1), prev)) {
-          stack.push_back(Vec2 { x1, p[1] - 1 });
-          spanAbove = true;
-        } else if (spanAbove && (p[1] > 0) && !almostEqual(getPixel(x1, p[1] - 1), prev)) {
-          spanAbove = false;
-        }
+    auto key = commandKey(*layer);
 
-        if (!spanBelow && (p[1] < (yMax - 1)) && almostEqual(getPixel(x1, p[1] + 1), prev)) {
-          stack.push_back(Vec2 { x1, p[1] + 1 });
-          spanBelow = true;
-        } else if (spanBelow && (p[1] < (yMax - 1)) && !almostEqual(getPixel(x1, p[1] + 1), prev)) {
-          spanBelow = false;
-        }
+    std::size_t i = 0;
 
-        x1++;
-      }
+    while ((i < taken.size()) && (taken[i] || (list->layers[i].key != key))) {
+      i++;
     }
+
+    if (i < taken.size()) {
+      taken[i] = true;
+      sources.emplace_back(i);
+      continue;
+    }
+
+    compiled.emplace_back();
+
+    compileLayer(*layer, w, h, compiled.back());
+
+    sources.emplace_back(none);
   }
-};
 
-void render(const Document* doc, float* colorBuffer, std::size_t w, std::size_t h) noexcept
+  std::vector<LayerCommands> layers(sources.size());
+
+  auto next = compiled.begin();
+
+  for (std::size_t i = 0; i < sources.size(); i++) {
+    if (sources[i] == none) {
+      layers[i] = std::move(*(next++));
+    } else {
+      layers[i] = std::move(list->layers[sources[i]]);
+    }
+  }
+
+  list->layers = std::move(layers);
+  list->width = w;
+  list->height = h;
+  list->background = doc->background;
+}
+
+void render(const DisplayList* list, float* colorBuffer, std::size_t w, std::size_t h) noexcept
 {
+  if ((w != list->width) || (h != list->height)) {
+    return;
+  }
+
   Painter painter(colorBuffer, w, h);
 
-  painter.clear(doc->background);
+  painter.clear(list->background);
 
-  painter.renderLayers(doc->layers);
+  for (const auto& commands : list->layers) {
+    replay(commands, colorBuffer, w, h);
+  }
 }
 
-void render(const Document* doc, Image* image) noexcept
+void render(const DisplayList* list, Image* image) noexcept
 {
-  render(doc, image->colorBuffer.data(), image->width, image->height);
+  render(list, image->colorBuffer.data(), image->width, image->height);
 }
 
 } // namespace px
@@ -52,11 +52,14 @@
 #define LIBPX_LIBPX_HPP
 
 #include <cstddef>
+#include <cstdint>
 
 /// @brief All declarations for this
 /// library are put into this namespace.
 namespace px {
 
+struct Compositor;
+struct DisplayList;
 struct Document;
 struct Ellipse;
 struct ErrorList;
@@ -80,6 +83,31 @@ enum class BlendMode
   Subtract
 };
 
+/// Identifies the type of a node within a layer.
+enum class NodeType
+{
+  /// The node is an @ref Ellipse.
+  Ellipse,
+  /// The node is a @ref Fill.
+  Fill,
+  /// The node is a @ref Line.
+  Line,
+  /// The node is a @ref Quad.
+  Quad
+};
+
+/// Describes how a document is encoded when it's saved.
+/// Documents in either format can be opened with @ref openDoc
+enum class DocFormat
+{
+  /// A human-readable text format.
+  /// This is the default format.
+  Text,
+  /// A compact binary format. It's faster
+  /// to save and open than the text format.
+  Binary
+};
+
 /// @defgroup pxImageApi Image API
 ///
 /// @brief Contains all declarations related to the image API.
@@ -171,10 +199,13 @@ void resizeImage(Image* image, std::size_t width, std::size_t height);
 Document* createDoc();
 
 /// Imports data from an external document.
+/// The document may be in either the text or binary format.
 ///
 /// @param doc A pointer to a document returned from @ref createDoc
 ///
 /// @param filename The path to the file to import the data from.
+/// Where supported, the file is mapped into memory and parsed in place.
+/// The error list refers to the mapping instead of copying the file.
 ///
 /// @param errList An optional parameter to store the error list at.
 /// See @ref pxErrorListApi for more information. If a pointer is passed
@@ -189,10 +220,31 @@ Document* createDoc();
 /// the pointer before calling any of the functions in @ref pxErrorApi
 int openDoc(Document* doc, const char* filename, ErrorList** errList = nullptr);
 
+/// Imports data from a document that is already in memory,
+/// such as the data returned by the memory buffer version of @ref saveDoc
+///
+/// @param doc A pointer to a document returned from @ref createDoc
+///
+/// @param data The contents of the document. This is parsed in place.
+///
+/// @param size The number of bytes in @p data.
+///
+/// @param errList An optional parameter to store the error list at.
+/// This works the same way as it does when opening a file, except the
+/// error list refers to @p data instead of copying it. Therefore, @p data
+/// must remain valid until the error list is closed. The file name given
+/// to the error list is "<memory>".
+///
+/// @return If the document was opened properly, then zero is returned.
+/// If @p data is null and @p size is not zero, then EFAULT is returned.
+/// If the document has a syntax error, then EINVAL is returned.
+int openDoc(Document* doc, const void* data, std::size_t size, ErrorList** errList = nullptr);
+
 /// Saves a document to a file.
 ///
 /// @param doc The document to save.
 /// @param filename The filename to save the data at.
+/// @param format The format to encode the document in.
 ///
 /// @return True on success, false on failure.
 /// If a failure occurs, no other functions are called
@@ -202,7 +254,7 @@ int openDoc(Document* doc, const char* filename, ErrorList** errList = nullptr);
 /// @return True on success, false on failure.
 ///
 /// @ingroup pxDocumentApi
-bool saveDoc(const Document* doc, const char* filename);
+bool saveDoc(const Document* doc, const char* filename, DocFormat format = DocFormat::Text);
 
 /// Saves a document to a memory buffer.
 ///
@@ -210,7 +262,8 @@ bool saveDoc(const Document* doc, const char* filename);
 /// @param data Is assigned memory allocated with malloc() that
 /// contains the formatted document data.
 /// @param size Is assigned the number of bytes allocated in @p data.
-void saveDoc(const Document* doc, void** data, std::size_t* size);
+/// @param format The format to encode the document in.
+void saveDoc(const Document* doc, void** data, std::size_t* size, DocFormat format = DocFormat::Text);
 
 /// Releases memory allocated by a document.
 ///
@@ -221,6 +274,24 @@ void closeDoc(Document* doc) noexcept;
 
 /// Copies an existing document.
 ///
+/// The layers are shared between the two documents instead of
+/// being copied. The first document to modify a shared layer takes it
+/// over. When another document modifies the layer, it's given its own
+/// copy of the layer first, and when the document that took it over
+/// modifies it, the other documents are given a copy first. So each
+/// document only sees its own modifications.
+///
+/// Pointers to layers and nodes that were accessed for modifying them
+/// remain valid and keep referring to the layer of their document. A
+/// layer accessed without modifying it, through a constant document,
+/// may still be shared. Once another document modifies that layer,
+/// pointers to it refer to the layer of that document instead, and
+/// have to be looked up again to see the layer of their own document.
+///
+/// Since modifying one of the documents also updates the other, the
+/// documents can't be used from different threads at the same time.
+/// To read a copy of a document on another thread, use @ref snapshotDoc.
+///
 /// @exception std::bad_alloc If a memory allocation fails.
 ///
 /// @param other The document to copy.
@@ -230,6 +301,31 @@ void closeDoc(Document* doc) noexcept;
 /// @ingroup pxDocumentApi
 Document* copyDoc(const Document* other);
 
+/// Makes a snapshot of a document that can be read from another
+/// thread, while the document continues to be modified. This is meant
+/// for rendering a document in the background.
+///
+/// Unlike @ref copyDoc, the snapshot doesn't share any layers with
+/// @p doc. Each layer is copied, unless a layer that looks the same
+/// is in @p previous, in which case that layer is shared instead. So
+/// taking a snapshot after each modification only copies the layers
+/// that were modified.
+///
+/// Snapshots may be read by any number of threads at once and may be
+/// released on any thread. Modifying a snapshot gives it its own
+/// copy of the modified layer, like it does for a copied document.
+///
+/// @exception std::bad_alloc If a memory allocation fails.
+///
+/// @param doc The document to take a snapshot of.
+/// @param previous A snapshot taken earlier, which may be a null
+/// pointer. This must have been made with this function.
+///
+/// @return A pointer to the snapshot. It is released with @ref closeDoc.
+///
+/// @ingroup pxDocumentApi
+Document* snapshotDoc(const Document* doc, const Document* previous = nullptr);
+
 /// Adds a layer to the document.
 ///
 /// @exception std::bad_alloc If the memory allocation
@@ -263,12 +359,60 @@ void removeLayer(Document* doc, std::size_t index);
 /// @ingroup pxDocumentApi
 std::size_t getLayerCount(const Document* doc) noexcept;
 
+/// Finds the topmost node of a document whose bounds
+/// contain a point. Layers that aren't visible are skipped.
+///
+/// A fill is found at the pixels that it covers in this document.
+/// When a fill is painted over the point, the document is painted up
+/// to the topmost such fill to find what it covers, so this costs up
+/// to one render of the document. Without fills above the point, only
+/// the spatial indices of the layers are searched.
+///
+/// @exception std::bad_alloc If a spatial index can't be built.
+///
+/// @param doc The document to search.
+/// @param x The X coordinate of the point.
+/// @param y The Y coordinate of the point.
+/// @param layer Receives the index of the layer that the node is in.
+/// @param index Receives the index of the node within the layer.
+///
+/// @return True if a node was found, false otherwise.
+///
+/// @ingroup pxDocumentApi
+bool findTopNode(const Document* doc, int x, int y, std::size_t* layer, std::size_t* index);
+
+/// Measures the memory used by a document.
+///
+/// Copies of a document share the layers that they have in
+/// common, so the memory used by a copy can be measured on
+/// its own by passing the document it was copied from.
+/// Caches kept for rendering are not included.
+///
+/// @param doc The document to measure.
+///
+/// @param base An optional document whose layers are
+/// not counted, if @p doc shares them. This may be null.
+///
+/// @return The number of bytes allocated by @p doc
+/// and not shared with @p base.
+///
+/// @ingroup pxDocumentApi
+std::size_t getDocMemoryUsage(const Document* doc, const Document* base = nullptr) noexcept;
+
 /// Gets a layer at a specified index.
 ///
+/// If the layer is shared with a copy of the document,
+/// this may copy the layer so that it can be modified
+/// without affecting the other document. When the layer
+/// is only read, the const overload avoids the copy.
+///
 /// @exception std::out_of_range exception if @p index
 /// is out of bounds (greater than or equal to the value
 /// returned by @ref getLayerCount().
 ///
+/// @exception std::bad_alloc If the layer has to be copied
+/// and there isn't enough memory for the copy.
+///
 /// @param doc The document to get the layer from.
 /// @param index The index of the layer to get.
 ///
@@ -277,8 +421,19 @@ std::size_t getLayerCount(const Document* doc) noexcept;
 /// @ingroup pxDocumentApi
 Layer* getLayer(Document* doc, std::size_t index);
 
-/// @copydoc getLayer
-const Layer* getLayer(const Document* doc, std::size_t);
+/// Gets a layer at a specified index, for reading.
+///
+/// @exception std::out_of_range exception if @p index
+/// is out of bounds (greater than or equal to the value
+/// returned by @ref getLayerCount().
+///
+/// @param doc The document to get the layer from.
+/// @param index The index of the layer to get.
+///
+/// @return A pointer to the specified layer.
+///
+/// @ingroup pxDocumentApi
+const Layer* getLayer(const Document* doc, std::size_t index);
 
 /// Moves a layer to a new position.
 ///
@@ -335,6 +490,43 @@ Fill* addFill(Document* doc, std::size_t layer = 0);
 /// @ingroup pxDocumentApi
 Quad* addQuad(Document* doc, std::size_t layer = 0);
 
+/// Adds a number of ellipses to a document at once.
+/// This is quicker than calling @ref addEllipse in a loop,
+/// since memory for all of the ellipses is allocated up front.
+///
+/// @exception std::bad_alloc If memory for the ellipses can't be
+/// allocated, in which case none of the ellipses are added.
+///
+/// @param doc The document to add the ellipses to.
+/// @param count The number of ellipses to add.
+/// @param ellipses Receives pointers to the new ellipses.
+/// There must be room for at least @p count pointers.
+/// @param layer The index of the layer to add the ellipses to.
+///
+/// @ingroup pxDocumentApi
+void addEllipses(Document* doc, std::size_t count, Ellipse** ellipses, std::size_t layer = 0);
+
+/// Adds a number of fill operations to a document at once.
+///
+/// @see addEllipses
+///
+/// @ingroup pxDocumentApi
+void addFills(Document* doc, std::size_t count, Fill** fills, std::size_t layer = 0);
+
+/// Adds a number of lines to a document at once.
+///
+/// @see addEllipses
+///
+/// @ingroup pxDocumentApi
+void addLines(Document* doc, std::size_t count, Line** lines, std::size_t layer = 0);
+
+/// Adds a number of quadrilaterals to a document at once.
+///
+/// @see addEllipses
+///
+/// @ingroup pxDocumentApi
+void addQuads(Document* doc, std::size_t count, Quad** quads, std::size_t layer = 0);
+
 /// Gets the width of the document, in pixels.
 ///
 /// @param doc The document to get the width of.
@@ -379,6 +571,20 @@ void resizeDoc(Document* doc, std::size_t width, std::size_t height) noexcept;
 /// @ingroup pxDocumentApi
 void setBackground(Document* doc, float r, float g, float b, float a) noexcept;
 
+/// Gets the revision of a document. The revision changes whenever the
+/// document, one of its layers or one of its nodes is modified, and
+/// revisions are never reused. A caller that keeps the revision of the
+/// last document it rendered can skip rendering until it changes.
+/// A copy of a document has the same revision as the original, until
+/// either one is modified.
+///
+/// @param doc The document to get the revision of.
+///
+/// @return The revision of the document.
+///
+/// @ingroup pxDocumentApi
+std::uint64_t getDocRevision(const Document* doc) noexcept;
+
 /// @defgroup pxLayerApi Layer API
 ///
 /// @brief Contains all declarations for layers.
@@ -444,6 +650,133 @@ void setLayerOpacity(Layer* layer, float opacity) noexcept;
 /// @ingroup pxLayerApi
 void setLayerVisibility(Layer* layer, bool visibility) noexcept;
 
+/// Gets the number of nodes in a layer.
+///
+/// @param layer The layer to get the number of nodes of.
+///
+/// @return The number of nodes in @p layer.
+///
+/// @ingroup pxLayerApi
+std::size_t getNodeCount(const Layer* layer) noexcept;
+
+/// Gets the type of a node in a layer.
+///
+/// @exception std::out_of_range If @p index is
+/// not less than the number of nodes in the layer.
+///
+/// @param layer The layer that the node is in.
+/// @param index The index of the node, in painting order.
+///
+/// @return The type of the node.
+///
+/// @ingroup pxLayerApi
+NodeType getNodeType(const Layer* layer, std::size_t index);
+
+/// Accesses an ellipse in a layer.
+///
+/// @exception std::out_of_range If @p index is
+/// not less than the number of nodes in the layer.
+///
+/// @param layer The layer that the ellipse is in.
+/// @param index The index of the ellipse, in painting order.
+///
+/// @return A pointer to the ellipse, or a null
+/// pointer if the node is not an ellipse.
+///
+/// @ingroup pxLayerApi
+Ellipse* getEllipse(Layer* layer, std::size_t index);
+
+/// Accesses a fill in a layer.
+///
+/// @exception std::out_of_range If @p index is
+/// not less than the number of nodes in the layer.
+///
+/// @param layer The layer that the fill is in.
+/// @param index The index of the fill, in painting order.
+///
+/// @return A pointer to the fill, or a null
+/// pointer if the node is not a fill.
+///
+/// @ingroup pxLayerApi
+Fill* getFill(Layer* layer, std::size_t index);
+
+/// Accesses a line in a layer.
+///
+/// @exception std::out_of_range If @p index is
+/// not less than the number of nodes in the layer.
+///
+/// @param layer The layer that the line is in.
+/// @param index The index of the line, in painting order.
+///
+/// @return A pointer to the line, or a null
+/// pointer if the node is not a line.
+///
+/// @ingroup pxLayerApi
+Line* getLine(Layer* layer, std::size_t index);
+
+/// Accesses a quadrilateral in a layer.
+///
+/// @exception std::out_of_range If @p index is
+/// not less than the number of nodes in the layer.
+///
+/// @param layer The layer that the quadrilateral is in.
+/// @param index The index of the quadrilateral, in painting order.
+///
+/// @return A pointer to the quadrilateral, or a null
+/// pointer if the node is not a quadrilateral.
+///
+/// @ingroup pxLayerApi
+Quad* getQuad(Layer* layer, std::size_t index);
+
+/// Finds the nodes of a layer whose bounds intersect a rectangle.
+///
+/// The bounds of a node are the ones given by @ref getBounds,
+/// which include the pixel size of strokes. Fills may reach any
+/// pixel, so they intersect every rectangle. Lines with fewer than
+/// two points paint nothing and are never found.
+///
+/// Each layer keeps a spatial index of its nodes. It's built the
+/// first time the layer is queried and then kept up to date, so that
+/// a query only looks at the nodes near the rectangle.
+///
+/// @exception std::bad_alloc If the spatial index can't be built.
+///
+/// @param layer The layer to search.
+///
+/// @param x1 The left side of the rectangle (inclusive.)
+/// @param y1 The top side of the rectangle (inclusive.)
+/// @param x2 The right side of the rectangle (exclusive.)
+/// @param y2 The bottom side of the rectangle (exclusive.)
+///
+/// @param indices Receives the indices of the nodes found, in painting order.
+/// @param maxCount The maximum number of indices to write to @p indices.
+///
+/// @return The number of nodes found. This may be
+/// larger than @p maxCount, in which case only the
+/// first @p maxCount nodes are written.
+///
+/// @ingroup pxLayerApi
+std::size_t findNodes(const Layer* layer, int x1, int y1, int x2, int y2, std::size_t* indices, std::size_t maxCount);
+
+/// Finds the topmost node of a layer whose bounds contain a point.
+/// This is the last node painted at that point, if any.
+///
+/// Fills are never found, since what a fill covers depends on the
+/// layers beneath it. Use @ref findTopNode(const Document*, int, int, std::size_t*, std::size_t*)
+/// to find fills as well.
+///
+/// @exception std::bad_alloc If the spatial index can't be built.
+///
+/// @param layer The layer to search.
+/// @param x The X coordinate of the point.
+/// @param y The Y coordinate of the point.
+/// @param index Receives the index of the node, if one is found.
+///
+/// @return True if a node was found, false otherwise.
+///
+/// @ingroup pxLayerApi
+bool findTopNode(const Layer* layer, int x, int y, std::size_t* index);
+
 /// @defgroup pxEllipseApi Ellipse API
 ///
 /// @brief Contains all declarations for ellipses.
@@ -501,6 +834,19 @@ void setPixelSize(Ellipse* ellipse, int pixelSize) noexcept;
 /// @ingroup pxEllipseApi
 void resizeRect(Ellipse* ellipse, int x1, int y1, int x2, int y2) noexcept;
 
+/// Gets the area of the image that an ellipse may paint on.
+///
+/// @param ellipse The ellipse to get the area of.
+/// @param bounds Receives the area as four integers. The first two are
+/// the inclusive upper left corner and the last two are the exclusive
+/// lower right corner. These can be passed to the region @ref render
+/// functions after the ellipse is added, removed or modified.
+///
+/// @return True if the ellipse paints anything, false otherwise.
+///
+/// @ingroup pxEllipseApi
+bool getBounds(const Ellipse* ellipse, int* bounds) noexcept;
+
 /// @defgroup pxFillApi Flood Fill API
 ///
 /// @brief Contains all declarations for flood fills.
@@ -532,6 +878,38 @@ void setFillOrigin(Fill* fill, int x, int y) noexcept;
 /// @ingroup pxFillApi
 void setColor(Fill* fill, float r, float g, float b, float a = 1) noexcept;
 
+/// Gets the area of the image that a fill operation may paint on.
+/// Since the area reached by a fill depends on everything painted
+/// before it, this is always the entire range of integers.
+///
+/// @param fill The fill operation to get the area of.
+/// @param bounds Receives the area as four integers,
+/// in the same format as the other bounds functions.
+///
+/// @return Always returns true.
+///
+/// @ingroup pxFillApi
+bool getBounds(const Fill* fill, int* bounds) noexcept;
+
+/// Gets the number of times that a fill was painted using the region
+/// it covered in an earlier render, and the number of times that the
+/// region had to be searched for. A region is reused when the pixels
+/// in and around it are the same as when it was searched for. The
+/// counts are shared by all documents.
+///
+/// @param hits Receives the number of fills painted from a cached region.
+/// This may be a null pointer.
+/// @param misses Receives the number of fills that were searched for.
+/// This may be a null pointer.
+///
+/// @ingroup pxFillApi
+void getFillCacheStats(std::size_t* hits, std::size_t* misses) noexcept;
+
+/// Resets the counts returned by @ref getFillCacheStats to zero.
+///
+/// @ingroup pxFillApi
+void resetFillCacheStats() noexcept;
+
 /// @defgroup pxLineApi Line API
 ///
 /// @brief Contains all declarations for lines.
@@ -561,6 +939,17 @@ void setColor(Line* line, float r, float g, float b, float a = 1) noexcept;
 /// @ingroup pxLineApi
 void addPoint(Line* line, int x, int y);
 
+/// Adds a series of points to a line.
+/// This is quicker than calling @ref addPoint
+/// for each point, when the points are known up front.
+///
+/// @param line The line to add the points to.
+/// @param points The coordinates of the points, as X and Y pairs.
+/// @param count The number of points to add.
+///
+/// @ingroup pxLineApi
+void addPoints(Line* line, const int* points, std::size_t count);
+
 /// This function removes meaningless points
 /// from a line. A point is meaningless if it
 /// is equal to its neighboring point or if it
@@ -572,6 +961,19 @@ void addPoint(Line* line, int x, int y);
 /// @ingroup pxLineApi
 void dissolvePoints(Line* line) noexcept;
 
+/// Removes meaningless points from the end of a line.
+/// Only the points from @p first onwards, and the two points
+/// before them, are examined. This is meant for lines that are
+/// dissolved as points are added, so that each new point doesn't
+/// cause the whole line to be examined again.
+///
+/// @param line The line to dissolve the points of.
+/// @param first The index of the first point added
+/// since the line was last dissolved.
+///
+/// @ingroup pxLineApi
+void dissolvePoints(Line* line, std::size_t first) noexcept;
+
 /// Gets the number of points in a line.
 ///
 /// @param line The line to get the point count of.
@@ -638,6 +1040,22 @@ void setPixelSize(Line* line, int pixelSize) noexcept;
 /// @ingroup pxLineApi
 bool setPoint(Line* line, std::size_t index, int x, int y) noexcept;
 
+/// Gets the area of the image that a line may paint on.
+///
+/// @param line The line to get the area of.
+/// @param bounds Receives the area as four integers. The first two are
+/// the inclusive upper left corner and the last two are the exclusive
+/// lower right corner.
+/// @param firstPoint If this is not zero, only the segments connected
+/// to this point and the points after it are included. After a point
+/// is added, passing its index gives the area of the new segment.
+///
+/// @return True if the line paints anything, false if it
+/// has less than two points (or no points after @p firstPoint.)
+///
+/// @ingroup pxLineApi
+bool getBounds(const Line* line, int* bounds, std::size_t firstPoint = 0) noexcept;
+
 /// @defgroup pxQuadApi Quad API
 ///
 /// @brief Contains all declarations for quadrilaterals.
@@ -673,6 +1091,18 @@ bool setPoint(Quad* quad, std::size_t index, int x, int y) noexcept;
 /// @ingroup pxQuadApi
 void setPixelSize(Quad* quad, int pixelSize) noexcept;
 
+/// Gets the area of the image that a quadrilateral may paint on.
+///
+/// @param quad The quadrilateral to get the area of.
+/// @param bounds Receives the area as four integers. The first two are
+/// the inclusive upper left corner and the last two are the exclusive
+/// lower right corner.
+///
+/// @return Always returns true.
+///
+/// @ingroup pxQuadApi
+bool getBounds(const Quad* quad, int* bounds) noexcept;
+
 /// Renders the document onto a color buffer.
 ///
 /// @param doc The document to be rendered.
@@ -693,6 +1123,267 @@ void render(const Document* doc, float* color, std::size_t w, std::size_t h) noe
 /// This can be generated with @ref createImage
 void render(const Document* doc, Image* image) noexcept;
 
+/// Renders the document onto a color buffer, using multiple threads.
+///
+/// The color buffer is split into horizontal tiles, which are
+/// painted in parallel. The result is identical to the result
+/// of the single threaded render functions. Flood fill operations
+/// depend on everything painted before them, so they are painted
+/// on the calling thread after all of the tiles are caught up.
+///
+/// @param doc The document to be rendered.
+///
+/// @param color The color buffer to render to.
+/// There must be 4 floats per color, since the
+/// color format is RGBA.
+///
+/// @param w The width of the color buffer.
+/// @param h The height of the color buffer.
+///
+/// @param threadCount The maximum number of threads to render with,
+/// including the calling thread. If this is zero, then the number of
+/// hardware threads is used.
+void render(const Document* doc, float* color, std::size_t w, std::size_t h, std::size_t threadCount) noexcept;
+
+/// Renders the document onto an instance of @ref Image, using multiple threads.
+///
+/// @param doc the document to be rendered.
+///
+/// @param image The image to render the document onto.
+///
+/// @param threadCount The maximum number of threads to render with,
+/// including the calling thread. If this is zero, then the number of
+/// hardware threads is used.
+void render(const Document* doc, Image* image, std::size_t threadCount) noexcept;
+
+/// Renders a region of the document onto a color buffer
+/// that already contains a render of the document.
+///
+/// This is used after the document is modified, so that only the
+/// pixels that were affected by the modification get painted again.
+/// The region is cleared and every node is painted again, but nodes
+/// (and line segments) outside of the region are skipped. The pixels
+/// within the region are identical to what a full render would produce.
+/// The region of a modification can be found by combining the bounds
+/// of the modified nodes, before and after modifying them.
+///
+/// Fills are painted with the region they found the last time they were
+/// rendered, so the color buffer should contain the latest render of the
+/// document. When the region reaches the pixels that decide what a fill
+/// covers, it's grown to include them. If a fill then covers a different
+/// area than it did before, or if it hasn't been rendered at this size
+/// yet, the entire document is rendered instead. The same happens when a
+/// copy of the document that shares the fill was rendered after it, since
+/// the region it found is then the one for the copy. Only the single
+/// threaded full render and the region render itself leave regions
+/// behind that a later region render can use.
+///
+/// @param doc The document to be rendered.
+///
+/// @param color The color buffer to render to.
+///
+/// @param w The width of the color buffer.
+/// @param h The height of the color buffer.
+///
+/// @param x1 The left side of the region (inclusive.)
+/// @param y1 The top side of the region (inclusive.)
+/// @param x2 The right side of the region (exclusive.)
+/// @param y2 The bottom side of the region (exclusive.)
+void render(const Document* doc, float* color, std::size_t w, std::size_t h, int x1, int y1, int x2, int y2) noexcept;
+
+/// Renders a region of the document onto an
+/// image that already contains a render of the document.
+///
+/// @param doc the document to be rendered.
+///
+/// @param image The image to render the document onto.
+///
+/// @param x1 The left side of the region (inclusive.)
+/// @param y1 The top side of the region (inclusive.)
+/// @param x2 The right side of the region (exclusive.)
+/// @param y2 The bottom side of the region (exclusive.)
+void render(const Document* doc, Image* image, int x1, int y1, int x2, int y2) noexcept;
+
+/// Renders the document onto an 8-bit RGBA color buffer.
+///
+/// The document is painted a band of rows at a time and each band
+/// is converted to bytes as soon as it's painted, so a floating point
+/// copy of the whole image is not needed. If the document has a visible
+/// fill operation, the whole image is painted before being converted.
+///
+/// Each channel is converted by multiplying it by 255 and truncating
+/// the result, which is the same as converting the color buffer of
+/// an image that was rendered with one of the other functions.
+///
+/// @exception std::bad_alloc If the band can't be allocated.
+///
+/// @param doc The document to be rendered.
+///
+/// @param rgba The color buffer to render to.
+/// There must be 4 bytes per pixel, in the order of RGBA.
+///
+/// @param w The width of the color buffer.
+/// @param h The height of the color buffer.
+///
+/// @param premultiplied Whether or not the color channels
+/// are premultiplied by the alpha channel. If this is false,
+/// the alpha channel is divided out of the color channels.
+void render(const Document* doc, unsigned char* rgba, std::size_t w, std::size_t h, bool premultiplied = true);
+
+/// @defgroup pxCompositorApi Compositor API
+///
+/// @brief Used for rendering documents with cached layers.
+///
+/// @details A compositor keeps a rendering of each layer and
+/// composites the layers onto the image. A layer is only painted
+/// again when its nodes are modified, so showing or hiding a layer
+/// only costs a composite.
+///
+/// Only layers that look the same either way are cached: layers
+/// whose strokes are all blended normally. A layer that has a fill or
+/// a subtracting stroke is painted onto the layers beneath it on every
+/// frame, the same way as the other render functions paint it. The
+/// opacity of a layer is part of its rendering, so changing it costs
+/// painting that one layer again. The result is the same as that of
+/// @ref render, except for rounding.
+///
+/// Each cached layer takes up a full size float buffer, which is
+/// 16 bytes per pixel, or about 33 MB at 1920x1080. A compositor keeps
+/// at most 256 MB of them, and paints the layers past that in place.
+
+/// Creates a new compositor.
+///
+/// @exception std::bad_alloc If the allocation fails.
+///
+/// @return A new compositor. It should be released
+/// with @ref closeCompositor when it is no longer needed.
+///
+/// @ingroup pxCompositorApi
+Compositor* createCompositor();
+
+/// Releases the memory allocated by a compositor.
+///
+/// @param compositor The compositor to release.
+/// This may be a null pointer.
+///
+/// @ingroup pxCompositorApi
+void closeCompositor(Compositor* compositor) noexcept;
+
+/// Renders the document onto a color buffer,
+/// using the layers cached by a compositor.
+///
+/// @exception std::bad_alloc If a layer has to be
+/// painted and there isn't enough memory for it.
+///
+/// @param doc The document to be rendered.
+///
+/// @param color The color buffer to render to.
+/// There must be 4 floats per color, since the
+/// color format is RGBA.
+///
+/// @param w The width of the color buffer.
+/// @param h The height of the color buffer.
+///
+/// @param compositor The compositor containing the layers
+/// cached from the last time the document was rendered.
+///
+/// @ingroup pxCompositorApi
+void render(const Document* doc, float* color, std::size_t w, std::size_t h, Compositor* compositor);
+
+/// Renders the document onto an instance of @ref Image,
+/// using the layers cached by a compositor.
+///
+/// @exception std::bad_alloc If a layer has to be
+/// painted and there isn't enough memory for it.
+///
+/// @param doc The document to be rendered.
+///
+/// @param image The image to render the document onto.
+///
+/// @param compositor The compositor containing the layers
+/// cached from the last time the document was rendered.
+///
+/// @ingroup pxCompositorApi
+void render(const Document* doc, Image* image, Compositor* compositor);
+
+/// @defgroup pxDisplayListApi Display List API
+///
+/// @brief Used for rendering a document many times without changes.
+///
+/// @details A display list is compiled from a document for a certain
+/// image size. The strokes of each layer are compiled to the spans of
+/// pixels that they cover, with their colors already combined with the
+/// opacity of the layer, so rendering the list only blends the spans.
+/// Fills are painted when the list is rendered, since they depend on
+/// the pixels painted before them.
+///
+/// Compiling a document again only compiles the layers that changed
+/// since the last compilation. The result of rendering a display list
+/// is identical to the result of @ref render for the same document.
+
+/// Creates a new, empty display list.
+///
+/// @exception std::bad_alloc If the allocation fails.
+///
+/// @return A new display list. It should be released
+/// with @ref closeDisplayList when it is no longer needed.
+///
+/// @ingroup pxDisplayListApi
+DisplayList* createDisplayList();
+
+/// Releases the memory allocated by a display list.
+///
+/// @param list The display list to release.
+/// This may be a null pointer.
+///
+/// @ingroup pxDisplayListApi
+void closeDisplayList(DisplayList* list) noexcept;
+
+/// Compiles a document into a display list.
+/// Layers that haven't changed since the list was last
+/// compiled are kept, unless the image size has changed.
+///
+/// @exception std::bad_alloc If a layer has to be compiled
+/// and there isn't enough memory for it. The display list
+/// is left as it was before the call.
+///
+/// @param doc The document to compile.
+///
+/// @param w The width of the image that the list is rendered onto.
+/// @param h The height of the image that the list is rendered onto.
+///
+/// @param list The display list to compile the document into.
+///
+/// @ingroup pxDisplayListApi
+void compileDoc(const Document* doc, std::size_t w, std::size_t h, DisplayList* list);
+
+/// Renders a display list onto a color buffer.
+///
+/// @param list The display list to render.
+///
+/// @param color The color buffer to render to.
+/// There must be 4 floats per color, since the
+/// color format is RGBA.
+///
+/// @param w The width of the color buffer.
+/// @param h The height of the color buffer.
+/// If the size is not the size that the list was compiled
+/// for, then nothing is rendered.
+///
+/// @ingroup pxDisplayListApi
+void render(const DisplayList* list, float* color, std::size_t w, std::size_t h) noexcept;
+
+/// Renders a display list onto an instance of @ref Image.
+///
+/// @param list The display list to render.
+///
+/// @param image The image to render the list onto. If the
+/// image is not the size that the list was compiled for,
+/// then nothing is rendered.
+///
+/// @ingroup pxDisplayListApi
+void render(const DisplayList* list, Image* image) noexcept;
+
 /// @defgroup pxErrorListApi Error List API
 ///
 /// @brief Used for examining errors reporting from opening a file.